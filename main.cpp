@@ -12,17 +12,114 @@
 #include <sys/epoll.h>
 
 #include "./util/lst_timer.h"
+#include "./util/coarse_clock.h"
+#include "./util/idle_lru.h"
+#include "./util/rate_limit.h"
+#include "./util/trace.h"
+#include "./util/router.h"
+#include "./util/websocket.h"
+#include "./util/busy_poll.h"
+#include "./util/dgram_fetch.h"
+#include "./util/server_policy.h"
 #include <assert.h>
+#include <vector>
+
+const int MAX_FD = 65535; //最大套接字个数
+const int MAX_EVENTS = 10000; //一次监听的最大事件数量
+const int MAX_IDLE = 10000; //最多保持的空闲keep-alive连接数，超过后驱逐最久未活动的
+const unsigned int CONN_RATE = 200;   //每个客户端IP每秒可以新建的连接数，超过后accept完直接关闭
+const unsigned int CONN_BURST = 400;
+const unsigned int REQ_RATE = 2000;   //每个客户端IP每秒可以发的请求数，超过后回复429并断开
+const unsigned int REQ_BURST = 4000;
+const int RATE_PREFIX_V4 = 32;        //IPv4按这个前缀长度合并成一个限流对象
+const int RATE_PREFIX_V6 = 64;        //IPv6的前缀长度，一般一个用户分到一个/64
+const unsigned int TRACE_SAMPLE = 100; //每多少个请求分阶段追踪一个，0关闭；SIGUSR1导出
+const unsigned int POOL_WEIGHT_FAST = 8;   //线程池三个优先级队列的权重，积压时按这个比例轮流取任务
+const unsigned int POOL_WEIGHT_NORMAL = 4;
+const unsigned int POOL_WEIGHT_BULK = 1;
+const unsigned int POOL_CLIENT_QUOTA = 2;  //同一客户端（按限流的地址前缀）最多同时占用的工作线程数，0不限
+const bool INLINE_FAST_PATH = true;   //主循环直接回答资源包命中等廉价请求，false时全部交给线程池
+const unsigned int BUSY_POLL_US = 0;   //主循环处理完事件后忙轮询这么多微秒再阻塞，窗口按命中情况自适应，0关闭；
+const char* BUSY_POLL_ENV = "BUSY_POLL_US"; //环境变量可以覆盖，需要给主循环留出专用的核
+const char* DGRAM_LISTEN = "";         //UDP分段取文件的监听地址（写法同TCP，如"8443"），空为关闭；环境变量覆盖
+const char* DGRAM_LISTEN_ENV = "DGRAM_LISTEN";
+const char* DGRAM_OFFLOAD_ENV = "DGRAM_OFFLOAD"; //设为0时不用GSO/GRO，逐个数据报收发，用于对比
+const char* WS_PATH = "/ws";           //WebSocket升级的路径，连上的客户端互相广播收到的消息
+const char* SSE_PATH = "/events";      //Server-Sent Events订阅路径，事件由POST /api/publish?event=名字 发布，请求体是数据
+const size_t SSE_QUEUE = 256;          //每个订阅者最多积压的事件数；环境变量SSE_QUEUE覆盖
+const char* SSE_QUEUE_ENV = "SSE_QUEUE";
+const char* SSE_SLOW_ENV = "SSE_SLOW"; //积压满时的处理：drop（默认）丢最旧的事件，close断开订阅者
+const size_t ZEROCOPY_MIN = 64 * 1024; //明文连接上不小于这个大小的响应体用MSG_ZEROCOPY发送，0关闭
+const size_t WRITE_BUDGET = 256 * 1024; //一个连接每次可写时最多发这么多字节，之后让给其它就绪连接，0不限；
+const char* WRITE_BUDGET_ENV = "WRITE_BUDGET"; //环境变量可以覆盖
+const int SEND_WINDOW = 512 * 1024;    //每个连接在内核里排队未发出的数据上限（TCP_NOTSENT_LOWAT），可被SOCK_PROFILE覆盖
+const unsigned int MIN_SEND_RATE = 4096; //发送响应时每秒至少被读走的字节数，慢于它的连接在定时器到期时断开，0不限
+//两个监听端口的socket选项，默认值见sock_profile；环境变量可以覆盖，格式如"nodelay=0,sndbuf=262144"，
+//SOCK_PROFILE作用于两个端口，SOCK_PROFILE_HTTPS再单独覆盖HTTPS端口
+const char* SOCK_PROFILE_ENV = "SOCK_PROFILE";
+const char* SOCK_PROFILE_HTTPS_ENV = "SOCK_PROFILE_HTTPS";
 
 static int pipefd[2];
-static sort_timer_lst timer_lst;
+using server_pool = mirror::selected_policy::pool<http_conn>;
+static mirror::selected_policy::timer_list timer_lst;
+static idle_lru idle_conns(MAX_FD, MAX_IDLE);
+static mirror::rate_limiter conn_limiter(CONN_RATE, CONN_BURST);
+static mirror::rate_limiter req_limiter(REQ_RATE, REQ_BURST);
+static mirror::sock_profile http_profile;
+static mirror::sock_profile https_profile;
+// 一个监听socket，地址的写法见listen_on
+struct listener {
+    int fd;
+    int family;
+    bool tls;
+};
+static std::vector<listener> listeners;
+static mirror::router api_router;
+static server_pool* api_pool = nullptr;
+static mirror::ws_hub<http_conn> ws_hub(WS_PATH);
+static mirror::sse_hub<http_conn> sse_hub(SSE_PATH, SSE_QUEUE, mirror::SSE_DROP_OLDEST);
+static mirror::busy_poller poller(BUSY_POLL_US);
+static int dgram_fd = -1;
+static mirror::udp_rx_batch* dgram_rx = nullptr;
+static mirror::udp_tx_batch* dgram_tx = nullptr;
+static mirror::dgram_tokens* dgram_tokens = nullptr;
+static unsigned long stale_events = 0; //句柄属于已关闭连接、被丢弃的epoll事件
+// 只在主循环上读写的计数，主循环每轮末尾抄一份到这里；接口处理器可能在工作线程上执行，只读这份快照
+struct loop_snapshot {
+    std::atomic<int> connections{0};
+    std::atomic<int> idle{0};
+    std::atomic<size_t> websocket{0};
+    std::atomic<size_t> sse_subscribers{0};
+    std::atomic<unsigned long long> sse_published{0};
+    std::atomic<unsigned long long> sse_dropped{0};
+    std::atomic<unsigned long long> sse_disconnected{0};
+    std::atomic<unsigned long long> spin_ns{0};
+    std::atomic<unsigned long long> block_ns{0};
+    std::atomic<unsigned long long> spin_hits{0};
+    std::atomic<unsigned long long> spin_misses{0};
+    std::atomic<long long> window_ns{0};
+    std::atomic<unsigned long> stale_events{0};
+};
+static loop_snapshot loop_stats;
 const unsigned int TIMESLOT = 5;
 static int epfd = 0;
 
+#ifdef CORO_CONN
+// 协程模式：每个连接是一个在主循环上运行的协程，不经过线程池和util_timer
+#include "./util/coro.h"
+static mirror::coro_reactor reactor(MAX_FD);
+static mirror::io_offload io_offload;
+static mirror::proxy_table proxy;
+const char* PROXY_CONF = "proxy.conf"; //反向代理路由配置，不存在时只提供静态文件
+#endif
+
 void timer_handler()
 {
     // 定时处理任务，实际上就是调用tick()函数
     timer_lst.tick();
+    // 顺带清理已经补满的限流条目
+    conn_limiter.expire();
+    req_limiter.expire();
     // 因为一次 alarm 调用只会引起一次SIGALARM 信号，所以我们要重新定时，以不断触发 SIGALARM信号。
     alarm(TIMESLOT);
 }
@@ -30,8 +127,161 @@ void timer_handler()
 void cb_func( http_conn* user_data )
 {
     assert( user_data );
-    epoll_rm(epfd, user_data->m_sockfd);
     printf( "close fd %d\n", user_data->m_sockfd );
+    idle_conns.remove( user_data->m_sockfd );
+    user_data->timer = nullptr;
+#ifdef CORO_CONN
+    if( reactor.cancel( user_data->m_sockfd ) ) {
+        return; // 挂起的协程被唤醒后自己关闭连接
+    }
+    if( user_data->m_sockfd != -1 ) {
+        reactor.set_handle( user_data->m_sockfd, 0 );
+    }
+#endif
+    user_data->close_conn();
+}
+
+// 连接的定时器到期：正在以不低于最低速率发送响应的连接再给一轮时间；WebSocket连接先发一个ping
+// 再给一轮时间，上一个ping也没有回应才关闭；事件流连接发心跳，积压的事件一直发不出去才关闭
+void timer_expired( http_conn* user_data )
+{
+    if( !user_data->send_progressing() && !user_data->ws_ping() && !user_data->sse_ping() ) {
+        cb_func( user_data );
+        return;
+    }
+    util_timer* timer = new util_timer;
+    timer->user_data = user_data;
+    timer->handle = user_data->handle();
+    timer->cb_func = timer_expired;
+    timer->expire = coarse_clock::now() + 3 * TIMESLOT;
+    user_data->timer = timer;
+    timer_lst.add_timer( timer );
+}
+
+// UDP取文件的请求：每次最多处理几批，剩下的等下一轮（水平触发），不让大量请求占住主循环
+void dgram_serve()
+{
+    for( int i = 0; i < 8; ++i ) {
+        int n = dgram_rx->recv( []( const sockaddr_storage& peer, socklen_t len, const char* data, size_t size ) {
+            mirror::dgram_respond( http_conn::m_assets, *dgram_tokens, peer, len, data, size, *dgram_tx );
+        } );
+        if( n < mirror::udp_rx_batch::BATCH ) {
+            break;
+        }
+    }
+    dgram_tx->flush();
+}
+
+// fd或内存紧张时，关闭最久未活动的空闲keep-alive连接，成功驱逐返回true
+bool evict_idle( http_conn* users )
+{
+    int fd = idle_conns.pop_lru();
+    if( fd == -1 ) {
+        return false;
+    }
+    util_timer* timer = users[fd].timer;
+    printf( "evict idle fd %d\n", fd );
+    cb_func( &users[fd] );
+    timer_lst.del_timer( timer );
+    return true;
+}
+
+// 响应发完、连接进入空闲状态时登记到LRU，超过上限就驱逐最久未活动的
+void touch_idle( http_conn* users, int fd )
+{
+    idle_conns.touch( fd );
+    if( idle_conns.over_limit() ) {
+        evict_idle( users );
+    }
+}
+
+// 按逗号分隔的地址列表逐个创建监听socket
+void listen_all( const char* specs, bool tls, const mirror::sock_profile* profile )
+{
+    char buf[ 1024 ];
+    snprintf( buf, sizeof( buf ), "%s", specs );
+    char* save = nullptr;
+    for( char* spec = strtok_r( buf, ",", &save ); spec; spec = strtok_r( nullptr, ",", &save ) ) {
+        listener l;
+        l.fd = listen_on( spec, profile, &l.family );
+        l.tls = tls;
+        listeners.push_back( l );
+        printf( "%s listening on %s\n", tls ? "https" : "http", spec );
+    }
+}
+
+// 事件来自监听socket时返回它，否则返回nullptr。监听socket只有几个，顺序查找即可
+const listener* find_listener( int fd )
+{
+    for( const listener& l : listeners ) {
+        if( l.fd == fd ) {
+            return &l;
+        }
+    }
+    return nullptr;
+}
+
+// 内置的JSON接口。处理器在reactor或工作线程上执行，不能阻塞，只读全局状态
+
+// 健康检查，给负载均衡器探活用
+void api_health( const mirror::http_request&, mirror::response_builder& res )
+{
+    res.write( "{\"status\":\"ok\"}" );
+}
+
+// 主循环每轮调用一次，写快照只是几次relaxed store
+void publish_loop_stats()
+{
+    const mirror::busy_poll_stats& bp = poller.stats();
+    const mirror::sse_stats& ss = sse_hub.stats();
+    loop_stats.connections.store( http_conn::m_user_cnt, std::memory_order_relaxed );
+    loop_stats.idle.store( idle_conns.size(), std::memory_order_relaxed );
+    loop_stats.websocket.store( ws_hub.size(), std::memory_order_relaxed );
+    loop_stats.sse_subscribers.store( sse_hub.size(), std::memory_order_relaxed );
+    loop_stats.sse_published.store( ss.published, std::memory_order_relaxed );
+    loop_stats.sse_dropped.store( ss.dropped, std::memory_order_relaxed );
+    loop_stats.sse_disconnected.store( ss.disconnected, std::memory_order_relaxed );
+    loop_stats.spin_ns.store( bp.spin_ns, std::memory_order_relaxed );
+    loop_stats.block_ns.store( bp.block_ns, std::memory_order_relaxed );
+    loop_stats.spin_hits.store( bp.hits, std::memory_order_relaxed );
+    loop_stats.spin_misses.store( bp.misses, std::memory_order_relaxed );
+    loop_stats.window_ns.store( bp.window_ns, std::memory_order_relaxed );
+    loop_stats.stale_events.store( stale_events, std::memory_order_relaxed );
+}
+
+// 连接数、线程池和各优先级队列的排队情况，只对本机开放
+void api_stats( const mirror::http_request&, mirror::response_builder& res )
+{
+    mirror::pool_stats st = api_pool->stats();
+    const loop_snapshot& ls = loop_stats;
+    res.printf( "{\"connections\":%d,\"idle\":%d,\"websocket\":%zu,\"sse\":{\"subscribers\":%zu,\"published\":%llu,"
+                "\"dropped\":%llu,\"disconnected\":%llu},\"loop\":{\"spin_ms\":%llu,\"block_ms\":%llu,"
+                "\"spin_hits\":%llu,\"spin_misses\":%llu,\"window_us\":%lld},\"pool\":{\"threads\":%u,\"queued\":%zu,\"utilization\":%.2f,"
+                "\"wait_us\":[%.0f,%.0f,%.0f],\"quota_waits\":%lu},\"stale\":{\"events\":%lu,\"tasks\":%lu}}",
+                ls.connections.load(), ls.idle.load(), ls.websocket.load(), ls.sse_subscribers.load(),
+                ls.sse_published.load(), ls.sse_dropped.load(), ls.sse_disconnected.load(),
+                ls.spin_ns.load() / 1000000, ls.block_ns.load() / 1000000, ls.spin_hits.load(), ls.spin_misses.load(),
+                ls.window_ns.load() / 1000, st.threads, st.queue_len, st.utilization,
+                st.lane_wait_us[mirror::LANE_FAST], st.lane_wait_us[mirror::LANE_NORMAL], st.lane_wait_us[mirror::LANE_BULK],
+                st.quota_waits, ls.stale_events.load(), st.stale_tasks );
+}
+
+// 发布一个事件给所有事件流订阅者，只对本机开放：POST /api/publish?event=名字，请求体是数据（可以多行）
+void api_publish( const mirror::http_request& req, mirror::response_builder& res )
+{
+    unsigned long long id = sse_hub.publish( req.param( "event" ), req.body );
+    res.printf( "{\"id\":%llu}", id );
+}
+
+// 回显请求的各部分（包括请求头），调试客户端和前置代理用，只对本机开放：/api/echo/<任意>?k=v
+void api_echo( const mirror::http_request& req, mirror::response_builder& res )
+{
+    res.write( "{\"method\":" ).json_string( req.method );
+    res.write( ",\"path\":" ).json_string( req.path );
+    res.write( ",\"rest\":" ).json_string( req.rest );
+    res.write( ",\"query\":" ).json_string( req.query );
+    res.write( ",\"user_agent\":" ).json_string( req.header( "User-Agent" ) );
+    res.write( ",\"body\":" ).json_string( req.body ).write( "}" );
 }
 
 void sig_handler( int sig )
@@ -42,30 +292,106 @@ void sig_handler( int sig )
     errno = save_errno;
 }
 
-
-const int MAX_FD = 65535; //最大套接字个数
-const int MAX_EVENTS = 10000; //一次监听的最大事件数量
-
 int main(int argc, char* argv[]) {
-    ARGC_CHECK(argc, 2 , "wrong format!");
+    ARGC_CHECK(argc, 2, 5, "usage: server listen[,listen...] [https_listen[,...] cert.pem key.pem]\n"
+                           "listen: port (IPv6 dual-stack) | ip:port | [ipv6]:port | unix:/path | unix:@abstract");
     catch_sig(SIGPIPE, SIG_IGN); //SIGPIPE默认终止程序，改成忽略
     int ret;
 
     //线程池的创建
-    mirror::thread_pool<http_conn> *pool = nullptr;
+    server_pool *pool = nullptr;
     try {
-        pool = new mirror::thread_pool<http_conn>();
+        pool = new server_pool();
     }
     catch(...) {
         printf("error constructing pool!\n");
         exit(-1);
     }
 
+    pool->set_weights(POOL_WEIGHT_FAST, POOL_WEIGHT_NORMAL, POOL_WEIGHT_BULK);
+    pool->set_quota(POOL_CLIENT_QUOTA);
+    printf("policy: %s, %s, %s, %s\n", mirror::policy_name<mirror::selected_timers>::value,
+           mirror::policy_name<mirror::selected_sizing>::value, mirror::policy_name<mirror::selected_queue>::value,
+#ifdef CORO_CONN
+           "coroutine connections");
+#else
+           "threaded connections");
+#endif
+
     http_conn *users = new http_conn[MAX_FD]; //存放客户端信息
 
-    int lfd = listen_init(nullptr, argv[1], true);
+    api_pool = pool;
+    api_router.add(mirror::ROUTE_GET, "/api/health", api_health);
+    api_router.add(mirror::ROUTE_GET, "/api/stats", api_stats, false, true);
+    api_router.add(mirror::ROUTE_ANY, "/api/echo/*", api_echo, false, true);
+    api_router.add(mirror::ROUTE_POST, "/api/publish", api_publish, false, true);
+    http_conn::m_router = &api_router;
+    http_conn::m_ws_hub = &ws_hub;
+    http_conn::m_sse_hub = &sse_hub;
+
+#ifdef ASSET_PACK_PATH
+    if(!http_conn::m_assets.open(ASSET_PACK_PATH)) {
+        printf("asset pack %s not loaded, serving from %s\n", ASSET_PACK_PATH, doc_root);
+    }
+#endif
 
-    epfd = epoll_init(lfd);
+    http_profile.notsent_lowat = https_profile.notsent_lowat = SEND_WINDOW;
+    const char* spec = getenv(SOCK_PROFILE_ENV);
+    if(spec && !(http_profile.parse(spec) && https_profile.parse(spec))) {
+        printf("unknown option in %s=%s\n", SOCK_PROFILE_ENV, spec);
+    }
+    spec = getenv(SOCK_PROFILE_HTTPS_ENV);
+    if(spec && !https_profile.parse(spec)) {
+        printf("unknown option in %s=%s\n", SOCK_PROFILE_HTTPS_ENV, spec);
+    }
+    spec = getenv(WRITE_BUDGET_ENV);
+    http_conn::m_write_budget = spec ? strtoul(spec, nullptr, 10) : WRITE_BUDGET;
+    spec = getenv(SSE_QUEUE_ENV);
+    const char* slow = getenv(SSE_SLOW_ENV);
+    sse_hub.set_policy(slow && strcmp(slow, "close") == 0 ? mirror::SSE_DISCONNECT : mirror::SSE_DROP_OLDEST,
+                       spec ? strtoul(spec, nullptr, 10) : SSE_QUEUE);
+    spec = getenv(BUSY_POLL_ENV);
+    if(spec) {
+        poller.set_max_us(atoi(spec));
+    }
+    if(poller.enabled()) {
+        printf("busy poll window up to %lldus\n", poller.stats().window_ns / 1000);
+    }
+    http_profile.print("http");
+    listen_all(argv[1], false, &http_profile);
+
+    // 可选的UDP取文件端口，只回答资源包里的文件
+    spec = getenv(DGRAM_LISTEN_ENV);
+    spec = spec ? spec : DGRAM_LISTEN;
+    if(*spec) {
+        int family;
+        const char* offload = getenv(DGRAM_OFFLOAD_ENV);
+        bool on = !offload || atoi(offload) != 0;
+        dgram_fd = bind_on(spec, SOCK_DGRAM, &family);
+        dgram_rx = new mirror::udp_rx_batch(dgram_fd, on);
+        dgram_tx = new mirror::udp_tx_batch(dgram_fd, on);
+        dgram_tokens = new mirror::dgram_tokens();
+        printf("udp fetch listening on %s, gro %d gso %d\n", spec, dgram_rx->gro(), dgram_tx->gso());
+    }
+
+    // 可选的HTTPS监听端口，握手后由kTLS或OpenSSL负责加解密
+    if(argc == 5) {
+#ifdef WITH_TLS
+        http_conn::m_ssl_ctx = mirror::tls_ctx_init(argv[3], argv[4]);
+        https_profile.print("https");
+        listen_all(argv[2], true, &https_profile);
+#else
+        printf("built without OpenSSL, https listeners %s ignored\n", argv[2]);
+#endif
+    }
+
+    epfd = epoll_init(listeners[0].fd);
+    for(size_t i = 1; i < listeners.size(); ++i) {
+        epoll_add(epfd, listeners[i].fd, false);
+    }
+    if(dgram_fd != -1) {
+        epoll_add(epfd, dgram_fd, false);
+    }
 
     // 创建管道
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
@@ -75,47 +401,132 @@ int main(int argc, char* argv[]) {
     // 设置信号处理函数
     catch_sig( SIGALRM , sig_handler);
     catch_sig( SIGTERM , sig_handler);
+    catch_sig( SIGUSR1 , sig_handler);
+    mirror::trace::set_sampling( TRACE_SAMPLE );
     bool stop_server = false;
 
     struct epoll_event events[MAX_EVENTS];
+    coarse_clock::update();
     http_conn::m_epfd = epfd;
+#ifdef CORO_CONN
+    reactor.set_epfd(epfd);
+    http_conn::m_io_offload = &io_offload;
+    epoll_add(epfd, io_offload.event_fd(), false);
+    proxy.init(epfd, MAX_FD);
+    if(proxy.load(PROXY_CONF) > 0) {
+        http_conn::m_proxy = &proxy;
+    }
+#endif
     http_conn::m_user_cnt = 0;
+    http_conn::m_req_limiter = &req_limiter;
+    http_conn::m_rate_prefix = RATE_PREFIX_V4;
+    http_conn::m_rate_prefix_v6 = RATE_PREFIX_V6;
+    http_conn::m_zerocopy_min = ZEROCOPY_MIN;
+    http_conn::m_min_send_rate = MIN_SEND_RATE;
+    http_conn::m_send_check_ms = 3 * TIMESLOT * 1000;
 
     bool timeout = false;
     alarm(TIMESLOT);
 
     while(!stop_server) {
-        int num = epoll_wait(epfd, events, MAX_EVENTS, -1);
+#ifdef CORO_CONN
+        int num = poller.wait(epfd, events, MAX_EVENTS, reactor.next_timeout_ms());
+#else
+        int num = poller.wait(epfd, events, MAX_EVENTS, -1);
+#endif
         ERROR_CHK(num, -1, "epoll_wait", EINTR);
+        coarse_clock::update(); //本轮事件统一使用这一时刻
 
         for(int i = 0; i < num; ++i) {
-            int sfd = events[i].data.fd;
+            // 连接的事件带着注册时的句柄：这一批事件里前面刚关掉的连接，它的fd可能已经被后面的accept
+            // 复用，旧连接剩下的事件不能落到新连接上
+            uint64_t tag = events[i].data.u64;
+            int sfd = handle_fd(tag);
             unsigned int ev = events[i].events;
-            if(sfd == lfd) {
-                struct sockaddr_in clientaddr;
+            if(handle_gen(tag) && !users[sfd].is_current(tag)) {
+                ++stale_events;
+                continue;
+            }
+            if((ev & EPOLLERR) && users[sfd].m_sockfd == sfd && users[sfd].reap_zerocopy()) {
+                // 错误队列里只是零拷贝发送的完成通知，连接本身没有出错
+                ev &= ~EPOLLERR;
+#ifndef CORO_CONN
+                if(!(ev & (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP))) {
+                    users[sfd].rearm();
+                    continue;
+                }
+#endif
+            }
+            if(const listener* l = find_listener(sfd)) {
+                struct sockaddr_storage clientaddr;
                 socklen_t addrlen = sizeof(clientaddr);
-                int clientfd = accept(lfd, (sockaddr*)&clientaddr, &addrlen);
+                int clientfd = accept(sfd, (sockaddr*)&clientaddr, &addrlen);
+                if(clientfd == -1 && (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)) {
+                    //fd或内存耗尽，先驱逐一个空闲连接再重试，而不是拒绝新客户端
+                    if(!evict_idle(users)) {
+                        continue;
+                    }
+                    clientfd = accept(sfd, (sockaddr*)&clientaddr, &addrlen);
+                    if(clientfd == -1) {
+                        continue;
+                    }
+                }
                 ERROR_CHK(clientfd, -1, "accept");
 
-                if(http_conn::m_user_cnt >= MAX_FD) { //服务器正忙，无法处理用户请求
+                if(http_conn::m_user_cnt >= MAX_FD && !evict_idle(users)) { //服务器正忙，且没有可驱逐的空闲连接
+                    close(clientfd);
+                    continue;
+                }
+                if(clientfd >= MAX_FD) {
+                    close(clientfd);
+                    continue;
+                }
+                uint64_t rate_key = mirror::rate_key_or_exempt(clientaddr, RATE_PREFIX_V4, RATE_PREFIX_V6);
+                if(rate_key && !conn_limiter.allow(rate_key)) { //新建连接过快
                     close(clientfd);
                     continue;
                 }
 
-                users[clientfd].init(clientfd, clientaddr);
+                //Unix域socket上没有TCP选项可补，也不需要cork
+                mirror::sock_profile* profile = l->family == AF_UNIX ? nullptr : l->tls ? &https_profile : &http_profile;
+                users[clientfd].init(clientfd, clientaddr, l->tls, profile);
+#ifdef CORO_CONN
+                users[clientfd].serve(reactor, 3 * TIMESLOT * 1000).detach();
+                continue;
+#endif
 
                 // 创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，最后将定时器添加到链表timer_lst中
                 util_timer* timer = new util_timer;
                 timer->user_data = &users[clientfd];
-                timer->cb_func = cb_func;
-                time_t cur = time( NULL );
-                timer->expire = cur + 3 * TIMESLOT;
+                timer->handle = users[clientfd].handle();
+                timer->cb_func = timer_expired;
+                timer->expire = coarse_clock::now() + 3 * TIMESLOT;
                 users[clientfd].timer = timer;
                 timer_lst.add_timer( timer );
             }
+            else if(sfd == dgram_fd) {
+                dgram_serve();
+            }
+#ifdef CORO_CONN
+            else if(sfd == io_offload.event_fd()) {
+                // 阻塞I/O线程完成了预读，恢复对应的协程
+                io_offload.drain();
+            }
+            else if(sfd != pipefd[0]) {
+                // 唤醒挂起在该fd上的协程，挂断和错误由它在read/writev时自行发现
+                idle_conns.remove(sfd);
+                reactor.dispatch(sfd);
+                // 上游连接的fd不对应users中的客户端
+                if(users[sfd].m_sockfd == sfd && users[sfd].is_idle()) {
+                    touch_idle(users, sfd);
+                }
+            }
+#endif
             else if(ev & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 //异常断开
-                users[sfd].close_conn();
+                util_timer* timer = users[sfd].timer;
+                cb_func( &users[sfd] );
+                timer_lst.del_timer( timer );
             }
             else if(sfd == pipefd[0] && ev & EPOLLIN) {
                 // 处理信号
@@ -132,6 +543,14 @@ int main(int argc, char* argv[]) {
                                 timeout = true;
                                 break;
                             }
+                            case SIGUSR1:
+                            {
+                                // 导出各线程最近的追踪记录，写文件交给线程池，不阻塞主循环
+                                if( !pool->submit( []{ mirror::trace::dump_file(); } ) ) {
+                                    mirror::trace::dump_file();
+                                }
+                                break;
+                            }
                             case SIGTERM:
                             {
                                 stop_server = true;
@@ -141,19 +560,46 @@ int main(int argc, char* argv[]) {
                     }
                 }
             }
+            else if(users[sfd].tls_handshaking()) {
+                // 握手在主循环上推进，完成后等待第一个请求
+                int hs = users[sfd].tls_handshake();
+                if(hs < 0) {
+                    util_timer* timer = users[sfd].timer;
+                    cb_func( &users[sfd] );
+                    timer_lst.del_timer( timer );
+                }
+                else {
+                    users[sfd].arm(hs == 0 ? (uint32_t)users[sfd].tls_want() : (uint32_t)EPOLLIN);
+                }
+            }
             else if(ev & EPOLLIN) {
                 util_timer* timer = users[sfd].timer;
+                idle_conns.remove(sfd);
                 if(users[sfd].read()) {
 
                     // 如果某个客户端上有数据可读，则我们要调整该连接对应的定时器，以延迟该连接被关闭的时间。
                     if( timer ) {
-                        time_t cur = time( NULL );
-                        timer->expire = cur + 3 * TIMESLOT;
+                        timer->expire = coarse_clock::now() + 3 * TIMESLOT;
                         printf( "adjust timer once\n" );
                         timer_lst.adjust_timer( timer );
                     }
 
-                    pool->append(&users[sfd]);
+                    // WebSocket和事件流连接共享频道，只能在主循环上处理
+                    int handled = ( INLINE_FAST_PATH || users[sfd].is_ws() || users[sfd].is_sse() ) ? users[sfd].process_inline() : 0;
+                    if(handled == 0) {
+                        mirror::trace::mark(users[sfd].trace_id(), mirror::trace::ENQUEUE, sfd);
+                        pool->append(&users[sfd], users[sfd].lane(), users[sfd].m_rate_key, users[sfd].handle());
+                    }
+                    else if(handled < 0) {
+                        cb_func( &users[sfd] );
+                        if( timer )
+                        {
+                            timer_lst.del_timer( timer );
+                        }
+                    }
+                    else if(users[sfd].is_idle()) {
+                        touch_idle(users, sfd);
+                    }
                 }
                 else {
                     cb_func( &users[sfd] );
@@ -166,7 +612,13 @@ int main(int argc, char* argv[]) {
             }
             else if(ev & EPOLLOUT) {
                 if(!users[sfd].write()) {
-                    users[sfd].close_conn();
+                    util_timer* timer = users[sfd].timer;
+                    cb_func( &users[sfd] );
+                    timer_lst.del_timer( timer );
+                }
+                else if(users[sfd].is_idle()) {
+                    // 响应发送完毕，连接进入空闲状态
+                    touch_idle(users, sfd);
                 }
             }
             else {
@@ -174,15 +626,45 @@ int main(int argc, char* argv[]) {
             }
         }
 
+#ifdef CORO_CONN
+        reactor.tick();
+#endif
         // 最后处理定时事件，因为I/O事件有更高的优先级。当然，这样做将导致定时任务不能精准的按照预定的时间执行。
         if( timeout ) {
             timer_handler();
             timeout = false;
         }
+        // 本轮所有广播和ping攒在一起，每个订阅者只写一次；工作线程上发布的事件也在这里发出
+        ws_hub.flush();
+        sse_hub.flush();
+        publish_loop_stats();
     }
 
+    if(dgram_fd != -1) {
+        const mirror::udp_io_stats& rx = dgram_rx->stats();
+        const mirror::udp_io_stats& tx = dgram_tx->stats();
+        printf("udp fetch: rx %llu datagrams in %llu syscalls, tx %llu datagrams as %llu messages in %llu syscalls, dropped %llu, "
+               "retry %llu\n", rx.datagrams, rx.syscalls, tx.datagrams, tx.messages, tx.syscalls, tx.dropped, dgram_tokens->issued);
+        close(dgram_fd);
+        delete dgram_rx;
+        delete dgram_tx;
+        delete dgram_tokens;
+    }
+    printf("stale handles: %lu events, %lu pool tasks dropped\n", stale_events, pool->stats().stale_tasks);
+    if(poller.enabled()) {
+        const mirror::busy_poll_stats& bp = poller.stats();
+        printf("busy poll: spin %.1fs (%llu hits, %llu misses), blocked %.1fs in %llu waits\n",
+               bp.spin_ns / 1e9, bp.hits, bp.misses, bp.block_ns / 1e9, bp.blocks);
+    }
     close(epfd);
-    close(lfd);
+    for(const listener& l : listeners) {
+        close(l.fd);
+    }
+#ifdef WITH_TLS
+    if(http_conn::m_ssl_ctx) {
+        SSL_CTX_free(http_conn::m_ssl_ctx);
+    }
+#endif
     delete[] users;
     delete pool;
 
@@ -0,0 +1,29 @@
+#!/bin/sh
+# 对比主循环阻塞等待和不同忙轮询窗口（BUSY_POLL_US环境变量）下的请求延迟。
+# 每个窗口跑一轮单连接（纯往返延迟）和一轮多连接，最后一列是/api/stats里轮询和阻塞的时间。
+# 用法：tools/busy_poll_bench.sh <构建目录> [路径=/index.html] [多连接数=16] [秒数=3] [服务器=webserver_cpp11]
+BUILD=${1:?usage: $0 <build_dir> [path] [conns] [secs] [server]}
+URL_PATH=${2:-/index.html}
+CONNS=${3:-16}
+SECS=${4:-3}
+SERVER=${5:-webserver_cpp11}
+PORT=18080
+WINDOWS="0 10 50 200"
+
+cd "$BUILD" || exit 1
+printf "%-8s %6s %10s %9s %9s %9s  %s\n" window conns "req/s" "p50(us)" "p99(us)" "max(us)" "loop"
+for w in $WINDOWS; do
+    for c in 1 $CONNS; do
+        BUSY_POLL_US=$w ./$SERVER $PORT > /dev/null 2>&1 &
+        pid=$!
+        sleep 0.5
+        result=$(./http_bench 127.0.0.1 $PORT "$URL_PATH" $c $SECS | awk '
+            /^requests/ { rps = $5 }
+            /^latency/  { p50 = $4; p99 = $8; max = $10 }
+            END { printf "%10s %9s %9s %9s", rps, p50, p99, max }')
+        loop=$(curl -s http://127.0.0.1:$PORT/api/stats | sed -n 's/.*"loop":{\([^}]*\)}.*/\1/p')
+        printf "%-8s %6s %s  %s\n" "$w" "$c" "$result" "$loop"
+        kill $pid
+        wait $pid 2> /dev/null
+    done
+done
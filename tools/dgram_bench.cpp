@@ -0,0 +1,298 @@
+// UDP分段取文件压测：反复取同一个文件，保持window个区间在途，统计每秒取完的次数、吞吐和
+// 单次取完的延迟分位数。loss按比例随机丢掉收到的数据报（本机没有netem时模拟丢包），
+// 丢了的部分超时后只重新请求缺的那一段，其它区间照常进行。服务器回dgram_retry时换上新令牌，
+// 探测请求立即重发，其余区间等超时后带新令牌重新请求。
+// 用法：dgram_bench <ip> <port> <路径> [秒数=5] [丢包率%=0] [在途区间数=8] [gro=1]
+// 服务器用DGRAM_LISTEN打开UDP端口，DGRAM_OFFLOAD=0关掉GSO/GRO做对比
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "util/dgram_fetch.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static long long now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now().time_since_epoch()).count();
+}
+
+static const long long MIN_RTO_NS = 200000;
+static const size_t RANGE_BLOCKS = mirror::DGRAM_MAX_RANGE / mirror::DGRAM_PAYLOAD;
+
+// 一个已请求的区间
+struct range {
+    long long sent = 0;
+    long long deadline = 0;
+    size_t remaining = 0;   // 还没收到的数据报数
+    bool retransmitted = false;
+};
+
+struct fetcher {
+    int fd;
+    std::string path;
+    size_t window;
+    uint32_t id = 0;
+    long long started = 0;
+    long long probe_deadline = 0;      // 还不知道文件长度时第一个请求的超时
+    uint64_t token = 0;                // 服务器签发的地址令牌
+    uint64_t total = ~0ULL;
+    size_t blocks = 0;
+    size_t received = 0;
+    std::vector<char> got;
+    std::vector<range> ranges;
+    size_t next_range = 0;
+    size_t in_flight = 0;
+    long long srtt = 1000000;
+    unsigned long long requests = 0, rerequests = 0, stale = 0, retries = 0;
+
+    long long rto() const { return std::max(MIN_RTO_NS, 2 * srtt); }
+
+    void request(uint64_t offset, uint32_t length) {
+        char buf[sizeof(mirror::dgram_request) + 1024];
+        mirror::dgram_request req;
+        req.magic = htobe32(mirror::DGRAM_MAGIC);
+        req.id = htobe32(id);
+        req.offset = htobe64(offset);
+        req.length = htobe32(length);
+        req.path_len = htobe16(path.size());
+        req.reserved = 0;
+        req.token = htobe64(token);
+        memcpy(buf, &req, sizeof(req));
+        memcpy(buf + sizeof(req), path.data(), path.size());
+        send(fd, buf, sizeof(req) + path.size(), 0);
+        ++requests;
+    }
+
+    void start() {
+        ++id;
+        started = now_ns();
+        total = ~0ULL;
+        received = 0;
+        ranges.clear();
+        in_flight = 0;
+        request(0, mirror::DGRAM_MAX_RANGE);
+        probe_deadline = started + rto();
+    }
+
+    // 知道总长度后按区间切分，第一个区间就是刚才的探测请求
+    void plan(uint64_t len) {
+        total = len;
+        blocks = (len + mirror::DGRAM_PAYLOAD - 1) / mirror::DGRAM_PAYLOAD;
+        got.assign(blocks, 0);
+        ranges.assign((blocks + RANGE_BLOCKS - 1) / RANGE_BLOCKS, range());
+        for(size_t r = 0; r < ranges.size(); ++r) {
+            ranges[r].remaining = std::min(RANGE_BLOCKS, blocks - r * RANGE_BLOCKS);
+        }
+        if(!ranges.empty()) {
+            ranges[0].sent = started;
+            ranges[0].deadline = probe_deadline;
+            in_flight = 1;
+        }
+        next_range = 1;
+    }
+
+    void fill() {
+        while(in_flight < window && next_range < ranges.size()) {
+            range& r = ranges[next_range];
+            r.sent = now_ns();
+            r.deadline = r.sent + rto();
+            request(next_range * mirror::DGRAM_MAX_RANGE, mirror::DGRAM_MAX_RANGE);
+            ++next_range;
+            ++in_flight;
+        }
+    }
+
+    // 处理一个响应数据报，返回这次取文件是否已经完成
+    bool on_datagram(const char* data, size_t len) {
+        mirror::dgram_retry r;
+        if(len == sizeof(r)) {
+            memcpy(&r, data, sizeof(r));
+            if(be32toh(r.magic) == mirror::DGRAM_RETRY_MAGIC) {
+                token = be64toh(r.token);
+                ++retries;
+                if(total == ~0ULL && be32toh(r.id) == id) {
+                    request(0, mirror::DGRAM_MAX_RANGE);
+                    probe_deadline = now_ns() + rto();
+                }
+                return false;
+            }
+        }
+        mirror::dgram_header h;
+        if(len < sizeof(h)) {
+            return false;
+        }
+        memcpy(&h, data, sizeof(h));
+        if(be32toh(h.id) != id) {
+            ++stale;
+            return false;
+        }
+        uint64_t t = be64toh(h.total);
+        if(t == mirror::DGRAM_NOT_FOUND) {
+            fprintf(stderr, "%s not found in the asset pack\n", path.c_str());
+            exit(-1);
+        }
+        if(total == ~0ULL) {
+            plan(t);
+        }
+        size_t n = len - sizeof(h);
+        uint64_t offset = be64toh(h.offset);
+        if(n > 0 && offset / mirror::DGRAM_PAYLOAD < blocks) {
+            size_t b = offset / mirror::DGRAM_PAYLOAD;
+            if(!got[b]) {
+                got[b] = 1;
+                ++received;
+                range& r = ranges[b / RANGE_BLOCKS];
+                if(--r.remaining == 0) {
+                    --in_flight;
+                    if(!r.retransmitted) {
+                        srtt = (srtt * 7 + (now_ns() - r.sent)) / 8;
+                    }
+                }
+            }
+        }
+        fill();
+        return received == blocks;
+    }
+
+    // 超时的区间只补缺的那一段；返回距最近一个超时的纳秒数
+    long long check_timeouts() {
+        long long now = now_ns();
+        if(total == ~0ULL) {
+            if(now >= probe_deadline) {
+                request(0, mirror::DGRAM_MAX_RANGE);
+                ++rerequests;
+                probe_deadline = now + rto();
+            }
+            return probe_deadline - now;
+        }
+        long long next = rto();
+        for(size_t i = 0; i < next_range; ++i) {
+            range& r = ranges[i];
+            if(r.remaining == 0) {
+                continue;
+            }
+            if(now >= r.deadline) {
+                size_t first = i * RANGE_BLOCKS, last = std::min(first + RANGE_BLOCKS, blocks);
+                while(got[first]) {
+                    ++first;
+                }
+                while(got[last - 1]) {
+                    --last;
+                }
+                request(first * mirror::DGRAM_PAYLOAD, (last - first) * mirror::DGRAM_PAYLOAD);
+                ++rerequests;
+                r.retransmitted = true;
+                r.deadline = now + rto();
+            }
+            next = std::min(next, r.deadline - now);
+        }
+        return next;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    if(argc < 4) {
+        printf("usage: %s <ip> <port> <path> [seconds=5] [loss%%=0] [window=8] [gro=1]\n", argv[0]);
+        return 1;
+    }
+    if(strlen(argv[3]) > 1024) {
+        printf("path too long\n");
+        return 1;
+    }
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+    double loss = argc > 5 ? atof(argv[5]) / 100 : 0;
+    size_t window = argc > 6 ? atoi(argv[6]) : 8;
+    bool gro = argc > 7 ? atoi(argv[7]) != 0 : true;
+
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    socklen_t len;
+    if(strchr(ip, ':')) {
+        sockaddr_in6& a6 = (sockaddr_in6&)ss;
+        a6.sin6_family = AF_INET6;
+        a6.sin6_port = htons(port);
+        inet_pton(AF_INET6, ip, &a6.sin6_addr);
+        len = sizeof(a6);
+    } else {
+        sockaddr_in& a4 = (sockaddr_in&)ss;
+        a4.sin_family = AF_INET;
+        a4.sin_port = htons(port);
+        inet_pton(AF_INET, ip, &a4.sin_addr);
+        len = sizeof(a4);
+    }
+    int fd = socket(ss.ss_family, SOCK_DGRAM, 0);
+    if(fd == -1 || connect(fd, (sockaddr*)&ss, len) == -1) {
+        perror("connect");
+        return -1;
+    }
+    int rcvbuf = 8 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    mirror::udp_rx_batch rx(fd, gro);
+    fetcher f;
+    f.fd = fd;
+    f.path = argv[3];
+    f.window = std::max<size_t>(window, 1);
+
+    std::mt19937_64 rng(12345);
+    std::bernoulli_distribution drop(loss);
+    unsigned long long dropped = 0, bytes = 0, size = 0;
+    std::vector<long long> latencies;
+
+    long long end = now_ns() + seconds * 1000000000LL;
+    f.start();
+    while(now_ns() < end) {
+        bool done = false;
+        int n = rx.recv([&](const sockaddr_storage&, socklen_t, const char* data, size_t size) {
+            if(done) {
+                return;
+            }
+            if(loss > 0 && drop(rng)) {
+                ++dropped;
+                return;
+            }
+            done = f.on_datagram(data, size);
+        });
+        if(done) {
+            latencies.push_back(now_ns() - f.started);
+            bytes += f.total;
+            size = f.total;
+            f.start();
+            continue;
+        }
+        long long wait = f.check_timeouts();
+        if(n == 0) {
+            struct pollfd p = {fd, POLLIN, 0};
+            struct timespec ts = {(time_t)(wait / 1000000000), (long)(wait % 1000000000)};
+            ppoll(&p, 1, &ts, NULL);
+        }
+    }
+
+    if(latencies.empty()) {
+        printf("no fetch completed\n");
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    const mirror::udp_io_stats& st = rx.stats();
+    printf("%zu fetches of %llu bytes in %ds: %.0f fetches/s, %.1f MB/s\n", latencies.size(),
+           size, seconds, latencies.size() / (double)seconds, bytes / 1e6 / seconds);
+    printf("fetch latency p50 %.1f us, p99 %.1f us, max %.1f us\n", latencies[latencies.size() / 2] / 1e3,
+           latencies[latencies.size() * 99 / 100] / 1e3, latencies.back() / 1e3);
+    printf("requests %llu, re-requests %llu (%.2f per fetch), dropped %llu, stale %llu, retry %llu\n", f.requests,
+           f.rerequests, f.rerequests / (double)latencies.size(), dropped, f.stale, f.retries);
+    printf("rx gro %d: %llu datagrams in %llu messages, %llu syscalls (%.1f datagrams per syscall)\n", rx.gro(),
+           st.datagrams, st.messages, st.syscalls, st.datagrams / (double)std::max(1ULL, st.syscalls));
+    return 0;
+}
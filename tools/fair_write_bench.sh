@@ -0,0 +1,43 @@
+#!/bin/sh
+# 大文件下载和小请求混跑：若干curl反复下载一个大文件，同时用http_bench测小请求的延迟，
+# 对比不限写预算和发送窗口（旧行为）与不同WRITE_BUDGET下小请求的尾延迟和大文件的总吞吐。
+# 大文件要放在doc_root下（不进资源包，走线程池和mmap）。
+# 用法：tools/fair_write_bench.sh <构建目录> [大文件路径=/big.bin] [下载数=4] [小请求连接数=8] [秒数=5] [服务器=webserver_cpp11]
+BUILD=${1:?usage: $0 <build_dir> [big_path] [downloads] [conns] [secs] [server]}
+BIG_PATH=${2:-/big.bin}
+DOWNLOADS=${3:-4}
+CONNS=${4:-8}
+SECS=${5:-5}
+SERVER=${6:-webserver_cpp11}
+PORT=18080
+# 每种配置：名字 WRITE_BUDGET SOCK_PROFILE
+CONFIGS="unlimited:0:notsent_lowat=0 window:0: budget256k:262144: budget64k:65536:"
+
+cd "$BUILD" || exit 1
+printf "%-11s %10s %9s %9s %9s %11s\n" config "req/s" "p50(us)" "p99(us)" "max(us)" "bulk(MB/s)"
+for c in $CONFIGS; do
+    name=${c%%:*}
+    rest=${c#*:}
+    budget=${rest%%:*}
+    profile=${rest#*:}
+    WRITE_BUDGET=$budget SOCK_PROFILE=$profile ./$SERVER $PORT > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    rm -f /tmp/fair_bulk.$$
+    jobs=""
+    for i in $(seq $DOWNLOADS); do
+        timeout $((SECS + 1)) sh -c "while :; do curl -s -o /dev/null -w '%{size_download}\n' http://127.0.0.1:$PORT$BIG_PATH >> /tmp/fair_bulk.$$; done" &
+        jobs="$jobs $!"
+    done
+    sleep 0.2
+    result=$(./http_bench 127.0.0.1 $PORT /index.html $CONNS $SECS | awk '
+        /^requests/ { rps = $5 }
+        /^latency/  { p50 = $4; p99 = $8; max = $10 }
+        END { printf "%10s %9s %9s %9s", rps, p50, p99, max }')
+    wait $jobs 2> /dev/null
+    bulk=$(awk -v s=$SECS '{ b += $1 } END { printf "%.0f", b / 1e6 / (s + 1) }' /tmp/fair_bulk.$$)
+    printf "%-11s %s %11s\n" "$name" "$result" "$bulk"
+    kill $pid
+    wait $pid 2> /dev/null
+done
+rm -f /tmp/fair_bulk.$$
@@ -0,0 +1,286 @@
+// 简单的 HTTP/1.1 keep-alive 压测客户端：若干连接在一个 epoll 上循环发送同一个 GET，
+// 统计吞吐和单请求延迟分位数，用来对比不同服务器版本/配置。
+// 给出服务器的pid时，压测期间在它的每个线程上挂perf计数器，输出每个请求的CPU时间和缓存缺失。
+// 用法：http_bench <ip> <port> <path> [连接数=64] [秒数=5] [服务器pid]
+// ip也可以是IPv6地址或unix:/path、unix:@name，用来对比Unix域socket和本机TCP
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+using bench_clock = std::chrono::steady_clock;
+
+struct client {
+    int fd = -1;
+    std::string in;
+    bench_clock::time_point start;
+};
+
+static long long elapsed_ns(bench_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - since).count();
+}
+
+// 找到一个完整响应则返回其长度，否则返回0
+static size_t response_len(const std::string& buf) {
+    size_t end = buf.find("\r\n\r\n");
+    if(end == std::string::npos) {
+        return 0;
+    }
+    size_t body = 0;
+    size_t pos = buf.find("Content-Length:");
+    if(pos != std::string::npos && pos < end) {
+        body = strtoul(buf.c_str() + pos + 15, NULL, 10);
+    }
+    size_t total = end + 4 + body;
+    return buf.size() >= total ? total : 0;
+}
+
+// 服务器所有线程上的一组perf计数器；虚拟机里常常没有硬件PMU，打不开的事件输出n/a
+class server_counters {
+public:
+    struct event { const char* name; uint32_t type; uint64_t config; };
+
+    explicit server_counters(int pid) {
+        for(size_t e = 0; e < EVENTS; ++e) {
+            m_fds[e] = open_all(pid, events()[e]);
+        }
+    }
+    ~server_counters() {
+        for(auto& fds : m_fds) {
+            for(int fd : fds) {
+                close(fd);
+            }
+        }
+    }
+    void start() {
+        for(auto& fds : m_fds) {
+            for(int fd : fds) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+    void report(size_t requests) {
+        printf("server per request:");
+        for(size_t e = 0; e < EVENTS; ++e) {
+            if(m_fds[e].empty() || requests == 0) {
+                printf("  %s n/a", events()[e].name);
+                continue;
+            }
+            uint64_t total = 0;
+            for(int fd : m_fds[e]) {
+                uint64_t v = 0;
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                if(::read(fd, &v, sizeof(v)) == sizeof(v)) {
+                    total += v;
+                }
+            }
+            double per = (double)total / requests;
+            if(events()[e].type == PERF_TYPE_SOFTWARE) {
+                printf("  %s %.2fus", events()[e].name, per / 1000.0); // task-clock以纳秒计
+            } else {
+                printf("  %s %.1f", events()[e].name, per);
+            }
+        }
+        printf("\n");
+    }
+
+private:
+    static const size_t EVENTS = 5;
+    static const event* events() {
+        static const event list[EVENTS] = {
+            {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+            {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {"cache-refs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+            {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {"L1d-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        };
+        return list;
+    }
+    // 每个线程单独开一个计数器，有一个打不开就当这个事件不可用
+    static std::vector<int> open_all(int pid, const event& ev) {
+        std::vector<int> fds;
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", pid);
+        DIR* dir = opendir(path);
+        if(!dir) {
+            return fds;
+        }
+        while(struct dirent* d = readdir(dir)) {
+            int tid = atoi(d->d_name);
+            if(tid <= 0) {
+                continue;
+            }
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = ev.type;
+            attr.config = ev.config;
+            attr.disabled = 1;
+            int fd = syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+            if(fd == -1) {
+                for(int f : fds) {
+                    close(f);
+                }
+                fds.clear();
+                break;
+            }
+            fds.push_back(fd);
+        }
+        closedir(dir);
+        return fds;
+    }
+    std::vector<int> m_fds[EVENTS];
+};
+
+// ip可以是IPv4、IPv6地址，或unix:/path、unix:@name（此时忽略端口）
+static int connect_to(const char* ip, int port) {
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    socklen_t len;
+    if(strncmp(ip, "unix:", 5) == 0) {
+        sockaddr_un& un = (sockaddr_un&)ss;
+        size_t n = std::min(strlen(ip + 5), sizeof(un.sun_path) - 1);
+        un.sun_family = AF_UNIX;
+        memcpy(un.sun_path, ip + 5, n);
+        bool abstract = ip[5] == '@';
+        if(abstract) {
+            un.sun_path[0] = '\0';
+        }
+        len = offsetof(sockaddr_un, sun_path) + n + !abstract;
+    } else if(strchr(ip, ':')) {
+        sockaddr_in6& a6 = (sockaddr_in6&)ss;
+        a6.sin6_family = AF_INET6;
+        a6.sin6_port = htons(port);
+        inet_pton(AF_INET6, ip, &a6.sin6_addr);
+        len = sizeof(a6);
+    } else {
+        sockaddr_in& a4 = (sockaddr_in&)ss;
+        a4.sin_family = AF_INET;
+        a4.sin_port = htons(port);
+        inet_pton(AF_INET, ip, &a4.sin_addr);
+        len = sizeof(a4);
+    }
+    int fd = socket(ss.ss_family, SOCK_STREAM, 0);
+    if(connect(fd, (sockaddr*)&ss, len) == -1) {
+        perror("connect");
+        exit(-1);
+    }
+    if(ss.ss_family != AF_UNIX) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 4) {
+        printf("usage: %s <ip> <port> <path> [connections] [seconds] [server_pid]\n", argv[0]);
+        return -1;
+    }
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+    int conns = argc > 4 ? atoi(argv[4]) : 64;
+    int seconds = argc > 5 ? atoi(argv[5]) : 5;
+    int server_pid = argc > 6 ? atoi(argv[6]) : 0;
+    std::string request = std::string("GET ") + argv[3] + " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+    int epfd = epoll_create1(0);
+    std::vector<client> clients(conns);
+    auto send_request = [&](client& c) {
+        c.start = bench_clock::now();
+        if(::send(c.fd, request.data(), request.size(), 0) != (ssize_t)request.size()) {
+            return false;
+        }
+        return true;
+    };
+    for(int i = 0; i < conns; ++i) {
+        clients[i].fd = connect_to(ip, port);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+        send_request(clients[i]);
+    }
+
+    std::vector<long long> latencies;
+    latencies.reserve(1 << 20);
+    long long errors = 0;
+    char buf[65536];
+    struct epoll_event events[1024];
+    std::unique_ptr<server_counters> counters(server_pid > 0 ? new server_counters(server_pid) : nullptr);
+    if(counters) {
+        counters->start();
+    }
+    auto begin = bench_clock::now();
+    auto deadline = begin + std::chrono::seconds(seconds);
+    while(bench_clock::now() < deadline) {
+        int n = epoll_wait(epfd, events, 1024, 100);
+        for(int i = 0; i < n; ++i) {
+            client& c = clients[events[i].data.u32];
+            while(true) {
+                ssize_t r = recv(c.fd, buf, sizeof(buf), 0);
+                if(r > 0) {
+                    c.in.append(buf, r);
+                    continue;
+                }
+                if(r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    // 服务器关闭了连接，重连继续
+                    ++errors;
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, NULL);
+                    close(c.fd);
+                    c.fd = connect_to(ip, port);
+                    c.in.clear();
+                    struct epoll_event ev;
+                    ev.events = EPOLLIN;
+                    ev.data.u32 = events[i].data.u32;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+                    send_request(c);
+                }
+                break;
+            }
+            size_t len;
+            while((len = response_len(c.in)) != 0) {
+                latencies.push_back(elapsed_ns(c.start));
+                c.in.erase(0, len);
+                send_request(c);
+            }
+        }
+    }
+    double secs = elapsed_ns(begin) / 1e9;
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) {
+        return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, (size_t)(latencies.size() * p))] / 1000.0;
+    };
+    printf("requests %zu in %.2fs, %.0f req/s, errors %lld\n", latencies.size(), secs, latencies.size() / secs, errors);
+    printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", pct(0.5), pct(0.9), pct(0.99), pct(1.0));
+    if(counters) {
+        counters->report(latencies.size());
+    }
+    for(auto& c : clients) {
+        close(c.fd);
+    }
+    close(epfd);
+    return 0;
+}
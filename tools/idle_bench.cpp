@@ -0,0 +1,372 @@
+// 空闲连接的开销和扩展性压测：分几步把并发连接数加到10k、100k，每个连接发一个请求后保持keep-alive，
+// 空闲（idle）或每隔几秒再发一个请求（trickle，连接不会被空闲定时器关掉，也让服务器不断调整定时器）。
+// 每一步记录建连速率、服务器RSS和内核socket内存的增量（换算成每个连接）、被服务器关掉的连接数，
+// 以及另一个活跃连接上小请求的延迟分位数。每一步输出一行JSON，方便存档对比；可读的摘要写到stderr。
+// 追加到文件（idle_bench ... >> idle.jsonl）即可跟踪历次结果。
+// 源地址轮流绑定到127.1.0.x上的多个地址，绕开单个源地址约2.8万个临时端口的限制。
+// 用法：idle_bench <ip> <port> <服务器pid|0> [步骤=1000,5000,10000] [模式=trickle|idle] [trickle间隔秒数=5]
+//                  [路径=/index.html] [源地址数=16]
+// 连接数受两边的ulimit -n限制，100k需要先调大；服务器的MAX_IDLE以外的空闲连接会被LRU驱逐
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
+using bench_clock = std::chrono::steady_clock;
+
+static long long now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now().time_since_epoch()).count();
+}
+
+static const int MAX_CONNECTING = 256; // 同时在握手中的连接数
+static const long long SETTLE_NS = 1000000000LL;
+static const long long PROBE_NS = 2000000000LL;
+
+struct conn {
+    int fd = -1;
+    bool connecting = false;
+    long long next_send = 0; // trickle模式下次发请求的时刻
+};
+
+// 从/proc读一个"键: 数值"格式的字段，没有时返回-1
+static long long proc_field(const char* path, const char* key) {
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        return -1;
+    }
+    char line[512];
+    long long v = -1;
+    size_t n = strlen(key);
+    while(fgets(line, sizeof(line), f)) {
+        if(strncmp(line, key, n) == 0) {
+            v = atoll(line + n);
+            break;
+        }
+    }
+    fclose(f);
+    return v;
+}
+
+// /proc/net/sockstat中TCP缓冲占用的页数（客户端和服务器两端的socket都算在里面）
+static long long tcp_mem_pages() {
+    FILE* f = fopen("/proc/net/sockstat", "r");
+    if(!f) {
+        return -1;
+    }
+    char line[512];
+    long long pages = -1;
+    while(fgets(line, sizeof(line), f)) {
+        const char* p = strstr(line, " mem ");
+        if(strncmp(line, "TCP:", 4) == 0 && p) {
+            pages = atoll(p + 5);
+        }
+    }
+    fclose(f);
+    return pages;
+}
+
+class bench {
+public:
+    bench(const sockaddr_in& server, const std::string& request, bool trickle, long long interval_ns, int sources)
+        : m_server(server), m_request(request), m_trickle(trickle), m_interval(interval_ns), m_sources(sources) {
+        m_epfd = epoll_create1(0);
+        m_events.resize(4096);
+    }
+
+    // 把连接数补到target，返回新建连接的速率（每秒）
+    double grow(size_t target) {
+        long long start = now_ns();
+        size_t opened = 0, wanted = target > m_conns.size() ? target - m_conns.size() : 0;
+        while(opened < wanted || m_connecting > 0) {
+            while(opened < wanted && m_connecting < MAX_CONNECTING) {
+                if(!open_one()) {
+                    wanted = opened; // fd或端口用完，停在这里
+                    break;
+                }
+                ++opened;
+            }
+            poll_once(10);
+        }
+        double secs = (now_ns() - start) / 1e9;
+        return secs > 0 ? opened / secs : 0;
+    }
+
+    // 在duration内照常处理所有连接
+    void run_for(long long duration) {
+        long long end = now_ns() + duration;
+        while(now_ns() < end) {
+            poll_once(10);
+        }
+    }
+
+    // 另开一个连接反复请求，测量延迟分位数（微秒）
+    std::vector<double> probe(long long duration) {
+        std::vector<double> lat;
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd == -1 || connect(fd, (sockaddr*)&m_server, sizeof(m_server)) == -1) {
+            if(fd != -1) {
+                close(fd);
+            }
+            return lat;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = PROBE;
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev);
+        m_probe_fd = fd;
+        long long end = now_ns() + duration;
+        while(now_ns() < end) {
+            m_probe_in.clear();
+            m_probe_done = false;
+            long long start = now_ns();
+            if(send(fd, m_request.data(), m_request.size(), MSG_NOSIGNAL) != (ssize_t)m_request.size()) {
+                break;
+            }
+            while(!m_probe_done && m_probe_fd != -1 && now_ns() < end) {
+                poll_once(10);
+            }
+            if(!m_probe_done) {
+                break;
+            }
+            lat.push_back((now_ns() - start) / 1e3);
+        }
+        if(m_probe_fd != -1) {
+            close(m_probe_fd);
+            m_probe_fd = -1;
+        }
+        std::sort(lat.begin(), lat.end());
+        return lat;
+    }
+
+    size_t alive() const { return m_conns.size() - m_closed; }
+    size_t closed() const { return m_closed; }
+    size_t failed() const { return m_failed; }
+
+private:
+    static const uint64_t PROBE = ~0ULL;
+
+    bool open_one() {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if(fd == -1) {
+            ++m_failed;
+            return false;
+        }
+        // 源地址127.1.0.1到127.1.0.N轮流用，端口在connect时按四元组分配
+        sockaddr_in src;
+        memset(&src, 0, sizeof(src));
+        src.sin_family = AF_INET;
+        src.sin_addr.s_addr = htonl((127u << 24) | (1u << 16) | (1 + m_conns.size() % m_sources));
+        int one = 1;
+        setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+        bind(fd, (sockaddr*)&src, sizeof(src));
+        if(connect(fd, (sockaddr*)&m_server, sizeof(m_server)) == -1 && errno != EINPROGRESS) {
+            close(fd);
+            ++m_failed;
+            return false;
+        }
+        conn c;
+        c.fd = fd;
+        c.connecting = true;
+        epoll_event ev;
+        ev.events = EPOLLOUT | EPOLLRDHUP;
+        ev.data.u64 = m_conns.size();
+        epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev);
+        m_conns.push_back(c);
+        ++m_connecting;
+        return true;
+    }
+
+    void drop(conn& c) {
+        if(c.connecting) {
+            --m_connecting;
+            ++m_failed;
+        } else {
+            ++m_closed;
+        }
+        close(c.fd);
+        c.fd = -1;
+        c.connecting = false;
+    }
+
+    void send_request(conn& c) {
+        if(send(c.fd, m_request.data(), m_request.size(), MSG_NOSIGNAL) != (ssize_t)m_request.size()) {
+            drop(c);
+            return;
+        }
+        // 间隔加一点随机，各连接的请求均匀摊开，不会同时到达
+        c.next_send = m_trickle ? now_ns() + m_interval / 2 + rand() % std::max(1LL, m_interval) : 0;
+    }
+
+    void poll_once(int timeout_ms) {
+        int n = epoll_wait(m_epfd, m_events.data(), m_events.size(), timeout_ms);
+        char buf[65536];
+        for(int i = 0; i < n; ++i) {
+            uint64_t id = m_events[i].data.u64;
+            if(id == PROBE) {
+                ssize_t r = recv(m_probe_fd, buf, sizeof(buf), 0);
+                if(r <= 0) {
+                    if(r == 0 || errno != EAGAIN) {
+                        close(m_probe_fd);
+                        m_probe_fd = -1;
+                    }
+                    continue;
+                }
+                m_probe_in.append(buf, r);
+                m_probe_done = response_complete(m_probe_in);
+                continue;
+            }
+            conn& c = m_conns[id];
+            if(c.fd == -1) {
+                continue;
+            }
+            if(c.connecting) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if(err || (m_events[i].events & (EPOLLERR | EPOLLHUP))) {
+                    drop(c);
+                    continue;
+                }
+                c.connecting = false;
+                --m_connecting;
+                epoll_event ev;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.u64 = id;
+                epoll_ctl(m_epfd, EPOLL_CTL_MOD, c.fd, &ev);
+                send_request(c);
+                continue;
+            }
+            // 响应直接丢掉；对端关闭说明被服务器的空闲定时器或LRU驱逐了
+            ssize_t r;
+            while((r = recv(c.fd, buf, sizeof(buf), 0)) > 0) {
+            }
+            if(r == 0 || (r < 0 && errno != EAGAIN)) {
+                drop(c);
+            }
+        }
+        if(m_trickle) {
+            long long now = now_ns();
+            // 每次只扫一段，十万个连接也不会让这一轮变长
+            for(size_t k = 0; k < 2048 && !m_conns.empty(); ++k) {
+                m_cursor = (m_cursor + 1) % m_conns.size();
+                conn& c = m_conns[m_cursor];
+                if(c.fd != -1 && !c.connecting && c.next_send && now >= c.next_send) {
+                    send_request(c);
+                }
+            }
+        }
+    }
+
+    static bool response_complete(const std::string& buf) {
+        size_t end = buf.find("\r\n\r\n");
+        if(end == std::string::npos) {
+            return false;
+        }
+        size_t body = 0;
+        size_t pos = buf.find("Content-Length:");
+        if(pos != std::string::npos && pos < end) {
+            body = strtoul(buf.c_str() + pos + 15, NULL, 10);
+        }
+        return buf.size() >= end + 4 + body;
+    }
+
+    sockaddr_in m_server;
+    std::string m_request;
+    bool m_trickle;
+    long long m_interval;
+    int m_sources;
+    int m_epfd;
+    std::vector<epoll_event> m_events;
+    std::vector<conn> m_conns;
+    int m_connecting = 0;
+    size_t m_closed = 0;
+    size_t m_failed = 0;
+    size_t m_cursor = 0;
+    int m_probe_fd = -1;
+    std::string m_probe_in;
+    bool m_probe_done = false;
+};
+
+int main(int argc, char* argv[]) {
+    if(argc < 4) {
+        printf("usage: %s <ip> <port> <server_pid|0> [steps=1000,5000,10000] [trickle|idle] [interval_s=5] [path=/index.html] [sources=16]\n", argv[0]);
+        return 1;
+    }
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(atoi(argv[2]));
+    inet_pton(AF_INET, argv[1], &server.sin_addr);
+    int pid = atoi(argv[3]);
+    std::string steps = argc > 4 ? argv[4] : "1000,5000,10000";
+    bool trickle = argc > 5 ? strcmp(argv[5], "idle") != 0 : true;
+    long long interval = (argc > 6 ? atoll(argv[6]) : 5) * 1000000000LL;
+    const char* path = argc > 7 ? argv[7] : "/index.html";
+    int sources = argc > 8 ? std::max(1, atoi(argv[8])) : 16;
+
+    // 客户端这边的fd上限尽量放开
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    fprintf(stderr, "client fd limit %llu\n", (unsigned long long)rl.rlim_cur);
+
+    std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+    bench b(server, request, trickle, interval, sources);
+
+    char status[64];
+    snprintf(status, sizeof(status), "/proc/%d/status", pid);
+    long long rss0 = pid ? proc_field(status, "VmRSS:") : -1;
+    long long tcp0 = tcp_mem_pages();
+    long long slab0 = proc_field("/proc/meminfo", "Slab:");
+    long long page = sysconf(_SC_PAGESIZE);
+    std::vector<double> lat0 = b.probe(PROBE_NS);
+
+    char* save = nullptr;
+    for(char* s = strtok_r(&steps[0], ",", &save); s; s = strtok_r(nullptr, ",", &save)) {
+        size_t target = strtoul(s, nullptr, 10);
+        double rate = b.grow(target);
+        b.run_for(SETTLE_NS);
+        long long rss = pid ? proc_field(status, "VmRSS:") : -1;
+        long long tcp = tcp_mem_pages();
+        long long slab = proc_field("/proc/meminfo", "Slab:");
+        std::vector<double> lat = b.probe(PROBE_NS);
+        size_t alive = b.alive();
+        double per = alive ? 1.0 / alive : 0;
+        double p50 = lat.empty() ? -1 : lat[lat.size() / 2];
+        double p99 = lat.empty() ? -1 : lat[lat.size() * 99 / 100];
+        double max = lat.empty() ? -1 : lat.back();
+        printf("{\"ts\":%ld,\"mode\":\"%s\",\"target\":%zu,\"alive\":%zu,\"closed_by_server\":%zu,\"failed\":%zu,"
+               "\"connect_per_s\":%.0f,\"server_rss_kb\":%lld,\"server_bytes_per_conn\":%.0f,"
+               "\"tcp_mem_bytes_per_conn\":%.0f,\"slab_bytes_per_conn\":%.0f,"
+               "\"probe_requests\":%zu,\"probe_p50_us\":%.1f,\"probe_p99_us\":%.1f,\"probe_max_us\":%.1f}\n",
+               (long)time(nullptr), trickle ? "trickle" : "idle", target, alive, b.closed(), b.failed(), rate, rss,
+               rss0 >= 0 ? (rss - rss0) * 1024.0 * per : -1, (tcp - tcp0) * page * per, (slab - slab0) * 1024.0 * per,
+               lat.size(), p50, p99, max);
+        fflush(stdout);
+        fprintf(stderr, "%zu conns (%zu alive): %.0f connects/s, server rss %lld KB (%.0f B/conn), "
+                "probe p50 %.1f us p99 %.1f us (baseline p50 %.1f us)\n", target, alive, rate, rss,
+                rss0 >= 0 ? (rss - rss0) * 1024.0 * per : -1, p50, p99, lat0.empty() ? -1 : lat0[lat0.size() / 2]);
+    }
+    return 0;
+}
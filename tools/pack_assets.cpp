@@ -0,0 +1,218 @@
+// 构建时把静态资源目录打包成一个带完美哈希索引的文件，格式见 util/asset_pack.h
+// 用法：pack_assets <资源目录> <输出文件>
+#include <cstdio>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "../util/asset_pack.h"
+
+#ifdef PACK_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace fs = std::filesystem;
+
+struct asset {
+    std::string url;
+    std::string body;
+    std::string gzip_body;
+    std::string content_type;
+    char etag[pack::ETAG_LEN];
+};
+
+static const char* content_type_of(const std::string& path) {
+    std::string ext = fs::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if(ext == ".html" || ext == ".htm") return "text/html; charset=utf-8";
+    if(ext == ".css") return "text/css";
+    if(ext == ".js") return "application/javascript";
+    if(ext == ".json") return "application/json";
+    if(ext == ".txt") return "text/plain; charset=utf-8";
+    if(ext == ".svg") return "image/svg+xml";
+    if(ext == ".png") return "image/png";
+    if(ext == ".jpg" || ext == ".jpeg") return "image/jpeg";
+    if(ext == ".gif") return "image/gif";
+    if(ext == ".ico") return "image/x-icon";
+    return "application/octet-stream";
+}
+
+// 文本类资源才值得预压缩
+static bool compressible(const std::string& type) {
+    return type.compare(0, 5, "text/") == 0 || type == "application/javascript" ||
+           type == "application/json" || type == "image/svg+xml";
+}
+
+#ifdef PACK_WITH_ZLIB
+static bool gzip(const std::string& in, std::string& out) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = (Bytef*)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+// gzip 编码是不同的表示，ETag 在引号内追加 -gz。有gzip版本的资源两种表示都要带Vary，
+// 否则共享缓存可能把未压缩的那份当成对所有客户端都有效
+static std::string make_headers(const asset& a, const std::string& body, bool gz) {
+    char buf[512];
+    int etag_len = strlen(a.etag) - 1;
+    snprintf(buf, sizeof(buf),
+             "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nContent-Type: %s\r\nETag: %.*s%s\r\n%s%s",
+             body.size(), a.content_type.c_str(), etag_len, a.etag, gz ? "-gz\"" : "\"",
+             gz ? "Content-Encoding: gzip\r\n" : "",
+             a.gzip_body.empty() ? "" : "Vary: Accept-Encoding\r\n");
+    return buf;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc != 3) {
+        printf("usage: %s <resource dir> <output pack>\n", argv[0]);
+        return -1;
+    }
+    fs::path root(argv[1]);
+
+    std::vector<asset> assets;
+    for(auto& item : fs::recursive_directory_iterator(root)) {
+        if(!item.is_regular_file()) {
+            continue;
+        }
+        asset a;
+        a.url = "/" + fs::relative(item.path(), root).generic_string();
+        std::ifstream in(item.path(), std::ios::binary);
+        a.body.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        a.content_type = content_type_of(a.url);
+        unsigned long long h = 1469598103934665603ull;
+        for(unsigned char c : a.body) {
+            h = (h ^ c) * 1099511628211ull;
+        }
+        snprintf(a.etag, sizeof(a.etag), "\"%llx-%zx\"", h, a.body.size());
+#ifdef PACK_WITH_ZLIB
+        std::string gz;
+        if(compressible(a.content_type) && gzip(a.body, gz) && gz.size() < a.body.size() * 9 / 10) {
+            a.gzip_body.swap(gz);
+        }
+#endif
+        assets.push_back(std::move(a));
+    }
+
+    // 两级完美哈希（hash and displace）：先分桶，再为每个桶找一个让桶内URL全部落入空槽的种子
+    uint32_t n = assets.size();
+    uint32_t bucket_count = n / 4 + 1;
+    uint32_t slot_count = n + n / 4 + 1;
+    std::vector<std::vector<uint32_t>> buckets(bucket_count);
+    for(uint32_t i = 0; i < n; ++i) {
+        buckets[pack::hash(assets[i].url.data(), assets[i].url.size(), 0) % bucket_count].push_back(i);
+    }
+    std::vector<uint32_t> order(bucket_count);
+    for(uint32_t b = 0; b < bucket_count; ++b) order[b] = b;
+    std::sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+        return buckets[x].size() > buckets[y].size();
+    });
+
+    std::vector<uint32_t> disp(bucket_count, 0);
+    std::vector<uint32_t> slots(slot_count, pack::EMPTY_SLOT);
+    for(uint32_t b : order) {
+        if(buckets[b].empty()) {
+            continue;
+        }
+        for(uint32_t seed = 1; ; ++seed) {
+            std::vector<uint32_t> taken;
+            bool ok = true;
+            for(uint32_t i : buckets[b]) {
+                uint32_t s = pack::hash(assets[i].url.data(), assets[i].url.size(), seed) % slot_count;
+                if(slots[s] != pack::EMPTY_SLOT || std::find(taken.begin(), taken.end(), s) != taken.end()) {
+                    ok = false;
+                    break;
+                }
+                taken.push_back(s);
+            }
+            if(ok) {
+                for(size_t k = 0; k < taken.size(); ++k) {
+                    slots[taken[k]] = buckets[b][k];
+                }
+                disp[b] = seed;
+                break;
+            }
+        }
+    }
+
+    // 依次排布：头部、位移表、槽位表、条目表、数据区
+    auto align8 = [](uint64_t v) { return (v + 7) & ~7ull; };
+    pack::pack_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, pack::MAGIC, sizeof(hdr.magic));
+    hdr.entry_count = n;
+    hdr.bucket_count = bucket_count;
+    hdr.slot_count = slot_count;
+    hdr.disp_off = align8(sizeof(hdr));
+    hdr.slot_off = align8(hdr.disp_off + bucket_count * sizeof(uint32_t));
+    hdr.entry_off = align8(hdr.slot_off + slot_count * sizeof(uint32_t));
+
+    std::string data;
+    uint64_t data_off = align8(hdr.entry_off + n * sizeof(pack::pack_entry));
+    auto put = [&](const std::string& s) {
+        uint64_t off = data_off + data.size();
+        data += s;
+        data.resize(align8(data.size()), '\0');
+        return off;
+    };
+
+    std::vector<pack::pack_entry> entries(n);
+    for(uint32_t i = 0; i < n; ++i) {
+        asset& a = assets[i];
+        pack::pack_entry& e = entries[i];
+        memset(&e, 0, sizeof(e));
+        memcpy(e.etag, a.etag, sizeof(e.etag));
+        e.url_off = put(a.url);
+        e.url_len = a.url.size();
+
+        std::string hs = make_headers(a, a.body, false);
+        e.identity.hdr_off = put(hs);
+        e.identity.hdr_len = hs.size();
+        e.identity.body_off = put(a.body);
+        e.identity.body_len = a.body.size();
+
+        if(!a.gzip_body.empty()) {
+            e.has_gzip = 1;
+            hs = make_headers(a, a.gzip_body, true);
+            e.gzip.hdr_off = put(hs);
+            e.gzip.hdr_len = hs.size();
+            e.gzip.body_off = put(a.gzip_body);
+            e.gzip.body_len = a.gzip_body.size();
+        }
+        printf("%s -> %zu bytes%s\n", a.url.c_str(), a.body.size(), e.has_gzip ? " (+gzip)" : "");
+    }
+
+    std::string out(data_off, '\0');
+    memcpy(&out[0], &hdr, sizeof(hdr));
+    memcpy(&out[hdr.disp_off], disp.data(), disp.size() * sizeof(uint32_t));
+    memcpy(&out[hdr.slot_off], slots.data(), slots.size() * sizeof(uint32_t));
+    if(n) {
+        memcpy(&out[hdr.entry_off], entries.data(), n * sizeof(pack::pack_entry));
+    }
+    out += data;
+
+    FILE* fp = fopen(argv[2], "wb");
+    if(!fp || fwrite(out.data(), 1, out.size(), fp) != out.size()) {
+        perror("write pack");
+        return -1;
+    }
+    fclose(fp);
+    printf("packed %u assets into %s (%zu bytes)\n", n, argv[2], out.size());
+    return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+# 依次压测构建目录里每种编译期策略组合（见util/server_policy.h）：短连接满载的请求速率和延迟，
+# 以及逐步建立上万个空闲keep-alive连接时的建连速率（连接定时器的插入开销主要体现在这里）。
+# 用法：tools/policy_bench.sh <构建目录> [空闲连接数=1000,5000,8000] [小请求连接数=64] [秒数=3]
+BUILD=${1:?usage: $0 <build_dir> [idle_steps] [conns] [secs]}
+STEPS=${2:-1000,5000,8000}
+CONNS=${3:-64}
+SECS=${4:-3}
+PORT=18080
+
+cd "$BUILD" || exit 1
+printf "%-28s %9s %9s %9s   %s\n" server "req/s" "p50(us)" "p99(us)" "connects/s at $STEPS"
+for server in webserver_cpp11 webserver_cpp11_fixed webserver_cpp11_wheel webserver_cpp11_wheel_fixed \
+              webserver_cpp11_fifo webserver_coro webserver_coro_fixed webserver_coro_fifo; do
+    [ -x ./$server ] || continue
+    ./$server $PORT > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    result=$(./http_bench 127.0.0.1 $PORT /index.html $CONNS $SECS | awk '
+        /^requests/ { rps = $5 }
+        /^latency/  { p50 = $4; p99 = $8 }
+        END { printf "%9s %9s %9s", rps, p50, p99 }')
+    connects=$(./idle_bench 127.0.0.1 $PORT $pid $STEPS idle 1 2> /dev/null | awk -F'"connect_per_s":' '
+        NF > 1 { split($2, a, ","); printf "%s%s", sep, a[1]; sep = "," }')
+    printf "%-28s %s   %s\n" "$server" "$result" "$connects"
+    kill $pid
+    wait $pid 2> /dev/null
+done
@@ -0,0 +1,38 @@
+#!/bin/sh
+# 依次用不同的socket选项（SOCK_PROFILE环境变量）启动服务器，各跑一轮http_bench，
+# 输出一张吞吐和延迟的对比表。第一行是加这些选项之前的行为（backlog 5、开Nagle、不cork）。
+# 用法：tools/sockopt_matrix.sh <构建目录> [路径=/index.html] [连接数=64] [秒数=3] [服务器=webserver_cpp11]
+BUILD=${1:?usage: $0 <build_dir> [path] [conns] [secs] [server]}
+URL_PATH=${2:-/index.html}
+CONNS=${3:-64}
+SECS=${4:-3}
+SERVER=${5:-webserver_cpp11}
+PORT=18080
+
+PROFILES="
+nodelay=0,cork=0,backlog=5
+default
+nodelay=0
+cork=0
+sndbuf=65536
+sndbuf=1048576,rcvbuf=1048576
+notsent_lowat=16384
+busy_poll_us=50
+keepalive_idle=60
+"
+
+cd "$BUILD" || exit 1
+printf "%-32s %10s %9s %9s %9s %11s\n" profile "req/s" "p50(us)" "p90(us)" "p99(us)" "max(us)"
+for p in $PROFILES; do
+    spec=$p
+    [ "$p" = default ] && spec=""
+    SOCK_PROFILE="$spec" ./$SERVER $PORT > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    ./http_bench 127.0.0.1 $PORT "$URL_PATH" $CONNS $SECS | awk -v p="$p" '
+        /^requests/ { rps = $5 }
+        /^latency/  { p50 = $4; p90 = $6; p99 = $8; max = $10 }
+        END { printf "%-32s %10s %9s %9s %9s %11s\n", p, rps, p50, p90, p99, max }'
+    kill $pid
+    wait $pid 2> /dev/null
+done
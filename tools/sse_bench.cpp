@@ -0,0 +1,249 @@
+// Server-Sent Events扇出压测：N个订阅者连到事件流，发布者用keep-alive连接POST /api/publish，
+// 保持window个事件在途，一个事件被所有正常订阅者收到算完成，统计每秒完成的事件数、投递数和完成延迟分位数。
+// 服务器不处理流水线请求，每个在途事件单独用一条发布连接，上一个事件完成时它的响应早已回来
+// slow个订阅者只连不读，用来观察服务器的积压策略（SSE_SLOW=drop|close，SSE_QUEUE）是否拖慢其他人。
+// 用法：sse_bench <ip> <port> [订阅者数=10000] [秒数=5] [数据字节数=32] [在途事件数=4] [不读的订阅者数=0] [路径=/events]
+// 订阅者多时注意客户端和服务器两边的ulimit -n
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using bench_clock = std::chrono::steady_clock;
+
+static long long elapsed_ns(bench_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - since).count();
+}
+
+struct subscriber {
+    int fd = -1;
+    bool open = false; // 已收到响应头
+    bool slow = false; // 不读
+    std::string in;
+};
+
+// 一个在途事件
+struct event {
+    unsigned long long seq = 0;
+    int remaining = 0;
+    bench_clock::time_point sent;
+};
+
+static int connect_to(const char* ip, int port, int rcvbuf) {
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    socklen_t len;
+    if(strchr(ip, ':')) {
+        sockaddr_in6& a6 = (sockaddr_in6&)ss;
+        a6.sin6_family = AF_INET6;
+        a6.sin6_port = htons(port);
+        inet_pton(AF_INET6, ip, &a6.sin6_addr);
+        len = sizeof(a6);
+    } else {
+        sockaddr_in& a4 = (sockaddr_in&)ss;
+        a4.sin_family = AF_INET;
+        a4.sin_port = htons(port);
+        inet_pton(AF_INET, ip, &a4.sin_addr);
+        len = sizeof(a4);
+    }
+    int fd = socket(ss.ss_family, SOCK_STREAM, 0);
+    if(rcvbuf > 0) {
+        // 不读的订阅者收缓冲设小，服务器那边很快就积压起来
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    if(fd == -1 || connect(fd, (sockaddr*)&ss, len) == -1) {
+        perror("connect");
+        exit(-1);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 3) {
+        printf("usage: %s <ip> <port> [subscribers] [seconds] [data_bytes] [window] [slow] [path]\n", argv[0]);
+        return -1;
+    }
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+    int subs = argc > 3 ? atoi(argv[3]) : 10000;
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+    size_t data_bytes = std::max(argc > 5 ? (size_t)atoi(argv[5]) : 32, (size_t)20);
+    int window = argc > 6 ? atoi(argv[6]) : 4;
+    int slow = argc > 7 ? std::min(atoi(argv[7]), subs) : 0;
+    const char* path = argc > 8 ? argv[8] : "/events";
+    std::string subscribe = std::string("GET ") + path + " HTTP/1.1\r\nHost: bench\r\nAccept: text/event-stream\r\n\r\n";
+    int readers = subs - slow;
+
+    int epfd = epoll_create1(0);
+    std::vector<subscriber> clients(subs + window); // 最后window个是发布者
+    int opened = 0;
+    char buf[65536];
+    struct epoll_event events[1024];
+    auto pump = [&](int timeout_ms) {
+        int n = epoll_wait(epfd, events, 1024, timeout_ms);
+        for(int i = 0; i < n; ++i) {
+            subscriber& c = clients[events[i].data.u32];
+            ssize_t r;
+            while((r = recv(c.fd, buf, sizeof(buf), 0)) > 0) {
+                c.in.append(buf, r);
+            }
+            if(r == 0) {
+                printf("connection %u closed by server\n", events[i].data.u32);
+                exit(-1);
+            }
+            size_t end = c.in.find("\r\n\r\n");
+            if(!c.open && end != std::string::npos) {
+                if(c.in.compare(0, 12, "HTTP/1.1 200") != 0) {
+                    printf("subscribe refused: %.*s\n", (int)c.in.find("\r\n"), c.in.c_str());
+                    exit(-1);
+                }
+                c.in.erase(0, end + 4);
+                c.open = true;
+                ++opened;
+                if(c.slow) {
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, NULL); // 从此不再读
+                }
+            }
+        }
+        return n;
+    };
+    auto begin = bench_clock::now();
+    for(int i = 0; i < subs; ++i) {
+        subscriber& c = clients[i];
+        c.slow = i >= readers;
+        c.fd = connect_to(ip, port, c.slow ? 4096 : 0);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+        send(c.fd, subscribe.data(), subscribe.size(), 0);
+        if(i % 256 == 255) {
+            pump(0);
+        }
+    }
+    while(opened < subs) {
+        if(pump(1000) == 0) {
+            printf("subscribe stalled at %d/%d\n", opened, subs);
+            return -1;
+        }
+    }
+    printf("%d subscribers (%d not reading) connected in %.2fs\n", subs, slow, elapsed_ns(begin) / 1e9);
+
+    // 保持window个事件在途，每个在途槽位有自己的发布连接，槽位上的事件完成后在同一条连接上补发一个。
+    // 各连接的请求到达服务器的先后不定，事件不一定按seq顺序完成。HTTP响应读掉即可
+    for(int i = subs; i < subs + window; ++i) {
+        clients[i].fd = connect_to(ip, port, 0);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+    }
+    std::vector<event> inflight(window);
+    std::vector<long long> latencies;
+    latencies.reserve(1 << 20);
+    unsigned long long next_seq = 0;
+    long long deliveries = 0;
+    long long stray = 0;
+    std::string body(data_bytes, 'x');
+    auto publish = [&](int slot) {
+        event& e = inflight[slot];
+        e.seq = next_seq;
+        e.remaining = readers;
+        e.sent = bench_clock::now();
+        int n = snprintf(&body[0], 21, "%020llu", next_seq);
+        body[n] = 'x';
+        char head[256];
+        int h = snprintf(head, sizeof(head), "POST /api/publish?event=bench HTTP/1.1\r\nHost: bench\r\n"
+                         "Connection: keep-alive\r\nContent-Length: %zu\r\n\r\n", body.size());
+        std::string req = std::string(head, h) + body;
+        if(send(clients[subs + slot].fd, req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t)req.size()) {
+            printf("publisher send failed\n");
+            exit(-1);
+        }
+        ++next_seq;
+    };
+    for(int i = 0; i < window; ++i) {
+        publish(i);
+    }
+
+    begin = bench_clock::now();
+    auto deadline = begin + std::chrono::seconds(seconds);
+    while(bench_clock::now() < deadline) {
+        int n = epoll_wait(epfd, events, 1024, 100);
+        for(int i = 0; i < n; ++i) {
+            uint32_t idx = events[i].data.u32;
+            subscriber& c = clients[idx];
+            ssize_t r;
+            while((r = recv(c.fd, buf, sizeof(buf), 0)) > 0) {
+                if(idx < (uint32_t)subs) {
+                    c.in.append(buf, r);
+                }
+            }
+            if(r == 0) {
+                printf("%s %u closed by server\n", idx >= (uint32_t)subs ? "publisher" : "subscriber", idx);
+                return -1;
+            }
+            // 按空行切出一个个事件，心跳（注释行）和retry没有data行
+            size_t consumed = 0;
+            size_t end;
+            while((end = c.in.find("\n\n", consumed)) != std::string::npos) {
+                size_t d = c.in.find("data: ", consumed);
+                if(d != std::string::npos && d < end) {
+                    unsigned long long seq = strtoull(c.in.c_str() + d + 6, nullptr, 10);
+                    int slot = 0;
+                    while(slot < window && !(inflight[slot].seq == seq && inflight[slot].remaining > 0)) {
+                        ++slot;
+                    }
+                    if(slot < window) {
+                        event& e = inflight[slot];
+                        ++deliveries;
+                        if(--e.remaining == 0) {
+                            latencies.push_back(elapsed_ns(e.sent));
+                            publish(slot);
+                        }
+                    } else {
+                        ++stray;
+                    }
+                }
+                consumed = end + 2;
+            }
+            c.in.erase(0, consumed);
+        }
+    }
+    double secs = elapsed_ns(begin) / 1e9;
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) {
+        return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, (size_t)(latencies.size() * p))] / 1000.0;
+    };
+    printf("events %zu in %.2fs, %.0f events/s, %.0f deliveries/s, stray %lld\n",
+           latencies.size(), secs, latencies.size() / secs, deliveries / secs, stray);
+    printf("fan-out latency us (last subscriber): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           pct(0.5), pct(0.9), pct(0.99), pct(1.0));
+    // 不读的订阅者被断开后才读得到EOF，这里顺便数一下
+    int closed = 0;
+    for(int i = readers; i < subs; ++i) {
+        ssize_t r;
+        while((r = recv(clients[i].fd, buf, sizeof(buf), 0)) > 0) {
+        }
+        closed += r == 0;
+    }
+    if(slow > 0) {
+        printf("slow subscribers closed by server: %d/%d\n", closed, slow);
+    }
+    return 0;
+}
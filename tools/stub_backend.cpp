@@ -0,0 +1,185 @@
+// 代替真实应用的本地上游，用于验证和压测反向代理：单线程epoll，支持keep-alive。
+//   GET  /...           返回 body_bytes 字节，带 Content-Length
+//   GET  .../chunked... 同样的内容用 chunked 编码返回
+//   GET  .../close...   不带长度，发完关闭连接
+//   GET  .../hang...    永不回复，用来触发代理的超时
+//   POST/PUT            把请求体原样返回，请求体可以是 chunked 编码
+// 响应带 X-Backend: <port>，方便看出负载均衡的结果。
+// 用法：stub_backend <port> [body_bytes=1024]
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string>
+#include <map>
+
+struct conn {
+    std::string in;
+    std::string out;
+    size_t out_off = 0;
+    bool close_after = false;
+};
+
+static int port;
+static size_t body_bytes;
+
+// 解析出一个完整请求则生成响应并返回true
+static bool handle_request(conn& c) {
+    size_t end = c.in.find("\r\n\r\n");
+    if(end == std::string::npos) {
+        return false;
+    }
+    size_t body_len = 0;
+    std::string posted;
+    const char* cl = strcasestr(c.in.c_str(), "Content-Length:");
+    const char* te = strcasestr(c.in.c_str(), "Transfer-Encoding: chunked");
+    if(te && te < c.in.c_str() + end) {
+        // 逐块拼出请求体，不完整时等更多数据
+        size_t pos = end + 4;
+        while(true) {
+            size_t eol = c.in.find("\r\n", pos);
+            if(eol == std::string::npos) {
+                return false;
+            }
+            size_t n = strtoul(c.in.c_str() + pos, NULL, 16);
+            if(n == 0) {
+                size_t trailer_end = c.in.find("\r\n\r\n", eol);
+                if(trailer_end == std::string::npos) {
+                    return false;
+                }
+                body_len = trailer_end + 4 - (end + 4);
+                break;
+            }
+            if(c.in.size() < eol + 2 + n + 2) {
+                return false;
+            }
+            posted.append(c.in, eol + 2, n);
+            pos = eol + 2 + n + 2;
+        }
+    } else {
+        if(cl && cl < c.in.c_str() + end) {
+            body_len = strtoul(cl + 15, NULL, 10);
+        }
+        if(c.in.size() < end + 4 + body_len) {
+            return false;
+        }
+        posted = c.in.substr(end + 4, body_len);
+    }
+    std::string method = c.in.substr(0, c.in.find(' '));
+    size_t path_begin = method.size() + 1;
+    std::string path = c.in.substr(path_begin, c.in.find(' ', path_begin) - path_begin);
+    std::string body = (method == "POST" || method == "PUT") ? posted : std::string(body_bytes, 'x');
+    c.in.erase(0, end + 4 + body_len);
+
+    char head[256];
+    if(path.find("/hang") != std::string::npos) {
+        return true;
+    } else if(path.find("/chunked") != std::string::npos) {
+        snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nX-Backend: %d\r\nTransfer-Encoding: chunked\r\n\r\n", port);
+        c.out += head;
+        for(size_t off = 0; off < body.size(); off += 1000) {
+            size_t n = std::min((size_t)1000, body.size() - off);
+            snprintf(head, sizeof(head), "%zx\r\n", n);
+            c.out.append(head).append(body, off, n).append("\r\n");
+        }
+        c.out += "0\r\n\r\n";
+    } else if(path.find("/close") != std::string::npos) {
+        snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nX-Backend: %d\r\nConnection: close\r\n\r\n", port);
+        c.out.append(head).append(body);
+        c.close_after = true;
+    } else {
+        snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nX-Backend: %d\r\nContent-Length: %zu\r\n\r\n", port, body.size());
+        c.out.append(head).append(body);
+    }
+    return true;
+}
+
+// 尽量发送，返回false表示连接应该关闭
+static bool flush(int fd, conn& c) {
+    while(c.out_off < c.out.size()) {
+        ssize_t n = send(fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+        if(n > 0) {
+            c.out_off += n;
+        } else {
+            return n == -1 && errno == EAGAIN;
+        }
+    }
+    c.out.clear();
+    c.out_off = 0;
+    return !c.close_after;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        printf("usage: %s <port> [body_bytes]\n", argv[0]);
+        return -1;
+    }
+    port = atoi(argv[1]);
+    body_bytes = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+    signal(SIGPIPE, SIG_IGN);
+
+    int lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(lfd, (sockaddr*)&addr, sizeof(addr)) == -1 || listen(lfd, 1024) == -1) {
+        perror("listen");
+        return -1;
+    }
+
+    int epfd = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = lfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+    std::map<int, conn> conns;
+    struct epoll_event events[256];
+    char buf[65536];
+    while(true) {
+        int n = epoll_wait(epfd, events, 256, -1);
+        for(int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if(fd == lfd) {
+                int cfd;
+                while((cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+                    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+                    ev.data.fd = cfd;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev);
+                    conns[cfd];
+                }
+                continue;
+            }
+            conn& c = conns[fd];
+            bool alive = true;
+            while(true) {
+                ssize_t r = recv(fd, buf, sizeof(buf), 0);
+                if(r > 0) {
+                    c.in.append(buf, r);
+                    continue;
+                }
+                alive = r == -1 && errno == EAGAIN;
+                break;
+            }
+            while(alive && handle_request(c)) {}
+            if(alive || !c.out.empty()) {
+                alive = flush(fd, c) && alive;
+            }
+            if(!alive) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                close(fd);
+                conns.erase(fd);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+# 同一个服务器同时监听本机TCP端口和抽象命名空间的Unix域socket，用http_bench分别压测，
+# 对比同机前置代理/sidecar走Unix域socket能省下多少（没有TCP协议栈、校验和、ACK与拥塞控制）。
+# 用法：tools/uds_vs_tcp.sh <构建目录> [连接数列表="1 64"] [秒数=3] [服务器=webserver_cpp11]
+BUILD=${1:?usage: $0 <build_dir> [conns] [secs] [server]}
+CONNS=${2:-1 64}
+SECS=${3:-3}
+SERVER=${4:-webserver_cpp11}
+PORT=18080
+UDS=unix:@tws_bench
+
+cd "$BUILD" || exit 1
+./$SERVER $PORT,$UDS > /dev/null 2>&1 &
+pid=$!
+sleep 0.5
+printf "%-20s %-16s %5s %10s %9s %9s %9s\n" path target conns "req/s" "p50(us)" "p90(us)" "p99(us)"
+for path in /index.html /images/image1.jpg; do
+    for c in $CONNS; do
+        for target in 127.0.0.1 ::1 $UDS; do
+            ./http_bench $target $PORT $path $c $SECS | awk -v p="$path" -v t="$target" -v c="$c" '
+                /^requests/ { rps = $5 }
+                /^latency/  { p50 = $4; p90 = $6; p99 = $8 }
+                END { printf "%-20s %-16s %5s %10s %9s %9s %9s\n", p, t, c, rps, p50, p90, p99 }'
+        done
+    done
+done
+kill $pid
+wait $pid 2> /dev/null
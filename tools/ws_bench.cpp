@@ -0,0 +1,324 @@
+// WebSocket广播压测：N个订阅者和1个发布者连到同一个频道，发布者保持window条消息在途，
+// 一条消息被所有订阅者收到算完成，统计每秒完成的消息数、投递数和完成延迟分位数。
+// 用法：ws_bench <ip> <port> [订阅者数=10000] [秒数=5] [消息字节数=32] [在途消息数=4] [路径=/ws]
+//       ws_bench unmask      对比标量、SSE2、AVX2去掩码的吞吐
+// 订阅者多时注意客户端和服务器两边的ulimit -n
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "util/websocket.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static long long elapsed_ns(bench_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - since).count();
+}
+
+struct subscriber {
+    int fd = -1;
+    bool open = false; // 已收到101
+    std::string in;
+};
+
+// 一条在途消息
+struct message {
+    unsigned long long seq = 0;
+    int remaining = 0;
+    bench_clock::time_point sent;
+};
+
+static int connect_to(const char* ip, int port) {
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    socklen_t len;
+    if(strchr(ip, ':')) {
+        sockaddr_in6& a6 = (sockaddr_in6&)ss;
+        a6.sin6_family = AF_INET6;
+        a6.sin6_port = htons(port);
+        inet_pton(AF_INET6, ip, &a6.sin6_addr);
+        len = sizeof(a6);
+    } else {
+        sockaddr_in& a4 = (sockaddr_in&)ss;
+        a4.sin_family = AF_INET;
+        a4.sin_port = htons(port);
+        inet_pton(AF_INET, ip, &a4.sin_addr);
+        len = sizeof(a4);
+    }
+    int fd = socket(ss.ss_family, SOCK_STREAM, 0);
+    if(fd == -1 || connect(fd, (sockaddr*)&ss, len) == -1) {
+        perror("connect");
+        exit(-1);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static std::string upgrade_request(const char* path) {
+    return std::string("GET ") + path + " HTTP/1.1\r\nHost: bench\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+           "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+}
+
+// 客户端发出的帧必须加掩码
+static std::string masked_frame(const char* payload, size_t len) {
+    std::string f;
+    f.push_back((char)(0x80 | mirror::WS_BINARY));
+    if(len < 126) {
+        f.push_back((char)(0x80 | len));
+    } else {
+        f.push_back((char)(0x80 | 126));
+        f.push_back((char)(len >> 8));
+        f.push_back((char)len);
+    }
+    uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+    f.append((const char*)key, 4);
+    size_t off = f.size();
+    f.append(payload, len);
+    mirror::ws_unmask((uint8_t*)&f[off], len, key);
+    return f;
+}
+
+// 服务端帧不带掩码。取出in开头一个完整帧的负载，返回帧长，不完整时返回0
+static size_t next_frame(const char* in, size_t size, int* opcode, const char** payload, size_t* len) {
+    if(size < 2) {
+        return 0;
+    }
+    size_t n = (uint8_t)in[1] & 0x7f;
+    size_t hdr = 2;
+    if(n == 126) {
+        if(size < 4) {
+            return 0;
+        }
+        n = (uint8_t)in[2] << 8 | (uint8_t)in[3];
+        hdr = 4;
+    } else if(n == 127) {
+        if(size < 10) {
+            return 0;
+        }
+        n = 0;
+        for(int i = 0; i < 8; ++i) {
+            n = n << 8 | (uint8_t)in[2 + i];
+        }
+        hdr = 10;
+    }
+    if(size < hdr + n) {
+        return 0;
+    }
+    *opcode = in[0] & 0x0f;
+    *payload = in + hdr;
+    *len = n;
+    return hdr + n;
+}
+
+// 去掩码各实现的吞吐，单位GB/s
+static void bench_unmask() {
+    const size_t sizes[] = {125, 1024, 16384, 1 << 20};
+    uint8_t key[4] = {0xa1, 0xb2, 0xc3, 0xd4};
+    uint32_t m32;
+    memcpy(&m32, key, 4);
+    bool avx2 = __builtin_cpu_supports("avx2");
+    printf("%-10s %10s %10s %10s %10s\n", "bytes", "bytewise", "scalar64", "sse2", "avx2");
+    for(size_t size : sizes) {
+        std::vector<uint8_t> buf(size, 0x5a);
+        size_t rounds = (256u << 20) / size; // 每种实现处理256MB
+        auto run = [&](int kind) {
+            auto t = bench_clock::now();
+            for(size_t r = 0; r < rounds; ++r) {
+                uint8_t* p = buf.data();
+                if(kind == 0) {
+                    for(size_t i = 0; i < size; ++i) {
+                        p[i] ^= key[i & 3];
+                    }
+                } else if(kind == 1) {
+                    mirror::ws_unmask_scalar(p, size, key);
+                } else if(kind == 2) {
+                    mirror::ws_unmask_scalar(p, size, key, mirror::ws_unmask_sse2(p, size, m32));
+                } else {
+                    mirror::ws_unmask_scalar(p, size, key, mirror::ws_unmask_avx2(p, size, m32));
+                }
+                asm volatile("" : : "r"(p) : "memory"); // 不让编译器把多轮异或合并掉
+            }
+            return (double)rounds * size / elapsed_ns(t);
+        };
+        printf("%-10zu %10.2f %10.2f %10.2f", size, run(0), run(1), run(2));
+        if(avx2) {
+            printf(" %10.2f\n", run(3));
+        } else {
+            printf(" %10s\n", "n/a");
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if(argc == 2 && strcmp(argv[1], "unmask") == 0) {
+        bench_unmask();
+        return 0;
+    }
+    if(argc < 3) {
+        printf("usage: %s <ip> <port> [subscribers] [seconds] [message_bytes] [window] [path]\n"
+               "       %s unmask\n", argv[0], argv[0]);
+        return -1;
+    }
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+    int subs = argc > 3 ? atoi(argv[3]) : 10000;
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+    size_t msg_bytes = std::max(argc > 5 ? (size_t)atoi(argv[5]) : 32, sizeof(unsigned long long));
+    int window = argc > 6 ? atoi(argv[6]) : 4;
+    const char* path = argc > 7 ? argv[7] : "/ws";
+    std::string upgrade = upgrade_request(path);
+
+    int epfd = epoll_create1(0);
+    std::vector<subscriber> clients(subs + 1); // 最后一个是发布者
+    int opened = 0;
+    auto handshake_done = [&](subscriber& c) {
+        size_t end = c.in.find("\r\n\r\n");
+        if(end == std::string::npos) {
+            return false;
+        }
+        if(c.in.compare(0, 12, "HTTP/1.1 101") != 0) {
+            printf("upgrade refused: %.*s\n", (int)c.in.find("\r\n"), c.in.c_str());
+            exit(-1);
+        }
+        c.in.erase(0, end + 4);
+        c.open = true;
+        ++opened;
+        return true;
+    };
+
+    char buf[65536];
+    struct epoll_event events[1024];
+    // 建立连接并升级，服务器accept跟不上时边连边收101
+    auto pump = [&](int timeout_ms) {
+        int n = epoll_wait(epfd, events, 1024, timeout_ms);
+        for(int i = 0; i < n; ++i) {
+            subscriber& c = clients[events[i].data.u32];
+            ssize_t r;
+            while((r = recv(c.fd, buf, sizeof(buf), 0)) > 0) {
+                c.in.append(buf, r);
+            }
+            if(r == 0) {
+                printf("connection %u closed by server\n", events[i].data.u32);
+                exit(-1);
+            }
+            if(!c.open) {
+                handshake_done(c);
+            }
+        }
+        return n;
+    };
+    auto begin = bench_clock::now();
+    for(int i = 0; i <= subs; ++i) {
+        clients[i].fd = connect_to(ip, port);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+        send(clients[i].fd, upgrade.data(), upgrade.size(), 0);
+        if(i % 256 == 255) {
+            pump(0);
+        }
+    }
+    while(opened <= subs) {
+        if(pump(1000) == 0) {
+            printf("handshake stalled at %d/%d\n", opened, subs + 1);
+            return -1;
+        }
+    }
+    printf("%d subscribers connected in %.2fs\n", subs, elapsed_ns(begin) / 1e9);
+
+    // 发布者保持window条消息在途，每完成一条补发一条
+    subscriber& pub = clients[subs];
+    std::vector<message> inflight(window);
+    std::vector<long long> latencies;
+    latencies.reserve(1 << 20);
+    std::string payload(msg_bytes, 'x');
+    unsigned long long next_seq = 0;
+    long long deliveries = 0;
+    long long stray = 0;
+    auto publish = [&]() {
+        message& m = inflight[next_seq % window];
+        m.seq = next_seq;
+        m.remaining = subs;
+        m.sent = bench_clock::now();
+        memcpy(&payload[0], &next_seq, sizeof(next_seq));
+        std::string f = masked_frame(payload.data(), payload.size());
+        if(send(pub.fd, f.data(), f.size(), MSG_NOSIGNAL) != (ssize_t)f.size()) {
+            printf("publisher send failed\n");
+            exit(-1);
+        }
+        ++next_seq;
+    };
+    for(int i = 0; i < window; ++i) {
+        publish();
+    }
+
+    begin = bench_clock::now();
+    auto deadline = begin + std::chrono::seconds(seconds);
+    while(bench_clock::now() < deadline) {
+        int n = epoll_wait(epfd, events, 1024, 100);
+        for(int i = 0; i < n; ++i) {
+            subscriber& c = clients[events[i].data.u32];
+            ssize_t r;
+            while((r = recv(c.fd, buf, sizeof(buf), 0)) > 0) {
+                c.in.append(buf, r);
+            }
+            if(r == 0) {
+                printf("subscriber %u closed by server (too slow?)\n", events[i].data.u32);
+                return -1;
+            }
+            size_t consumed = 0;
+            size_t len;
+            int opcode;
+            const char* data;
+            size_t flen;
+            while((flen = next_frame(c.in.data() + consumed, c.in.size() - consumed, &opcode, &data, &len)) != 0) {
+                if(opcode == mirror::WS_PING) {
+                    // 压测时间超过服务器的空闲时间时会收到ping
+                    std::string pong = masked_frame(data, len);
+                    pong[0] = (char)(0x80 | mirror::WS_PONG);
+                    send(c.fd, pong.data(), pong.size(), MSG_NOSIGNAL);
+                } else if(len >= sizeof(unsigned long long)) {
+                    unsigned long long seq;
+                    memcpy(&seq, data, sizeof(seq));
+                    message& m = inflight[seq % window];
+                    if(m.seq == seq && m.remaining > 0) {
+                        ++deliveries;
+                        if(--m.remaining == 0) {
+                            latencies.push_back(elapsed_ns(m.sent));
+                            publish();
+                        }
+                    } else {
+                        ++stray;
+                    }
+                }
+                consumed += flen;
+            }
+            c.in.erase(0, consumed);
+        }
+    }
+    double secs = elapsed_ns(begin) / 1e9;
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) {
+        return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, (size_t)(latencies.size() * p))] / 1000.0;
+    };
+    printf("messages %zu in %.2fs, %.0f msg/s, %.0f deliveries/s, stray %lld\n",
+           latencies.size(), secs, latencies.size() / secs, deliveries / secs, stray);
+    printf("fan-out latency us (last subscriber): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           pct(0.5), pct(0.9), pct(0.99), pct(1.0));
+    return 0;
+}
@@ -0,0 +1,143 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdio>
+
+// 静态资源包：由 pack_assets 在构建时把 resources/ 打成一个文件，
+// 服务器启动时整体 mmap(MAP_POPULATE) 进来，请求时按 URL 做完美哈希查找，
+// 命中后响应头和文件体都直接指向映射内存，除了发送不再有任何系统调用。
+//
+// 文件布局（本机字节序）：
+//   pack_header
+//   uint32_t disp[bucket_count]     每个桶的位移种子
+//   uint32_t slots[slot_count]      槽位 -> 条目下标
+//   pack_entry entries[entry_count]
+//   字符串与文件内容区
+namespace pack {
+
+    const char MAGIC[8] = {'T', 'W', 'S', 'P', 'A', 'C', 'K', '1'};
+    const uint32_t EMPTY_SLOT = 0xffffffffu;
+    const int ETAG_LEN = 40;
+
+    struct pack_header {
+        char magic[8];
+        uint32_t entry_count;
+        uint32_t bucket_count;
+        uint32_t slot_count;
+        uint32_t reserved;
+        uint64_t disp_off;
+        uint64_t slot_off;
+        uint64_t entry_off;
+    };
+
+    // 一个资源的一种编码
+    struct pack_body {
+        uint64_t hdr_off;  // 预先生成的状态行+头部（不含 Connection/Date 和空行）
+        uint32_t hdr_len;
+        uint32_t reserved;
+        uint64_t body_off;
+        uint64_t body_len;
+    };
+
+    struct pack_entry {
+        uint64_t url_off;
+        uint32_t url_len;
+        uint32_t has_gzip;
+        char etag[ETAG_LEN]; // 带双引号，以 '\0' 结尾
+        pack_body identity;
+        pack_body gzip;      // has_gzip 为 0 时无效
+    };
+
+    // FNV-1a，seed 参与初始值，用于两级完美哈希
+    inline uint32_t hash(const char* s, size_t len, uint32_t seed) {
+        uint32_t h = 2166136261u ^ (seed * 16777619u);
+        for(size_t i = 0; i < len; ++i) {
+            h ^= (unsigned char)s[i];
+            h *= 16777619u;
+        }
+        h ^= h >> 15;
+        h *= 0x2c1b3c6du;
+        h ^= h >> 12;
+        return h;
+    }
+
+}
+
+class asset_pack {
+public:
+    asset_pack() : m_base(nullptr), m_size(0), m_header(nullptr) {}
+    ~asset_pack() {
+        if(m_base) {
+            munmap(m_base, m_size);
+        }
+    }
+
+    // 打开并预读整个资源包，失败时返回false，服务器退回文件系统路径
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        if(fd == -1) {
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(pack::pack_header)) {
+            ::close(fd);
+            return false;
+        }
+        void* addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        ::close(fd);
+        if(addr == MAP_FAILED) {
+            return false;
+        }
+        const pack::pack_header* hdr = (const pack::pack_header*)addr;
+        if(memcmp(hdr->magic, pack::MAGIC, sizeof(pack::MAGIC)) != 0 || hdr->slot_count == 0 || hdr->bucket_count == 0) {
+            munmap(addr, st.st_size);
+            return false;
+        }
+        m_base = (char*)addr;
+        m_size = st.st_size;
+        m_header = hdr;
+        m_disp = (const uint32_t*)(m_base + hdr->disp_off);
+        m_slots = (const uint32_t*)(m_base + hdr->slot_off);
+        m_entries = (const pack::pack_entry*)(m_base + hdr->entry_off);
+        printf("asset pack %s loaded: %u entries, %ld bytes\n", path, hdr->entry_count, (long)m_size);
+        return true;
+    }
+
+    bool loaded() const { return m_header != nullptr; }
+
+    // 按URL查找，O(1)，未命中返回nullptr
+    const pack::pack_entry* find(const char* url, size_t len) const {
+        if(!m_header) {
+            return nullptr;
+        }
+        uint32_t b = pack::hash(url, len, 0) % m_header->bucket_count;
+        uint32_t slot = pack::hash(url, len, m_disp[b]) % m_header->slot_count;
+        uint32_t idx = m_slots[slot];
+        if(idx == pack::EMPTY_SLOT) {
+            return nullptr;
+        }
+        const pack::pack_entry* e = &m_entries[idx];
+        if(e->url_len != len || memcmp(m_base + e->url_off, url, len) != 0) {
+            return nullptr;
+        }
+        return e;
+    }
+
+    const char* at(uint64_t off) const { return m_base + off; }
+
+private:
+    char* m_base;
+    size_t m_size;
+    const pack::pack_header* m_header;
+    const uint32_t* m_disp;
+    const uint32_t* m_slots;
+    const pack::pack_entry* m_entries;
+};
+
+#endif
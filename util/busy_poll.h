@@ -0,0 +1,101 @@
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <sys/epoll.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <algorithm>
+
+// 主循环的自适应忙轮询：有事件之后先用超时为0的epoll_wait转一段时间，下一个请求在窗口内到达就
+// 省掉一次睡眠唤醒和上下文切换；窗口内没等到就回到阻塞等待。窗口按命中情况自动伸缩：
+// 转空了减半，阻塞后很快就被唤醒（多转一会儿就能接住）则加倍，空闲时几乎不再空转。
+// 轮询会占满一个核，只适合给主循环留了专用核、对延迟敏感的部署。
+namespace mirror {
+
+    struct busy_poll_stats {
+        unsigned long long spin_ns = 0;   // 花在轮询上的时间
+        unsigned long long block_ns = 0;  // 阻塞在epoll_wait里的时间
+        unsigned long long hits = 0;      // 轮询期间等到了事件
+        unsigned long long misses = 0;    // 窗口用完也没有事件
+        unsigned long long blocks = 0;    // 阻塞等待的次数
+        long long window_ns = 0;          // 当前的轮询窗口
+    };
+
+    class busy_poller {
+    public:
+        static const long long MIN_WINDOW_NS = 2000; //窗口缩到这以下就不再轮询，等阻塞唤醒的间隔证明值得再打开
+
+        // max_us为0时wait就是普通的epoll_wait
+        explicit busy_poller(unsigned int max_us = 0) { set_max_us(max_us); }
+
+        void set_max_us(unsigned int max_us) {
+            m_max_ns = max_us * 1000LL;
+            m_stats.window_ns = m_max_ns;
+        }
+        bool enabled() const { return m_max_ns > 0; }
+
+        // 用法同epoll_wait，timeout_ms为-1表示没有超时
+        int wait(int epfd, struct epoll_event* events, int max_events, int timeout_ms) {
+            if(m_max_ns == 0 || timeout_ms == 0) {
+                return epoll_wait(epfd, events, max_events, timeout_ms);
+            }
+            long long start = now_ns();
+            if(m_stats.window_ns > 0) {
+                long long window = m_stats.window_ns;
+                if(timeout_ms > 0) {
+                    window = std::min(window, timeout_ms * 1000000LL);
+                }
+                long long now;
+                do {
+                    int n = epoll_wait(epfd, events, max_events, 0);
+                    if(n == 0) {
+                        // 专用核上没有别的线程可运行，立即返回；和工作线程共用核时把CPU让给它们，不至于饿住
+                        sched_yield();
+                    }
+                    now = now_ns();
+                    if(n != 0) {
+                        m_stats.spin_ns += now - start;
+                        ++m_stats.hits;
+                        return n;
+                    }
+                } while(now - start < window);
+                m_stats.spin_ns += now - start;
+                ++m_stats.misses;
+                m_stats.window_ns /= 2;
+                if(m_stats.window_ns < MIN_WINDOW_NS) {
+                    m_stats.window_ns = 0;
+                }
+                if(timeout_ms > 0) {
+                    timeout_ms = std::max(1LL, timeout_ms - (now - start) / 1000000);
+                }
+                start = now;
+            }
+            int n = epoll_wait(epfd, events, max_events, timeout_ms);
+            int saved = errno;
+            long long blocked = now_ns() - start;
+            m_stats.block_ns += blocked;
+            ++m_stats.blocks;
+            if(n > 0 && blocked < m_max_ns) {
+                // 只睡了不到一个最大窗口就来了事件，多转一会儿就能接住；按这次的间隔放大窗口
+                m_stats.window_ns = std::min(m_max_ns, std::max({m_stats.window_ns * 2, blocked * 2, MIN_WINDOW_NS}));
+            }
+            errno = saved;
+            return n;
+        }
+
+        const busy_poll_stats& stats() const { return m_stats; }
+
+    private:
+        static long long now_ns() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+
+        long long m_max_ns = 0;
+        busy_poll_stats m_stats;
+    };
+}
+
+#endif
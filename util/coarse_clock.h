@@ -0,0 +1,56 @@
+#ifndef COARSE_CLOCK_H
+#define COARSE_CLOCK_H
+
+#include <time.h>
+#include <atomic>
+#include <cstdio>
+
+// 粗粒度时钟：主循环每次 epoll_wait 返回时调用一次 update()，
+// 定时器、Date 头部和统计信息都读取缓存值，避免每次 accept/read 都陷入内核取时间。
+class coarse_clock {
+public:
+    static void update() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        m_mono_ms.store(ts.tv_sec * 1000LL + ts.tv_nsec / 1000000, std::memory_order_relaxed);
+        m_wall_sec.store(::time(NULL), std::memory_order_relaxed);
+    }
+
+    // 单调时间（秒），用于定时器的 expire
+    static time_t now() {
+        return m_mono_ms.load(std::memory_order_relaxed) / 1000;
+    }
+
+    // 单调时间（毫秒），用于统计
+    static long long now_ms() {
+        return m_mono_ms.load(std::memory_order_relaxed);
+    }
+
+    // 墙上时间（秒），只用于对外展示
+    static time_t wall() {
+        return m_wall_sec.load(std::memory_order_relaxed);
+    }
+
+    // RFC 7231 格式的 Date 值。工作线程各自缓存一份，秒数变化时才重新格式化
+    static const char* http_date() {
+        thread_local time_t last = -1;
+        thread_local char buf[32];
+        time_t cur = wall();
+        if(cur != last) {
+            struct tm tm_buf;
+            gmtime_r(&cur, &tm_buf);
+            strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm_buf);
+            last = cur;
+        }
+        return buf;
+    }
+
+private:
+    static std::atomic<long long> m_mono_ms;
+    static std::atomic<time_t> m_wall_sec;
+};
+
+std::atomic<long long> coarse_clock::m_mono_ms(0);
+std::atomic<time_t> coarse_clock::m_wall_sec(0);
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef COLD_IO_H
+#define COLD_IO_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <optional>
+#include <coroutine>
+#include <algorithm>
+#include "coarse_clock.h"
+#include "thread_pool_2.0.h"
+#include "error_check.h"
+
+// 冷文件检测与预读：mmap 的文件页不在页缓存中时，writev 会在发送线程上触发缺页并阻塞。
+// 在 do_request 里用 mincore 判断是否冷（结果按 inode 缓存），冷文件在发送前
+// 由工作线程或专用的阻塞 I/O 线程池预先读入，主循环只发送已经在内存中的页。
+namespace mirror {
+
+    const off_t LARGE_FILE_SIZE = 1 << 20;  // 超过这个大小按顺序读提示内核
+    const long long RESIDENT_TTL_MS = 1000; // 确认热过的文件在这段时间内不再检查
+
+    // 以 inode 为键的直接映射缓存，记录最近一次确认整个文件都在页缓存中的时间
+    class residency_cache {
+    public:
+        bool recently_warm(const struct stat& st) const {
+            const slot& s = m_slots[index(st)];
+            return s.key.load(std::memory_order_relaxed) == key(st) &&
+                   coarse_clock::now_ms() - s.warm_ms.load(std::memory_order_relaxed) < RESIDENT_TTL_MS;
+        }
+        void mark_warm(const struct stat& st) {
+            slot& s = m_slots[index(st)];
+            s.key.store(key(st), std::memory_order_relaxed);
+            s.warm_ms.store(coarse_clock::now_ms(), std::memory_order_relaxed);
+        }
+    private:
+        static const int SLOTS = 4096;
+        struct slot {
+            std::atomic<uint64_t> key{0};
+            std::atomic<long long> warm_ms{0};
+        };
+        // 修改时间也参与，文件被替换后自然失效
+        static uint64_t key(const struct stat& st) {
+            return ((uint64_t)st.st_dev << 48) ^ (uint64_t)st.st_ino ^ ((uint64_t)st.st_mtime << 20);
+        }
+        static int index(const struct stat& st) { return (st.st_ino * 2654435761u) % SLOTS; }
+        slot m_slots[SLOTS];
+    };
+
+    // 映射区域是否全部在页缓存中；mincore 不可用时保守地认为是热的
+    inline bool is_resident(const void* addr, size_t len) {
+        static const long page = sysconf(_SC_PAGESIZE);
+        static const size_t CHUNK = 4096; //每次检查的页数
+        thread_local unsigned char vec[CHUNK];
+        uintptr_t begin = (uintptr_t)addr & ~(uintptr_t)(page - 1);
+        uintptr_t end = (uintptr_t)addr + len;
+        while(begin < end) {
+            size_t bytes = std::min((uintptr_t)(CHUNK * page), end - begin);
+            if(mincore((void*)begin, bytes, vec) == -1) {
+                return true;
+            }
+            size_t pages = (bytes + page - 1) / page;
+            for(size_t i = 0; i < pages; ++i) {
+                if(!(vec[i] & 1)) {
+                    return false;
+                }
+            }
+            begin += bytes;
+        }
+        return true;
+    }
+
+    // 阻塞地把映射区域读进内存：先 MADV_WILLNEED 让内核批量预读，再逐页访问，
+    // 缺页发生在调用线程上而不是主循环上
+    inline void prefetch(const void* addr, size_t len) {
+        static const long page = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = (uintptr_t)addr & ~(uintptr_t)(page - 1);
+        madvise((void*)begin, (uintptr_t)addr + len - begin, MADV_WILLNEED);
+        unsigned char sum = 0;
+        for(uintptr_t p = (uintptr_t)addr; p < (uintptr_t)addr + len; p += page) {
+            sum ^= *(const volatile unsigned char*)p;
+        }
+        volatile unsigned char sink = sum;
+        (void)sink;
+    }
+
+    // 打开文件后、mmap 前调用：大文件提示顺序访问并发起异步预读
+    inline void advise_open(int fd, const struct stat& st) {
+        if(st.st_size >= LARGE_FILE_SIZE) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            readahead(fd, 0, st.st_size);
+        }
+    }
+
+    // 专用阻塞 I/O 线程池，给协程模式使用：协程 co_await prefetch 后挂起，
+    // 由池中线程完成预读，再通过 eventfd 通知主循环恢复协程。
+    class io_offload {
+    public:
+        struct prefetch_job {
+            io_offload* owner;
+            const void* addr;
+            size_t len;
+            std::coroutine_handle<> handle;
+            void process() {
+                mirror::prefetch(addr, len);
+                owner->complete(handle);
+            }
+        };
+
+        class prefetch_awaiter {
+        public:
+            prefetch_awaiter(io_offload& o, const void* addr, size_t len) : m_job{&o, addr, len, {}} {}
+            bool await_ready() const noexcept { return false; }
+            // 任务在协程帧内，不额外分配；队列满时不挂起，直接发送
+            bool await_suspend(std::coroutine_handle<> h) {
+                m_job.handle = h;
+                return m_job.owner->m_pool->append(&m_job);
+            }
+            void await_resume() const noexcept {}
+        private:
+            prefetch_job m_job;
+        };
+
+        explicit io_offload(unsigned int threads = 2) {
+            m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            ERROR_CHK(m_event_fd, -1, "eventfd");
+            m_pool.emplace(threads, threads);
+        }
+        // 先停掉线程池并等工作线程退出，之后才能关eventfd、析构m_mutex和m_done：
+        // 正在执行的预读任务完成时还要用到它们
+        ~io_offload() {
+            m_pool.reset();
+            close(m_event_fd);
+        }
+
+        prefetch_awaiter prefetch(const void* addr, size_t len) { return prefetch_awaiter(*this, addr, len); }
+
+        // 注册到主循环的 epoll 上，可读时调用 drain()
+        int event_fd() const { return m_event_fd; }
+
+        // 在主循环线程上恢复所有已完成预读的协程
+        void drain() {
+            uint64_t cnt;
+            while(::read(m_event_fd, &cnt, sizeof(cnt)) > 0) {}
+            std::vector<std::coroutine_handle<>> done;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                done.swap(m_done);
+            }
+            for(auto h : done) {
+                h.resume();
+            }
+        }
+
+    private:
+        void complete(std::coroutine_handle<> h) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done.push_back(h);
+            }
+            uint64_t one = 1;
+            ssize_t ret = ::write(m_event_fd, &one, sizeof(one));
+            (void)ret;
+        }
+
+        int m_event_fd;
+        std::mutex m_mutex;
+        std::vector<std::coroutine_handle<>> m_done;
+        std::optional<mirror::thread_pool<prefetch_job, fixed_size_policy>> m_pool; // 最后声明，最先析构
+    };
+}
+
+#endif
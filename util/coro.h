@@ -0,0 +1,314 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+#include <sys/epoll.h>
+#include "epoll_manage.h"
+#include "coarse_clock.h"
+
+// C++20 协程运行时：每个连接是一个 task<>，在 reactor 线程上 co_await 可读、可写和定时事件。
+// 协程帧从按大小分级的空闲链表分配；co_await 另一个 task 时用对称转移直接切换，
+// 等待 fd/定时器的 awaiter 只是栈上对象，挂起时不分配内存。
+namespace mirror {
+
+    // 协程帧分配器：按 64 字节分级的线程局部空闲链表，帧释放后留给下一个连接复用
+    class frame_pool {
+    public:
+        static void* allocate(size_t size) {
+            size_t cls = (size + GRAIN - 1) / GRAIN;
+            if(cls >= CLASSES) {
+                return ::operator new(size);
+            }
+            free_node*& head = heads()[cls];
+            if(head) {
+                free_node* node = head;
+                head = node->next;
+                return node;
+            }
+            return ::operator new(cls * GRAIN);
+        }
+
+        static void deallocate(void* p, size_t size) {
+            size_t cls = (size + GRAIN - 1) / GRAIN;
+            if(cls >= CLASSES) {
+                ::operator delete(p);
+                return;
+            }
+            free_node* node = (free_node*)p;
+            node->next = heads()[cls];
+            heads()[cls] = node;
+        }
+
+    private:
+        static const size_t GRAIN = 64;
+        static const size_t CLASSES = 64; //4KB以上的帧直接走operator new
+        struct free_node { free_node* next; };
+        static free_node** heads() {
+            thread_local free_node* lists[CLASSES] = {};
+            return lists;
+        }
+    };
+
+    template<typename T = void>
+    class task;
+
+    namespace detail {
+
+        struct promise_base {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+            bool detached = false;
+
+            static void* operator new(size_t size) { return frame_pool::allocate(size); }
+            static void operator delete(void* p, size_t size) { frame_pool::deallocate(p, size); }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            struct final_awaiter {
+                bool await_ready() noexcept { return false; }
+                template<typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                    promise_base& p = h.promise();
+                    if(p.detached) {
+                        h.destroy();
+                        return std::noop_coroutine();
+                    }
+                    // 对称转移：直接恢复等待者，不经过调用栈
+                    return p.continuation ? p.continuation : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            final_awaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception() { exception = std::current_exception(); }
+        };
+
+        template<typename T>
+        struct promise : promise_base {
+            T value;
+            task<T> get_return_object();
+            void return_value(T v) { value = std::move(v); }
+        };
+
+        template<>
+        struct promise<void> : promise_base {
+            task<void> get_return_object();
+            void return_void() {}
+        };
+    }
+
+    template<typename T>
+    class task {
+    public:
+        using promise_type = detail::promise<T>;
+        using handle = std::coroutine_handle<promise_type>;
+
+        explicit task(handle h) : m_handle(h) {}
+        task(task&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+        ~task() {
+            if(m_handle) {
+                m_handle.destroy();
+            }
+        }
+
+        // co_await 子任务：记下自己作为延续，然后对称转移到子任务
+        bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            m_handle.promise().continuation = awaiting;
+            return m_handle;
+        }
+        T await_resume() {
+            if(m_handle.promise().exception) {
+                std::rethrow_exception(m_handle.promise().exception);
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return std::move(m_handle.promise().value);
+            }
+        }
+
+        // 顶层任务：启动后由协程自己在结束时释放帧
+        void detach() {
+            handle h = std::exchange(m_handle, {});
+            h.promise().detached = true;
+            h.resume();
+        }
+
+    private:
+        handle m_handle;
+    };
+
+    namespace detail {
+        template<typename T>
+        task<T> promise<T>::get_return_object() {
+            return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+        }
+        inline task<void> promise<void>::get_return_object() {
+            return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+        }
+    }
+
+    // 单线程 reactor：记录每个 fd 上挂起的协程，epoll 事件或超时到达时恢复它。
+    // fd 仍按 EPOLLONESHOT 注册，每次 co_await 重新 arm 一次。
+    class coro_reactor {
+    public:
+        enum wake_reason {WAKE_EVENT = 0, WAKE_TIMEOUT, WAKE_CANCEL};
+
+        explicit coro_reactor(int max_fd) : m_epfd(-1), m_waiters(max_fd) {}
+
+        void set_epfd(int epfd) { m_epfd = epfd; }
+
+        // 挂起等待 fd 上的 events，timeout_ms <= 0 表示不设超时
+        class io_awaiter {
+        public:
+            io_awaiter(coro_reactor& r, int fd, int events, long long timeout_ms)
+                : m_reactor(r), m_fd(fd), m_events(events), m_timeout_ms(timeout_ms) {}
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) {
+                m_reactor.park(m_fd, h, m_events, m_timeout_ms);
+            }
+            // 返回 true 表示事件就绪，false 表示超时或被取消
+            bool await_resume() const noexcept {
+                return m_reactor.m_waiters[m_fd].reason == WAKE_EVENT;
+            }
+        private:
+            coro_reactor& m_reactor;
+            int m_fd;
+            int m_events;
+            long long m_timeout_ms;
+        };
+
+        io_awaiter readable(int fd, long long timeout_ms = 0) { return io_awaiter(*this, fd, EPOLLIN, timeout_ms); }
+        io_awaiter writable(int fd, long long timeout_ms = 0) { return io_awaiter(*this, fd, EPOLLOUT, timeout_ms); }
+        io_awaiter wait(int fd, int events, long long timeout_ms = 0) { return io_awaiter(*this, fd, events, timeout_ms); }
+
+        // 最近一次恢复fd上协程的原因，区分超时和被取消
+        wake_reason reason(int fd) const { return m_waiters[fd].reason; }
+
+        // 纯定时：挂起 ms 毫秒，fd 用于定位等待槽
+        class sleep_awaiter {
+        public:
+            sleep_awaiter(coro_reactor& r, int fd, long long ms) : m_reactor(r), m_fd(fd), m_ms(ms) {}
+            bool await_ready() const noexcept { return m_ms <= 0; }
+            void await_suspend(std::coroutine_handle<> h) { m_reactor.park(m_fd, h, 0, m_ms); }
+            void await_resume() const noexcept {}
+        private:
+            coro_reactor& m_reactor;
+            int m_fd;
+            long long m_ms;
+        };
+        sleep_awaiter sleep_for(int fd, long long ms) { return sleep_awaiter(*this, fd, ms); }
+
+        // 主循环收到 fd 的事件时调用，返回是否有协程在等
+        bool dispatch(int fd) { return wake(fd, WAKE_EVENT); }
+
+        // 连接被外部关闭（如空闲驱逐）前调用，挂起的协程会看到 false 并自行收尾
+        bool cancel(int fd) { return wake(fd, WAKE_CANCEL); }
+
+        // 之后在 fd 上等待时，epoll 事件带着这个连接句柄（见 conn_handle），主循环据此丢弃旧连接的事件。
+        // 关闭 fd 前要设回 0，同一个号可能接着被上游连接等非客户端 fd 使用
+        void set_handle(int fd, uint64_t handle) { m_waiters[fd].tag = handle; }
+
+        // 处理到期的定时等待，主循环每轮调用一次
+        void tick() {
+            long long now = coarse_clock::now_ms();
+            while(!m_timers.empty() && m_timers.front().deadline <= now) {
+                std::pop_heap(m_timers.begin(), m_timers.end(), std::greater<timer_entry>());
+                timer_entry t = m_timers.back();
+                m_timers.pop_back();
+                if(m_waiters[t.fd].seq == t.seq) {
+                    wake(t.fd, WAKE_TIMEOUT);
+                }
+            }
+        }
+
+        // 距最近一个定时等待到期的毫秒数，没有则返回 -1，供 epoll_wait 使用
+        int next_timeout_ms() const {
+            if(m_timers.empty()) {
+                return -1;
+            }
+            long long d = m_timers.front().deadline - coarse_clock::now_ms();
+            return d < 0 ? 0 : (int)d;
+        }
+
+    private:
+        struct waiter {
+            std::coroutine_handle<> handle;
+            unsigned long long seq = 0; //每次挂起递增，用来识别过期的定时项
+            uint64_t tag = 0; //注册 epoll 事件时带的连接句柄，0 表示只带 fd
+            wake_reason reason = WAKE_EVENT;
+            bool timed = false; //堆里有这次挂起的定时项
+        };
+        struct timer_entry {
+            long long deadline;
+            int fd;
+            unsigned long long seq;
+            bool operator>(const timer_entry& o) const { return deadline > o.deadline; }
+        };
+
+        void park(int fd, std::coroutine_handle<> h, int events, long long timeout_ms) {
+            waiter& w = m_waiters[fd];
+            w.handle = h;
+            ++w.seq;
+            if(w.timed) {
+                w.timed = false;
+                --m_live_timers;
+            }
+            if(events) {
+                epoll_mod(m_epfd, fd, events, w.tag ? w.tag : conn_handle(fd, 0));
+            }
+            if(timeout_ms > 0) {
+                m_timers.push_back({coarse_clock::now_ms() + timeout_ms, fd, w.seq});
+                std::push_heap(m_timers.begin(), m_timers.end(), std::greater<timer_entry>());
+                w.timed = true;
+                ++m_live_timers;
+                compact();
+            }
+        }
+
+        // 提前结束的等待留下的定时项要到堆顶才会被丢掉，keep-alive连接上每个请求都留一个。
+        // 作废的项超过一定数量且多于有效项时重建一次堆，均摊下来每次push是O(1)的额外开销
+        void compact() {
+            size_t stale = m_timers.size() - m_live_timers;
+            if(stale < COMPACT_MIN || stale < m_live_timers) {
+                return;
+            }
+            m_timers.erase(std::remove_if(m_timers.begin(), m_timers.end(), [this](const timer_entry& t) {
+                return m_waiters[t.fd].seq != t.seq;
+            }), m_timers.end());
+            std::make_heap(m_timers.begin(), m_timers.end(), std::greater<timer_entry>());
+        }
+
+        bool wake(int fd, wake_reason reason) {
+            waiter& w = m_waiters[fd];
+            if(!w.handle) {
+                return false;
+            }
+            std::coroutine_handle<> h = std::exchange(w.handle, {});
+            ++w.seq; //作废尚未到期的定时项
+            if(w.timed) {
+                w.timed = false;
+                --m_live_timers;
+            }
+            w.reason = reason;
+            h.resume();
+            return true;
+        }
+
+        static const size_t COMPACT_MIN = 1024;
+
+        int m_epfd;
+        std::vector<waiter> m_waiters;
+        std::vector<timer_entry> m_timers; //按deadline的小根堆，含已作废的项
+        size_t m_live_timers = 0;          //m_timers中仍有效的项数
+    };
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef DGRAM_FETCH_H
+#define DGRAM_FETCH_H
+
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include "udp_batch.h"
+#include "asset_pack.h"
+
+// UDP上的分段取文件：客户端按区间请求资源包里的文件，服务器把区间切成不超过DGRAM_PAYLOAD的
+// 数据报一次发出（经udp_tx_batch走GSO）。区间彼此独立，丢了哪段只补哪段，后面的数据不用等它，
+// 没有TCP那种一个丢包卡住整条连接的队头阻塞。可靠性完全由客户端负责：超时没收齐就重新请求缺的区间。
+// 只回答资源包里的文件（内存常驻，不会在主循环上阻塞），其余路径回复NOT_FOUND。
+// 报文里的整数都是网络字节序。
+//
+// 地址验证（同QUIC的Retry）：UDP的源地址可以伪造，一个几十字节的请求能换来几十KB的响应，
+// 不验证就成了反射放大攻击的跳板。请求里没有带对当前源地址有效的令牌时，只回一个dgram_retry
+// 告诉客户端令牌，不发任何数据，回复不超过请求长度的DGRAM_AMPLIFICATION倍；客户端带着令牌重发。
+// 令牌是源IP和时间段的SipHash，密钥每个进程随机生成，服务器不用为客户端保存状态。
+namespace mirror {
+
+    const uint32_t DGRAM_MAGIC = 0x54575332;        // "TWS2"
+    const uint32_t DGRAM_RETRY_MAGIC = 0x54575352;  // "TWSR"
+    const size_t DGRAM_PAYLOAD = 1200;              // 每个数据报的负载，加上头部和IPv6/UDP头也不会被分片
+    const uint32_t DGRAM_MAX_RANGE = 48 * DGRAM_PAYLOAD; // 一个请求最多取这么多，正好一个GSO报文
+    const uint64_t DGRAM_NOT_FOUND = ~0ULL;
+    const size_t DGRAM_AMPLIFICATION = 3;           // 未验证地址的回复最多是请求长度的几倍
+    const long DGRAM_TOKEN_SECONDS = 60;            // 令牌的时间段，上一个时间段签发的也接受
+
+    // 请求：头部后面紧跟path_len字节的路径（不以\0结尾），路径之后的字节忽略，可以用来填充
+    struct dgram_request {
+        uint32_t magic;
+        uint32_t id;        // 客户端自己的编号，原样带回
+        uint64_t offset;
+        uint32_t length;
+        uint16_t path_len;
+        uint16_t reserved;
+        uint64_t token;     // 上次dgram_retry给的令牌，第一次请求填0
+    } __attribute__((packed));
+
+    // 响应：每个数据报一个头部，后面是从offset开始的数据
+    struct dgram_header {
+        uint32_t magic;
+        uint32_t id;
+        uint64_t offset;
+        uint64_t total;     // 文件总长度，找不到时为DGRAM_NOT_FOUND
+    } __attribute__((packed));
+
+    // 令牌无效时的唯一回复，客户端换上token后重发同一个请求
+    struct dgram_retry {
+        uint32_t magic;     // DGRAM_RETRY_MAGIC
+        uint32_t id;
+        uint64_t token;
+    } __attribute__((packed));
+
+    // SipHash-2-4：带密钥的短输入哈希，不知道密钥就算不出对某个地址有效的令牌
+    inline uint64_t siphash24(const uint64_t key[2], const void* data, size_t len) {
+        auto rotl = [](uint64_t x, int b) { return (x << b) | (x >> (64 - b)); };
+        uint64_t v0 = 0x736f6d6570736575ULL ^ key[0], v1 = 0x646f72616e646f6dULL ^ key[1];
+        uint64_t v2 = 0x6c7967656e657261ULL ^ key[0], v3 = 0x7465646279746573ULL ^ key[1];
+        auto round = [&]() {
+            v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+            v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+            v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+            v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+        };
+        const uint8_t* p = (const uint8_t*)data;
+        size_t blocks = len / 8;
+        for(size_t i = 0; i < blocks; ++i) {
+            uint64_t m;
+            memcpy(&m, p + i * 8, 8);
+            m = le64toh(m);
+            v3 ^= m;
+            round();
+            round();
+            v0 ^= m;
+        }
+        uint64_t last = (uint64_t)len << 56;
+        for(size_t i = 0; i < len % 8; ++i) {
+            last |= (uint64_t)p[blocks * 8 + i] << (8 * i);
+        }
+        v3 ^= last;
+        round();
+        round();
+        v0 ^= last;
+        v2 ^= 0xff;
+        for(int i = 0; i < 4; ++i) {
+            round();
+        }
+        return v0 ^ v1 ^ v2 ^ v3;
+    }
+
+    // 签发和检查地址令牌，只在主循环上使用
+    class dgram_tokens {
+    public:
+        dgram_tokens() {
+            if(getrandom(m_key, sizeof(m_key), 0) != (ssize_t)sizeof(m_key)) {
+                // 没有getrandom时退回/dev/urandom；都不可用就用时间和地址凑，仍然比不验证好
+                int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+                if(fd == -1 || read(fd, m_key, sizeof(m_key)) != (ssize_t)sizeof(m_key)) {
+                    struct timespec ts;
+                    clock_gettime(CLOCK_REALTIME, &ts);
+                    m_key[0] = ts.tv_nsec ^ (uint64_t)(uintptr_t)this;
+                    m_key[1] = ts.tv_sec ^ (uint64_t)getpid() << 32;
+                }
+                if(fd != -1) {
+                    close(fd);
+                }
+            }
+        }
+
+        uint64_t issue(const sockaddr_storage& peer) {
+            ++issued;
+            return sign(peer, epoch());
+        }
+
+        bool valid(const sockaddr_storage& peer, uint64_t token) const {
+            uint64_t now = epoch();
+            return token != 0 && (token == sign(peer, now) || token == sign(peer, now - 1));
+        }
+
+        unsigned long long issued = 0;   // 回过的dgram_retry数
+
+    private:
+        static uint64_t epoch() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return ts.tv_sec / DGRAM_TOKEN_SECONDS + 1; // 从1开始，上一个时间段不会下溢
+        }
+
+        // 只签IP不签端口：NAT换了端口不用重新验证，能收到这个IP的包就够防放大了
+        uint64_t sign(const sockaddr_storage& peer, uint64_t epoch) const {
+            uint8_t buf[8 + 16];
+            size_t len = 8;
+            memcpy(buf, &epoch, 8);
+            if(peer.ss_family == AF_INET6) {
+                memcpy(buf + len, &((const sockaddr_in6&)peer).sin6_addr, 16);
+                len += 16;
+            } else {
+                memcpy(buf + len, &((const sockaddr_in&)peer).sin_addr, 4);
+                len += 4;
+            }
+            uint64_t t = siphash24(m_key, buf, len);
+            return t ? t : 1; // 0留给“没有令牌”
+        }
+
+        uint64_t m_key[2];
+    };
+
+    // 处理一个请求数据报，响应写进tx，由调用者flush；格式不对的请求直接忽略
+    inline bool dgram_respond(const asset_pack& assets, dgram_tokens& tokens, const sockaddr_storage& peer,
+                              socklen_t peer_len, const char* data, size_t len, udp_tx_batch& tx) {
+        dgram_request req;
+        if(len < sizeof(req)) {
+            return false;
+        }
+        memcpy(&req, data, sizeof(req));
+        size_t path_len = be16toh(req.path_len);
+        if(be32toh(req.magic) != DGRAM_MAGIC || sizeof(req) + path_len > len) {
+            return false;
+        }
+        if(!tokens.valid(peer, be64toh(req.token))) {
+            // 请求至少sizeof(dgram_request)字节，这个回复总在放大倍数以内
+            static_assert(sizeof(dgram_retry) <= DGRAM_AMPLIFICATION * sizeof(dgram_request), "retry too large");
+            dgram_retry r;
+            r.magic = htobe32(DGRAM_RETRY_MAGIC);
+            r.id = req.id;
+            r.token = htobe64(tokens.issue(peer));
+            memcpy(tx.alloc(peer, peer_len, sizeof(r)), &r, sizeof(r));
+            return true;
+        }
+        const pack::pack_entry* e = assets.find(data + sizeof(req), path_len);
+        dgram_header h;
+        h.magic = req.magic;
+        h.id = req.id;
+        if(!e) {
+            h.offset = req.offset;
+            h.total = htobe64(DGRAM_NOT_FOUND);
+            memcpy(tx.alloc(peer, peer_len, sizeof(h)), &h, sizeof(h));
+            return true;
+        }
+        const char* body = assets.at(e->identity.body_off);
+        uint64_t total = e->identity.body_len;
+        uint64_t offset = be64toh(req.offset);
+        uint64_t end = offset + std::min<uint64_t>(be32toh(req.length), DGRAM_MAX_RANGE);
+        end = std::min(end, total);
+        h.total = htobe64(total);
+        do { // 越界或空文件也回一个只有头部的数据报，告诉客户端总长度
+            size_t n = offset < end ? std::min<uint64_t>(DGRAM_PAYLOAD, end - offset) : 0;
+            char* p = tx.alloc(peer, peer_len, sizeof(h) + n);
+            h.offset = htobe64(offset);
+            memcpy(p, &h, sizeof(h));
+            memcpy(p + sizeof(h), body + offset, n);
+            offset += n;
+        } while(offset < end);
+        return true;
+    }
+}
+
+#endif
@@ -4,8 +4,24 @@
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include "error_check.h"
 
+// 连接句柄：低32位是fd，高32位是连接槽位的代数。fd关闭后内核会把同一个号分给新连接，
+// 槽位每关闭一次代数加一，拿着旧句柄的事件、任务和定时器一比就知道过期了，不用加锁。
+// 代数0表示不是连接（监听socket、管道等），epoll里直接存fd
+uint64_t conn_handle(int fd, uint32_t gen) {
+    return (uint64_t)gen << 32 | (uint32_t)fd;
+}
+
+int handle_fd(uint64_t handle) {
+    return (int)(uint32_t)handle;
+}
+
+uint32_t handle_gen(uint64_t handle) {
+    return handle >> 32;
+}
+
 void set_nonblock(int fd) {
     int flag = fcntl(fd, F_GETFL);
     ERROR_CHK(flag, -1, "getfl");
@@ -14,9 +30,9 @@ void set_nonblock(int fd) {
     ERROR_CHK(ret, -1, "setfl");
 }
 
-void epoll_add(int epfd, int fd, bool oneshot) {
+void epoll_add(int epfd, int fd, bool oneshot, uint64_t handle) {
     struct epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = handle;
     event.events = EPOLLIN | EPOLLRDHUP; //加上挂起的监控
     if(oneshot) {
         event.events |= EPOLLONESHOT; //只触发一次，避免多个线程同时操作socket，但是必须线程每次重置，不然这辈子就只触发一次了
@@ -27,6 +43,10 @@ void epoll_add(int epfd, int fd, bool oneshot) {
     set_nonblock(fd);
 }
 
+void epoll_add(int epfd, int fd, bool oneshot) {
+    epoll_add(epfd, fd, oneshot, conn_handle(fd, 0));
+}
+
 int epoll_init(int listen_fd) {
     int epfd = epoll_create(233);
     ERROR_CHK(epfd, -1, "epoll_create");
@@ -41,11 +61,15 @@ void epoll_rm(int epfd, int fd) {
     ERROR_CHK(ret, -1, "close");
 }
 
-void epoll_mod(int epfd, int fd, int new_event) {
+void epoll_mod(int epfd, int fd, int new_event, uint64_t handle) {
     struct epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = handle;
     event.events = new_event | EPOLLONESHOT | EPOLLRDHUP;
     epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &event);
 }
 
+void epoll_mod(int epfd, int fd, int new_event) {
+    epoll_mod(epfd, fd, new_event, conn_handle(fd, 0));
+}
+
 #endif
\ No newline at end of file
@@ -12,6 +12,13 @@ inline void ARGC_CHECK(int argc, int need_argc, const char* msg) {
     }
 }
 
+inline void ARGC_CHECK(int argc, int need_argc, int or_argc, const char* msg) {
+    if(argc != need_argc && argc != or_argc) {
+        printf("%s\n", msg);
+        exit(-1);
+    }
+}
+
 inline void ERROR_CHK(int ret, int error_ret, const char* msg) {
     if(ret == error_ret) {
         perror(msg);
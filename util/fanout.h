@@ -0,0 +1,199 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <vector>
+
+// 一份数据发给多个连接：WebSocket的广播帧和SSE的事件共用这里的引用计数缓冲、订阅者的发送队列和订阅者集合。
+// 数据只序列化一次，各订阅者的队列引用同一份；每轮事件循环结束时flush一次，同一轮里攒下的块对每个订阅者
+// 合成一次writev。都只在reactor线程上访问，不加锁
+namespace mirror {
+
+    // 引用计数的只读缓冲，数据紧跟在对象后面，一次malloc；最后一个引用释放。
+    // ws_frame、sse_event从它派生，只加构造数据的静态函数，不能有自己的成员
+    class shared_chunk {
+    public:
+        void ref(int n = 1) { m_refs += n; }
+        void unref() {
+            if(--m_refs == 0) {
+                free(this);
+            }
+        }
+        const char* data() const { return (const char*)(this + 1); }
+        char* data() { return (char*)(this + 1); }
+        size_t size() const { return m_len; }
+
+    protected:
+        shared_chunk() = default;
+
+        // 分配cap字节的数据区，引用为1，长度先记为cap，写完后可以用set_size改小
+        template<typename T>
+        static T* alloc(size_t cap) {
+            static_assert(sizeof(T) == sizeof(shared_chunk), "chunk types must not add members");
+            T* c = (T*)malloc(sizeof(T) + cap);
+            c->m_refs = 1;
+            c->m_len = cap;
+            return c;
+        }
+        void set_size(size_t n) { m_len = n; }
+
+    private:
+        int m_refs;
+        size_t m_len;
+    };
+
+    // 一个订阅者的发送队列：有上限的环形队列，元素是块的引用。dirty和hub_index由fanout_hub维护
+    class fanout_queue {
+    public:
+        explicit fanout_queue(size_t max_queued) : m_max(max_queued < 2 ? 2 : max_queued) {}
+        ~fanout_queue() {
+            while(m_count > 0) {
+                pop();
+            }
+        }
+        fanout_queue(const fanout_queue&) = delete;
+        fanout_queue& operator=(const fanout_queue&) = delete;
+
+        // 加入队列，调用者已经给c加过这次的引用；队列满返回false，引用仍归调用者
+        bool push(shared_chunk* c) {
+            if(m_count >= m_max) {
+                return false;
+            }
+            if(m_count == m_ring.size()) {
+                grow();
+            }
+            m_ring[(m_head + m_count) & (m_ring.size() - 1)] = c;
+            ++m_count;
+            return true;
+        }
+
+        // 从队头起最多max个待发的块，第一个块跳过已经发出的部分
+        int fill_iov(struct iovec* iov, int max) const {
+            int n = 0;
+            for(size_t i = 0; i < m_count && n < max; ++i, ++n) {
+                shared_chunk* c = m_ring[(m_head + i) & (m_ring.size() - 1)];
+                size_t skip = i == 0 ? m_offset : 0;
+                iov[n].iov_base = c->data() + skip;
+                iov[n].iov_len = c->size() - skip;
+            }
+            return n;
+        }
+
+        // 已经发出n字节，释放发完的块
+        void consume(size_t n) {
+            m_sent += n;
+            while(n > 0 && m_count > 0) {
+                size_t left = m_ring[m_head]->size() - m_offset;
+                if(n < left) {
+                    m_offset += n;
+                    return;
+                }
+                n -= left;
+                pop();
+            }
+        }
+
+        bool pending() const { return m_count > 0; }
+        bool full() const { return m_count >= m_max; }
+        unsigned long long sent() const { return m_sent; } // 累计发出的字节数
+
+        bool dirty = false;    // 已在hub本轮待发送的列表里
+        size_t hub_index = 0;  // 在hub订阅者数组中的下标
+
+    protected:
+        // 腾出一个位置。队头的块已经发出一部分时不能丢（否则流里会出现半个块），丢它后面那个；
+        // 只在队列满时调用，这时至少有两个块
+        void drop_oldest() {
+            if(m_offset == 0) {
+                pop();
+                return;
+            }
+            size_t second = (m_head + 1) & (m_ring.size() - 1);
+            m_ring[second]->unref();
+            m_ring[second] = m_ring[m_head];
+            m_head = second;
+            --m_count;
+        }
+
+    private:
+        void pop() {
+            m_ring[m_head]->unref();
+            m_head = (m_head + 1) & (m_ring.size() - 1);
+            --m_count;
+            m_offset = 0;
+        }
+
+        // 环形队列按2的幂扩容，从8个开始，大多数订阅者跟得上，不会超过
+        void grow() {
+            std::vector<shared_chunk*> ring(m_ring.empty() ? 8 : m_ring.size() * 2);
+            for(size_t i = 0; i < m_count; ++i) {
+                ring[i] = m_ring[(m_head + i) & (m_ring.size() - 1)];
+            }
+            m_ring.swap(ring);
+            m_head = 0;
+        }
+
+        std::vector<shared_chunk*> m_ring;
+        size_t m_max;
+        size_t m_head = 0;
+        size_t m_count = 0;
+        size_t m_offset = 0;              // 队头的块已经发出的字节数
+        unsigned long long m_sent = 0;
+    };
+
+    // 订阅者集合和本轮有数据待发的订阅者。access提供三个静态函数：
+    //   queue(c)  连接的发送队列（fanout_queue的派生类），连接关闭后为空
+    //   flush(c)  把发送队列尽量写出：1发完，0发送缓冲满，-1出错
+    //   abort(c)  断开这个订阅者，连接由事件循环关闭
+    template<typename conn, typename access>
+    class fanout_hub {
+    public:
+        size_t size() const { return m_subs.size(); }
+
+        void join(conn* c) {
+            access::queue(c)->hub_index = m_subs.size();
+            m_subs.push_back(c);
+        }
+
+        void leave(conn* c) {
+            size_t i = access::queue(c)->hub_index;
+            m_subs[i] = m_subs.back();
+            access::queue(m_subs[i])->hub_index = i;
+            m_subs.pop_back();
+        }
+
+        // 队列里有了新数据，登记到本轮flush的列表里
+        void mark(conn* c) {
+            fanout_queue* q = access::queue(c);
+            if(!q->dirty) {
+                q->dirty = true;
+                m_dirty.push_back(c);
+            }
+        }
+
+        // 主循环每轮调用一次
+        void flush() {
+            // 已关闭的连接队列为空；槽位被新的订阅连接复用时多flush一次也无妨
+            for(conn* c : m_dirty) {
+                fanout_queue* q = access::queue(c);
+                if(!q || !q->dirty) {
+                    continue;
+                }
+                q->dirty = false;
+                if(access::flush(c) < 0) {
+                    access::abort(c);
+                }
+            }
+            m_dirty.clear();
+        }
+
+    protected:
+        std::vector<conn*> m_subs;
+
+    private:
+        std::vector<conn*> m_dirty;
+    };
+}
+
+#endif
@@ -0,0 +1,451 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <utility>
+
+// HTTP/2 头部压缩（RFC 7541）：静态表 + 动态表，解码支持哈夫曼字符串，
+// 编码只输出原始字符串，能命中表项的字段用索引表示。
+namespace mirror {
+namespace hpack {
+
+    struct header_field {
+        const char* name;
+        const char* value;
+    };
+
+    // RFC 7541 附录 A 静态表，下标从1开始
+    const header_field STATIC_TABLE[] = {
+        {"", ""},
+        {":authority", ""},
+        {":method", "GET"},
+        {":method", "POST"},
+        {":path", "/"},
+        {":path", "/index.html"},
+        {":scheme", "http"},
+        {":scheme", "https"},
+        {":status", "200"},
+        {":status", "204"},
+        {":status", "206"},
+        {":status", "304"},
+        {":status", "400"},
+        {":status", "404"},
+        {":status", "500"},
+        {"accept-charset", ""},
+        {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""},
+        {"accept-ranges", ""},
+        {"accept", ""},
+        {"access-control-allow-origin", ""},
+        {"age", ""},
+        {"allow", ""},
+        {"authorization", ""},
+        {"cache-control", ""},
+        {"content-disposition", ""},
+        {"content-encoding", ""},
+        {"content-language", ""},
+        {"content-length", ""},
+        {"content-location", ""},
+        {"content-range", ""},
+        {"content-type", ""},
+        {"cookie", ""},
+        {"date", ""},
+        {"etag", ""},
+        {"expect", ""},
+        {"expires", ""},
+        {"from", ""},
+        {"host", ""},
+        {"if-match", ""},
+        {"if-modified-since", ""},
+        {"if-none-match", ""},
+        {"if-range", ""},
+        {"if-unmodified-since", ""},
+        {"last-modified", ""},
+        {"link", ""},
+        {"location", ""},
+        {"max-forwards", ""},
+        {"proxy-authenticate", ""},
+        {"proxy-authorization", ""},
+        {"range", ""},
+        {"referer", ""},
+        {"refresh", ""},
+        {"retry-after", ""},
+        {"server", ""},
+        {"set-cookie", ""},
+        {"strict-transport-security", ""},
+        {"transfer-encoding", ""},
+        {"user-agent", ""},
+        {"vary", ""},
+        {"via", ""},
+        {"www-authenticate", ""},
+    };
+
+    // RFC 7541 附录 B 哈夫曼编码（不含EOS）
+    const uint32_t HUFFMAN_CODES[256] = {
+        0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+        0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+        0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+        0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+        0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+        0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+        0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+        0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+        0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+        0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+        0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+        0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+        0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+        0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+        0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+        0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+        0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+        0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+        0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+        0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+        0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+        0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+        0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+        0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+        0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+        0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+        0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+        0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+        0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+        0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+        0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+        0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    };
+    const uint8_t HUFFMAN_CODE_LEN[256] = {
+        13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+        28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+        6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+        5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+        13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+        15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+        6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+        20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+        24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+        22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+        21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+        26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+        19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+        20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+        26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    };
+
+    const size_t STATIC_COUNT = 61;
+    const size_t ENTRY_OVERHEAD = 32;
+    const size_t DEFAULT_TABLE_SIZE = 4096;
+
+    // 动态表：新条目在前，索引 62 是最新的一条
+    class dynamic_table {
+    public:
+        explicit dynamic_table(size_t max_size = DEFAULT_TABLE_SIZE) : m_size(0), m_max_size(max_size) {}
+
+        void add(std::string_view name, std::string_view value) {
+            size_t need = name.size() + value.size() + ENTRY_OVERHEAD;
+            evict(need > m_max_size ? m_max_size : m_max_size - need);
+            if(need > m_max_size) {
+                return; //比整张表还大，按规范清空表后丢弃
+            }
+            m_entries.emplace_front(std::string(name), std::string(value));
+            m_size += need;
+        }
+
+        void set_max_size(size_t max_size) {
+            m_max_size = max_size;
+            evict(m_max_size);
+        }
+
+        // idx 从 0 开始，0 是最新的一条
+        const std::pair<std::string, std::string>* get(size_t idx) const {
+            return idx < m_entries.size() ? &m_entries[idx] : nullptr;
+        }
+        size_t count() const { return m_entries.size(); }
+        size_t max_size() const { return m_max_size; }
+
+    private:
+        void evict(size_t limit) {
+            while(m_size > limit && !m_entries.empty()) {
+                m_size -= m_entries.back().first.size() + m_entries.back().second.size() + ENTRY_OVERHEAD;
+                m_entries.pop_back();
+            }
+        }
+
+        std::deque<std::pair<std::string, std::string>> m_entries;
+        size_t m_size;
+        size_t m_max_size;
+    };
+
+    // 前缀整数编码
+    inline void encode_int(std::string& out, uint8_t first, int prefix, uint64_t v) {
+        uint64_t max = (1u << prefix) - 1;
+        if(v < max) {
+            out.push_back((char)(first | v));
+            return;
+        }
+        out.push_back((char)(first | max));
+        v -= max;
+        while(v >= 128) {
+            out.push_back((char)(0x80 | (v & 0x7f)));
+            v >>= 7;
+        }
+        out.push_back((char)v);
+    }
+
+    inline bool decode_int(const uint8_t*& p, const uint8_t* end, int prefix, uint64_t& v) {
+        if(p >= end) {
+            return false;
+        }
+        uint64_t max = (1u << prefix) - 1;
+        v = *p++ & max;
+        if(v < max) {
+            return true;
+        }
+        for(int shift = 0; p < end && shift < 56; shift += 7) {
+            uint8_t b = *p++;
+            v += (uint64_t)(b & 0x7f) << shift;
+            if(!(b & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 哈夫曼解码用的二叉树，第一次使用时按码表构建
+    class huffman_tree {
+    public:
+        static const huffman_tree& get() {
+            static huffman_tree tree;
+            return tree;
+        }
+
+        bool decode(const uint8_t* p, size_t len, std::string& out) const {
+            int node = 0;
+            int depth = 0;  // 当前未完成符号已读入的位数
+            bool all_ones = true;
+            for(size_t i = 0; i < len; ++i) {
+                for(int bit = 7; bit >= 0; --bit) {
+                    int b = (p[i] >> bit) & 1;
+                    node = m_nodes[node].child[b];
+                    if(node <= 0) {
+                        return false; //走到了不存在的分支（只可能是EOS）
+                    }
+                    ++depth;
+                    all_ones = all_ones && b;
+                    if(m_nodes[node].sym >= 0) {
+                        out.push_back((char)m_nodes[node].sym);
+                        node = 0;
+                        depth = 0;
+                        all_ones = true;
+                    }
+                }
+            }
+            // 结尾填充必须是不超过7位的全1
+            return depth < 8 && all_ones;
+        }
+
+    private:
+        struct tree_node {
+            int child[2];
+            int sym;
+        };
+
+        huffman_tree() {
+            m_nodes.reserve(512);
+            m_nodes.push_back({{0, 0}, -1});
+            for(int sym = 0; sym < 256; ++sym) {
+                uint32_t code = HUFFMAN_CODES[sym];
+                int len = HUFFMAN_CODE_LEN[sym];
+                int node = 0;
+                for(int i = len - 1; i >= 0; --i) {
+                    int b = (code >> i) & 1;
+                    if(m_nodes[node].child[b] == 0) {
+                        m_nodes[node].child[b] = m_nodes.size();
+                        m_nodes.push_back({{0, 0}, -1});
+                    }
+                    node = m_nodes[node].child[b];
+                }
+                m_nodes[node].sym = sym;
+            }
+        }
+
+        std::vector<tree_node> m_nodes;
+    };
+
+    inline bool decode_string(const uint8_t*& p, const uint8_t* end, std::string& out) {
+        if(p >= end) {
+            return false;
+        }
+        bool huffman = *p & 0x80;
+        uint64_t len;
+        if(!decode_int(p, end, 7, len) || len > (uint64_t)(end - p)) {
+            return false;
+        }
+        out.clear();
+        if(huffman) {
+            if(!huffman_tree::get().decode(p, len, out)) {
+                return false;
+            }
+        } else {
+            out.assign((const char*)p, len);
+        }
+        p += len;
+        return true;
+    }
+
+    inline void encode_string(std::string& out, std::string_view s) {
+        encode_int(out, 0, 7, s.size());
+        out.append(s.data(), s.size());
+    }
+
+    class decoder {
+    public:
+        // 对方在 SETTINGS 中允许的上限，表大小更新指令不能超过它
+        void set_max_table_size(size_t size) { m_limit = size; }
+
+        // 解码一个完整的头部块，对每个字段调用 on_header(name, value)，格式错误返回false
+        template<typename F>
+        bool decode(const uint8_t* p, size_t len, F&& on_header) {
+            const uint8_t* end = p + len;
+            std::string name, value;
+            while(p < end) {
+                uint8_t b = *p;
+                uint64_t idx;
+                if(b & 0x80) {
+                    // 索引字段
+                    if(!decode_int(p, end, 7, idx) || !lookup(idx, name, value)) {
+                        return false;
+                    }
+                    on_header(std::string_view(name), std::string_view(value));
+                    continue;
+                }
+                if((b & 0xe0) == 0x20) {
+                    // 动态表大小更新
+                    if(!decode_int(p, end, 5, idx) || idx > m_limit) {
+                        return false;
+                    }
+                    m_table.set_max_size(idx);
+                    continue;
+                }
+                // 字面量：0x40 加入动态表，0x00 不加入，0x10 永不加入
+                bool indexing = (b & 0xc0) == 0x40;
+                int prefix = indexing ? 6 : 4;
+                if(!decode_int(p, end, prefix, idx)) {
+                    return false;
+                }
+                if(idx) {
+                    std::string unused;
+                    if(!lookup(idx, name, unused)) {
+                        return false;
+                    }
+                } else if(!decode_string(p, end, name)) {
+                    return false;
+                }
+                if(!decode_string(p, end, value)) {
+                    return false;
+                }
+                if(indexing) {
+                    m_table.add(name, value);
+                }
+                on_header(std::string_view(name), std::string_view(value));
+            }
+            return true;
+        }
+
+    private:
+        bool lookup(uint64_t idx, std::string& name, std::string& value) const {
+            if(idx == 0) {
+                return false;
+            }
+            if(idx <= STATIC_COUNT) {
+                name = STATIC_TABLE[idx].name;
+                value = STATIC_TABLE[idx].value;
+                return true;
+            }
+            const std::pair<std::string, std::string>* e = m_table.get(idx - STATIC_COUNT - 1);
+            if(!e) {
+                return false;
+            }
+            name = e->first;
+            value = e->second;
+            return true;
+        }
+
+        dynamic_table m_table;
+        size_t m_limit = DEFAULT_TABLE_SIZE;
+    };
+
+    class encoder {
+    public:
+        // 对方通过 SETTINGS_HEADER_TABLE_SIZE 调整，下一个头部块开头要告知
+        void set_max_table_size(size_t size) {
+            size = size < DEFAULT_TABLE_SIZE ? size : DEFAULT_TABLE_SIZE;
+            if(size != m_table.max_size()) {
+                m_table.set_max_size(size);
+                m_size_update = true;
+            }
+        }
+
+        void begin_block(std::string& out) {
+            if(m_size_update) {
+                encode_int(out, 0x20, 5, m_table.max_size());
+                m_size_update = false;
+            }
+        }
+
+        // index 为 false 时不进动态表，用于 date、content-length 这类每次都变的字段
+        void encode(std::string& out, std::string_view name, std::string_view value, bool index = true) {
+            size_t name_idx = 0;
+            for(size_t i = 1; i <= STATIC_COUNT; ++i) {
+                if(name == STATIC_TABLE[i].name) {
+                    if(value == STATIC_TABLE[i].value) {
+                        encode_int(out, 0x80, 7, i);
+                        return;
+                    }
+                    if(!name_idx) {
+                        name_idx = i;
+                    }
+                }
+            }
+            for(size_t i = 0; i < m_table.count(); ++i) {
+                const std::pair<std::string, std::string>* e = m_table.get(i);
+                if(e->first == name) {
+                    if(e->second == value) {
+                        encode_int(out, 0x80, 7, STATIC_COUNT + 1 + i);
+                        return;
+                    }
+                    if(!name_idx) {
+                        name_idx = STATIC_COUNT + 1 + i;
+                    }
+                }
+            }
+            if(index) {
+                encode_int(out, 0x40, 6, name_idx);
+            } else {
+                encode_int(out, 0x00, 4, name_idx);
+            }
+            if(!name_idx) {
+                encode_string(out, name);
+            }
+            encode_string(out, value);
+            if(index) {
+                m_table.add(name, value);
+            }
+        }
+
+    private:
+        dynamic_table m_table;
+        bool m_size_update = false;
+    };
+
+}
+}
+
+#endif
@@ -0,0 +1,591 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <string_view>
+#include <map>
+#include <deque>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdio>
+#include "hpack.h"
+
+// HTTP/2（RFC 9113）连接会话：解析客户端帧，按流收集请求交给 resolver 找到静态文件，
+// 再由调度器在连接/流两级流控窗口内轮转输出各个流的 DATA 帧，所有流共用一个 TCP 连接。
+// 会话只处理字节，收发仍由 http_conn 的 read/flush 完成。
+namespace mirror {
+
+    const char H2_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    const size_t H2_PREFACE_LEN = 24;
+    const size_t H2_FRAME_HEADER = 9;
+    const uint32_t H2_DEFAULT_WINDOW = 65535;
+    const uint32_t H2_MAX_FRAME_SIZE = 16384;       //我们接受的最大帧
+    const uint32_t H2_MAX_CONCURRENT_STREAMS = 128;
+    const uint32_t H2_MAX_HEADER_LIST_SIZE = 16384; //头部块和解码后的头部列表（按RFC的name+value+32计）的上限
+
+    enum h2_frame_type {H2_DATA = 0, H2_HEADERS, H2_PRIORITY, H2_RST_STREAM, H2_SETTINGS, H2_PUSH_PROMISE,
+                        H2_PING, H2_GOAWAY, H2_WINDOW_UPDATE, H2_CONTINUATION};
+    enum h2_flag {H2_END_STREAM = 0x1, H2_ACK = 0x1, H2_END_HEADERS = 0x4, H2_PADDED = 0x8, H2_PRIORITY_FLAG = 0x20};
+    enum h2_error {H2_NO_ERROR = 0, H2_PROTOCOL_ERROR, H2_INTERNAL_ERROR, H2_FLOW_CONTROL_ERROR, H2_SETTINGS_TIMEOUT,
+                   H2_STREAM_CLOSED, H2_FRAME_SIZE_ERROR, H2_REFUSED_STREAM, H2_CANCEL, H2_COMPRESSION_ERROR,
+                   H2_CONNECT_ERROR, H2_ENHANCE_YOUR_CALM};
+
+    struct h2_stream {
+        uint32_t id = 0;
+        int32_t window = H2_DEFAULT_WINDOW;  // 我们还能向这个流发送的字节数
+        bool request_done = false;           // 已收到 END_STREAM
+
+        // 请求
+        std::string method;
+        std::string path;
+        std::string if_none_match;
+        bool accept_gzip = false;
+
+        // 响应，由 resolver 填写
+        int status = 0;
+        std::vector<std::pair<std::string, std::string>> headers;
+        const char* body = nullptr;
+        size_t body_len = 0;
+        void* mapped = nullptr;              // 需要在流结束时 munmap 的映射
+        size_t mapped_len = 0;
+        bool cold = false;                   // 文件页不全在页缓存中，预读完之前不参与调度
+        struct stat file_stat{};             // 冷文件预读后用来标记为热
+
+        // 发送进度
+        bool headers_sent = false;
+        size_t body_sent = 0;
+        bool queued = false;                 // 在调度队列中
+    };
+
+    class h2_session {
+    public:
+        // 把一个完整的请求变成响应（状态码、头部、文件体），owner是创建会话时传入的连接
+        typedef void (*resolver)(void* owner, h2_stream& stream);
+
+        h2_session(resolver r, void* owner) : m_resolve(r), m_owner(owner) {
+            // 连接建立后服务端先发自己的 SETTINGS
+            char payload[18];
+            put_setting(payload, 3, H2_MAX_CONCURRENT_STREAMS);   // MAX_CONCURRENT_STREAMS
+            put_setting(payload + 6, 2, 0);                       // ENABLE_PUSH
+            put_setting(payload + 12, 6, H2_MAX_HEADER_LIST_SIZE); // MAX_HEADER_LIST_SIZE
+            append_frame(H2_SETTINGS, 0, 0, payload, sizeof(payload));
+        }
+
+        ~h2_session() {
+            for(auto& it : m_streams) {
+                release(it.second);
+            }
+        }
+
+        // h2c 升级：先回 101，再把升级前的 HTTP/1.1 请求当作流 1（客户端已半关闭）
+        void upgrade(std::string_view settings_b64, const char* path, bool accept_gzip, const char* if_none_match) {
+            static const char resp[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+            m_out.insert(0, resp, sizeof(resp) - 1);
+            std::string settings;
+            if(base64url_decode(settings_b64, settings)) {
+                apply_settings((const uint8_t*)settings.data(), settings.size());
+            }
+            h2_stream& s = m_streams[1];
+            s.id = 1;
+            s.window = m_peer_initial_window;
+            s.method = "GET";
+            s.path = path;
+            s.accept_gzip = accept_gzip;
+            if(if_none_match) {
+                s.if_none_match = if_none_match;
+            }
+            m_last_stream = 1;
+            finish_request(s);
+        }
+
+        // 喂入从连接读到的字节，协议错误时返回false（已排入GOAWAY，发送完即可关闭）
+        bool feed(const char* data, size_t len) {
+            m_in.append(data, len);
+            size_t pos = 0;
+            if(!m_preface_done) {
+                size_t n = std::min(m_in.size(), H2_PREFACE_LEN);
+                if(memcmp(m_in.data(), H2_PREFACE, n) != 0) {
+                    return fail(H2_PROTOCOL_ERROR);
+                }
+                if(n < H2_PREFACE_LEN) {
+                    return true;
+                }
+                m_preface_done = true;
+                pos = H2_PREFACE_LEN;
+            }
+            while(!m_goaway && m_in.size() - pos >= H2_FRAME_HEADER) {
+                const uint8_t* h = (const uint8_t*)m_in.data() + pos;
+                uint32_t length = (h[0] << 16) | (h[1] << 8) | h[2];
+                if(length > H2_MAX_FRAME_SIZE) {
+                    return fail(H2_FRAME_SIZE_ERROR);
+                }
+                if(m_in.size() - pos < H2_FRAME_HEADER + length) {
+                    break;
+                }
+                uint8_t type = h[3], flags = h[4];
+                uint32_t stream_id = get32(h + 5) & 0x7fffffff;
+                if(!on_frame(type, flags, stream_id, h + H2_FRAME_HEADER, length)) {
+                    return false;
+                }
+                pos += H2_FRAME_HEADER + length;
+            }
+            m_in.erase(0, pos);
+            return !m_goaway;
+        }
+
+        // 调度器：在budget字节内按轮转顺序给每个有数据的流输出一帧，直到窗口或预算用完
+        void pump(size_t budget) {
+            while(!m_ready.empty() && m_out.size() - m_out_off < budget) {
+                uint32_t id = m_ready.front();
+                m_ready.pop_front();
+                auto it = m_streams.find(id);
+                if(it == m_streams.end()) {
+                    continue;
+                }
+                h2_stream& s = it->second;
+                s.queued = false;
+                if(!s.headers_sent) {
+                    send_headers(s);
+                }
+                size_t left = s.body_len - s.body_sent;
+                if(left > 0) {
+                    if(m_conn_window <= 0) {
+                        requeue_front(s); //连接窗口用完，等WINDOW_UPDATE
+                        break;
+                    }
+                    if(s.window <= 0) {
+                        continue;         //流窗口用完，等这个流的WINDOW_UPDATE
+                    }
+                    size_t n = std::min({left, (size_t)m_peer_max_frame, (size_t)s.window, (size_t)m_conn_window});
+                    bool last = n == left;
+                    append_frame(H2_DATA, last ? H2_END_STREAM : 0, s.id, s.body + s.body_sent, n);
+                    s.body_sent += n;
+                    s.window -= n;
+                    m_conn_window -= n;
+                    if(!last) {
+                        requeue(s);
+                        continue;
+                    }
+                }
+                close_stream(id);
+            }
+        }
+
+        // 待发送的数据
+        const char* out_data() const { return m_out.data() + m_out_off; }
+        size_t out_len() const { return m_out.size() - m_out_off; }
+        void consumed(size_t n) {
+            m_out_off += n;
+            if(m_out_off == m_out.size()) {
+                m_out.clear();
+                m_out_off = 0;
+            }
+        }
+
+        // 取出一个等待预读的流，没有时返回空。连接在主循环之外预读完后调用warmed，流才开始发送，
+        // 和HTTP/1.1的冷文件一样，缺页不会发生在主循环的发送里
+        h2_stream* next_cold() {
+            while(!m_cold.empty()) {
+                uint32_t id = m_cold.back();
+                m_cold.pop_back();
+                auto it = m_streams.find(id);
+                if(it != m_streams.end()) {
+                    return &it->second;
+                }
+            }
+            return nullptr;
+        }
+        void warmed(h2_stream& s) {
+            s.cold = false;
+            requeue(s);
+        }
+
+        bool has_ready() const { return !m_ready.empty(); }
+        bool idle() const { return m_streams.empty() && out_len() == 0; }
+        bool closed() const { return m_goaway && out_len() == 0; }
+
+    private:
+        bool on_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* p, uint32_t len) {
+            // HEADERS 之后必须紧跟同一个流的 CONTINUATION
+            if(m_continuation_stream && (type != H2_CONTINUATION || stream_id != m_continuation_stream)) {
+                return fail(H2_PROTOCOL_ERROR);
+            }
+            switch(type) {
+                case H2_SETTINGS:
+                    if(stream_id != 0 || len % 6 != 0) {
+                        return fail(H2_PROTOCOL_ERROR);
+                    }
+                    if(!(flags & H2_ACK)) {
+                        if(!apply_settings(p, len)) {
+                            return false;
+                        }
+                        append_frame(H2_SETTINGS, H2_ACK, 0, NULL, 0);
+                    }
+                    return true;
+                case H2_HEADERS:
+                    return on_headers(flags, stream_id, p, len);
+                case H2_CONTINUATION:
+                    if(!m_continuation_stream) {
+                        return fail(H2_PROTOCOL_ERROR);
+                    }
+                    // 对方一直不给END_HEADERS时头部块不能无限增长
+                    if(m_header_block.size() + len > H2_MAX_HEADER_LIST_SIZE) {
+                        return fail(H2_ENHANCE_YOUR_CALM);
+                    }
+                    m_header_block.append((const char*)p, len);
+                    if(flags & H2_END_HEADERS) {
+                        uint32_t id = m_continuation_stream;
+                        m_continuation_stream = 0;
+                        return decode_request(id, m_continuation_end_stream);
+                    }
+                    return true;
+                case H2_DATA: {
+                    // 不需要请求体，但要把窗口还给对方
+                    if(len) {
+                        send_window_update(0, len);
+                        if(!(flags & H2_END_STREAM)) {
+                            send_window_update(stream_id, len);
+                        }
+                    }
+                    auto it = m_streams.find(stream_id);
+                    if(it != m_streams.end() && (flags & H2_END_STREAM) && !it->second.request_done) {
+                        finish_request(it->second);
+                    }
+                    return true;
+                }
+                case H2_WINDOW_UPDATE: {
+                    if(len != 4) {
+                        return fail(H2_FRAME_SIZE_ERROR);
+                    }
+                    uint32_t inc = get32(p) & 0x7fffffff;
+                    // 增量为0或加上后超过2^31-1：在连接上是连接错误，在流上只重置这个流（RFC 9113 6.9）
+                    if(stream_id == 0) {
+                        if(inc == 0) {
+                            return fail(H2_PROTOCOL_ERROR);
+                        }
+                        m_conn_window += inc;
+                        if(m_conn_window > 0x7fffffffLL) {
+                            return fail(H2_FLOW_CONTROL_ERROR);
+                        }
+                    } else {
+                        auto it = m_streams.find(stream_id);
+                        if(inc == 0) {
+                            reset_stream(stream_id, H2_PROTOCOL_ERROR);
+                        } else if(it != m_streams.end()) {
+                            long long window = (long long)it->second.window + inc;
+                            if(window > 0x7fffffffLL) {
+                                reset_stream(stream_id, H2_FLOW_CONTROL_ERROR);
+                            } else {
+                                it->second.window = (int32_t)window;
+                                if(window > 0) {
+                                    requeue(it->second);
+                                }
+                            }
+                        }
+                    }
+                    return true;
+                }
+                case H2_PING:
+                    if(len != 8 || stream_id != 0) {
+                        return fail(H2_PROTOCOL_ERROR);
+                    }
+                    if(!(flags & H2_ACK)) {
+                        append_frame(H2_PING, H2_ACK, 0, (const char*)p, 8);
+                    }
+                    return true;
+                case H2_RST_STREAM:
+                    close_stream(stream_id);
+                    return true;
+                case H2_GOAWAY:
+                    m_goaway = true;
+                    return true;
+                default:
+                    // PRIORITY 与未知类型直接忽略
+                    return true;
+            }
+        }
+
+        bool on_headers(uint8_t flags, uint32_t stream_id, const uint8_t* p, uint32_t len) {
+            if(stream_id == 0 || !(stream_id & 1)) {
+                return fail(H2_PROTOCOL_ERROR);
+            }
+            size_t pad = 0;
+            if(flags & H2_PADDED) {
+                if(len < 1) {
+                    return fail(H2_PROTOCOL_ERROR);
+                }
+                pad = p[0];
+                ++p;
+                --len;
+            }
+            if(flags & H2_PRIORITY_FLAG) {
+                if(len < 5) {
+                    return fail(H2_PROTOCOL_ERROR);
+                }
+                p += 5;
+                len -= 5;
+            }
+            if(pad > len) {
+                return fail(H2_PROTOCOL_ERROR);
+            }
+            if(len - pad > H2_MAX_HEADER_LIST_SIZE) {
+                return fail(H2_ENHANCE_YOUR_CALM);
+            }
+            m_header_block.assign((const char*)p, len - pad);
+            if(!(flags & H2_END_HEADERS)) {
+                m_continuation_stream = stream_id;
+                m_continuation_end_stream = flags & H2_END_STREAM;
+                return true;
+            }
+            return decode_request(stream_id, flags & H2_END_STREAM);
+        }
+
+        bool decode_request(uint32_t stream_id, bool end_stream) {
+            h2_stream req;
+            req.id = stream_id;
+            req.window = m_peer_initial_window;
+            // 小的头部块也可能靠反复引用动态表解码出很大的列表，解码后的大小另算
+            size_t list_size = 0;
+            bool ok = m_decoder.decode((const uint8_t*)m_header_block.data(), m_header_block.size(),
+                [&req, &list_size](std::string_view name, std::string_view value) {
+                    list_size += name.size() + value.size() + 32;
+                    if(list_size > H2_MAX_HEADER_LIST_SIZE) {
+                        return;
+                    }
+                    if(name == ":method") {
+                        req.method = value;
+                    } else if(name == ":path") {
+                        req.path = value;
+                    } else if(name == "accept-encoding") {
+                        req.accept_gzip = value.find("gzip") != std::string_view::npos;
+                    } else if(name == "if-none-match") {
+                        req.if_none_match = value;
+                    }
+                });
+            if(!ok) {
+                return fail(H2_COMPRESSION_ERROR);
+            }
+            m_header_block.clear();
+            if(list_size > H2_MAX_HEADER_LIST_SIZE) {
+                return fail(H2_ENHANCE_YOUR_CALM);
+            }
+            if(stream_id <= m_last_stream) {
+                // 已有流上的尾部头部，只关心它是否结束了请求
+                auto it = m_streams.find(stream_id);
+                if(it != m_streams.end() && end_stream && !it->second.request_done) {
+                    finish_request(it->second);
+                }
+                return true;
+            }
+            m_last_stream = stream_id;
+            if(m_streams.size() >= H2_MAX_CONCURRENT_STREAMS) {
+                send_rst(stream_id, H2_REFUSED_STREAM);
+                return true;
+            }
+            h2_stream& s = m_streams[stream_id];
+            s = std::move(req);
+            if(end_stream) {
+                finish_request(s);
+            }
+            return true;
+        }
+
+        void finish_request(h2_stream& s) {
+            s.request_done = true;
+            m_resolve(m_owner, s);
+            if(s.cold) {
+                m_cold.push_back(s.id);
+            } else {
+                requeue(s);
+            }
+        }
+
+        void send_headers(h2_stream& s) {
+            std::string block;
+            m_encoder.begin_block(block);
+            char status[4];
+            snprintf(status, sizeof(status), "%d", s.status);
+            m_encoder.encode(block, ":status", status);
+            for(auto& h : s.headers) {
+                bool index = h.first != "content-length" && h.first != "date" && h.first != "etag";
+                m_encoder.encode(block, h.first, h.second, index);
+            }
+            append_frame(H2_HEADERS, H2_END_HEADERS | (s.body_len == 0 ? H2_END_STREAM : 0), s.id, block.data(), block.size());
+            s.headers_sent = true;
+        }
+
+        bool apply_settings(const uint8_t* p, size_t len) {
+            for(size_t i = 0; i + 6 <= len; i += 6) {
+                uint16_t id = (p[i] << 8) | p[i + 1];
+                uint32_t value = get32(p + i + 2);
+                switch(id) {
+                    case 1: // HEADER_TABLE_SIZE
+                        m_encoder.set_max_table_size(value);
+                        break;
+                    case 4: { // INITIAL_WINDOW_SIZE，已有流按差值调整
+                        if(value > 0x7fffffff) {
+                            return fail(H2_FLOW_CONTROL_ERROR);
+                        }
+                        long long delta = (long long)value - m_peer_initial_window;
+                        m_peer_initial_window = value;
+                        for(auto& it : m_streams) {
+                            long long window = it.second.window + delta;
+                            if(window > 0x7fffffffLL) {
+                                return fail(H2_FLOW_CONTROL_ERROR);
+                            }
+                            it.second.window = (int32_t)window;
+                            if(window > 0 && it.second.headers_sent) {
+                                requeue(it.second);
+                            }
+                        }
+                        break;
+                    }
+                    case 5: // MAX_FRAME_SIZE
+                        if(value < 16384 || value > 16777215) {
+                            return fail(H2_PROTOCOL_ERROR);
+                        }
+                        m_peer_max_frame = value;
+                        break;
+                    default:
+                        break;
+                }
+            }
+            return true;
+        }
+
+        void requeue(h2_stream& s) {
+            if(!s.queued && !s.cold) {
+                s.queued = true;
+                m_ready.push_back(s.id);
+            }
+        }
+
+        void requeue_front(h2_stream& s) {
+            s.queued = true;
+            m_ready.push_front(s.id);
+        }
+
+        void close_stream(uint32_t id) {
+            auto it = m_streams.find(id);
+            if(it == m_streams.end()) {
+                return;
+            }
+            release(it->second);
+            m_streams.erase(it);
+        }
+
+        static void release(h2_stream& s) {
+            if(s.mapped) {
+                munmap(s.mapped, s.mapped_len);
+                s.mapped = nullptr;
+            }
+        }
+
+        bool fail(h2_error code) {
+            char payload[8];
+            put32(payload, m_last_stream);
+            put32(payload + 4, code);
+            append_frame(H2_GOAWAY, 0, 0, payload, sizeof(payload));
+            m_goaway = true;
+            return false;
+        }
+
+        // 流错误：告诉对方并丢掉这个流，连接继续
+        void reset_stream(uint32_t id, h2_error code) {
+            send_rst(id, code);
+            close_stream(id);
+        }
+
+        void send_rst(uint32_t id, h2_error code) {
+            char payload[4];
+            put32(payload, code);
+            append_frame(H2_RST_STREAM, 0, id, payload, sizeof(payload));
+        }
+
+        void send_window_update(uint32_t id, uint32_t inc) {
+            char payload[4];
+            put32(payload, inc);
+            append_frame(H2_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+        }
+
+        void append_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const char* payload, size_t len) {
+            char h[H2_FRAME_HEADER];
+            h[0] = (char)(len >> 16);
+            h[1] = (char)(len >> 8);
+            h[2] = (char)len;
+            h[3] = (char)type;
+            h[4] = (char)flags;
+            put32(h + 5, stream_id & 0x7fffffff);
+            m_out.append(h, sizeof(h));
+            if(len) {
+                m_out.append(payload, len);
+            }
+        }
+
+        static void put_setting(char* p, uint16_t id, uint32_t value) {
+            p[0] = (char)(id >> 8);
+            p[1] = (char)id;
+            put32(p + 2, value);
+        }
+        static void put32(char* p, uint32_t v) {
+            p[0] = (char)(v >> 24);
+            p[1] = (char)(v >> 16);
+            p[2] = (char)(v >> 8);
+            p[3] = (char)v;
+        }
+        static uint32_t get32(const uint8_t* p) {
+            return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        }
+
+        static bool base64url_decode(std::string_view in, std::string& out) {
+            uint32_t acc = 0;
+            int bits = 0;
+            for(char c : in) {
+                int v;
+                if(c >= 'A' && c <= 'Z') v = c - 'A';
+                else if(c >= 'a' && c <= 'z') v = c - 'a' + 26;
+                else if(c >= '0' && c <= '9') v = c - '0' + 52;
+                else if(c == '-' || c == '+') v = 62;
+                else if(c == '_' || c == '/') v = 63;
+                else if(c == '=') break;
+                else return false;
+                acc = (acc << 6) | v;
+                bits += 6;
+                if(bits >= 8) {
+                    bits -= 8;
+                    out.push_back((char)(acc >> bits));
+                }
+            }
+            return true;
+        }
+
+        resolver m_resolve;
+        void* m_owner;
+        std::string m_in;
+        std::string m_out;
+        size_t m_out_off = 0;
+        bool m_preface_done = false;
+        bool m_goaway = false;
+
+        hpack::decoder m_decoder;
+        hpack::encoder m_encoder;
+        std::string m_header_block;           // 正在拼接的头部块
+        uint32_t m_continuation_stream = 0;   // 非0表示正在等待CONTINUATION
+        bool m_continuation_end_stream = false;
+
+        std::map<uint32_t, h2_stream> m_streams;
+        std::deque<uint32_t> m_ready;         // 有数据要发的流，轮转调度
+        std::vector<uint32_t> m_cold;         // 等待预读的流
+        uint32_t m_last_stream = 0;
+        long long m_conn_window = H2_DEFAULT_WINDOW;
+        int32_t m_peer_initial_window = H2_DEFAULT_WINDOW;
+        uint32_t m_peer_max_frame = 16384;
+    };
+}
+
+#endif
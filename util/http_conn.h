@@ -4,138 +4,555 @@
 #include "sock.h"
 #include "epoll_manage.h"
 #include "lst_timer.h"
+#include "coarse_clock.h"
+#include "asset_pack.h"
+#include "coro.h"
+#include "cold_io.h"
+#include "tls.h"
+#include "http2.h"
+#include "proxy.h"
+#include "rate_limit.h"
+#include "trace.h"
+#include "zerocopy.h"
+#include "thread_pool_2.0.h"
+#include "router.h"
+#include "websocket.h"
+#include "sse.h"
 #include <errno.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <stdarg.h>
 #include <sys/uio.h>
+#include <ctype.h>
+#include <limits.h>
+#include <atomic>
 
 class util_timer;
-class http_conn {
+class alignas(64) http_conn {
 public:
     static int m_epfd;
     static int m_user_cnt;
+    static asset_pack m_assets; //启动时mmap的静态资源包，未加载时走文件系统
+    static mirror::residency_cache m_residency; //文件是否在页缓存中的检测结果
+    static mirror::io_offload* m_io_offload; //协程模式下预读冷文件的线程池，为空时在当前线程预读
+    static mirror::proxy_table* m_proxy; //反向代理的路由表，为空时所有请求都找静态文件
+    static mirror::router* m_router; //C++请求处理器的路由表，为空时没有动态接口
+    static mirror::ws_hub<http_conn>* m_ws_hub; //WebSocket广播频道，为空时不接受升级
+    static mirror::sse_hub<http_conn>* m_sse_hub; //Server-Sent Events频道，为空时不接受订阅
+    static mirror::rate_limiter* m_req_limiter; //每个客户端IP的请求限流，为空时不限
+    static int m_rate_prefix; //IPv4地址按这个前缀长度合并成一个限流对象
+    static int m_rate_prefix_v6; //IPv6地址的前缀长度
+    static size_t m_zerocopy_min; //响应体达到这个大小才用MSG_ZEROCOPY发送，0表示不用
+    static size_t m_write_budget; //每次可写时最多发出的字节数，用完就排到其它就绪连接后面，0表示不限
+    static unsigned int m_min_send_rate; //发送响应时对方每秒至少要读走的字节数，更慢的连接被断开，0表示不限
+    static long long m_send_check_ms; //协程模式下检查发送速率的间隔
+#ifdef WITH_TLS
+    static SSL_CTX* m_ssl_ctx; //HTTPS监听端口的证书与会话配置
+#endif
     static const int READ_BUFFER_SIZE = 2048;
+    static const int MAX_CONTENT_LENGTH = INT_MAX - READ_BUFFER_SIZE; //加上读缓冲里的位置也不会溢出int
     static const int WRITE_BUFFER_SIZE = 2048;
     static const int FILEPATH_LEN = 200;
+    static const size_t H2_SEND_BUDGET = 64 * 1024; //HTTP/2每次从会话取出的最大字节数
 
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
     enum CHECK_STATE {CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER, CHECK_STATE_CONTENT};
     enum LINE_STATE {LINE_OK = 0, LINE_BAD, LINE_OPEN};
-    enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION};
+    enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, ASSET_REQUEST, NOT_MODIFIED, H2C_UPGRADE, PROXY_REQUEST, BAD_GATEWAY, GATEWAY_TIMEOUT, TOO_MANY_REQUESTS, ADMIN_REQUEST, SLOW_REQUEST, HANDLER_REQUEST, METHOD_NOT_ALLOWED, WS_UPGRADE, SSE_SUBSCRIBE, LENGTH_REQUIRED};
 
-    http_conn() = default;
-    ~http_conn() = default;
+    http_conn() : m_sockfd(-1), m_gen(1), m_read_buf(nullptr), m_buffers(nullptr) {}
+    ~http_conn() { delete m_buffers; }
     void process(); //解析http请求，封装响应信息
-    void init(int fd, const sockaddr_in & addr);
+    int process_inline(); //在reactor上直接处理廉价请求：1已处理，0需要交给线程池，-1应关闭连接
+    void init(int fd, const sockaddr_storage & addr, bool tls = false, mirror::sock_profile* profile = nullptr);
     void close_conn();
     bool read();
     bool write();
+    mirror::task<> serve(mirror::coro_reactor& reactor, long long idle_ms); //协程模式下的整个连接生命周期
+    int tls_handshake(); //非阻塞握手：1完成，0需要等待m_tls_want事件，-1失败
+    bool tls_handshaking() const { return m_tls_handshaking; }
+    int tls_want() const { return m_tls_want; }
+    uint32_t trace_id() const { return m_trace_id; } //当前请求被采样追踪时非0
+    mirror::pool_lane lane() const { return m_lane; } //process_inline返回0后，交给线程池时排的队列
+    bool send_progressing(); //有响应在发，且自上次检查以来达到了最低发送速率
+    bool reap_zerocopy(); //收到EPOLLERR时取走零拷贝完成通知，true表示只是通知、连接没有出错
+    void rearm() { epoll_mod(m_epfd, m_sockfd, m_armed, handle()); } //ONESHOT被完成通知消耗后，按原来等待的事件重新注册
+    void arm(int ev) { m_armed = ev; epoll_mod(m_epfd, m_sockfd, ev, handle()); } //按ev重新注册并记下，之后rearm沿用
+    uint64_t handle() const { return conn_handle(m_sockfd, m_gen.load(std::memory_order_acquire)); } //当前连接的句柄，随epoll事件、任务和定时器带走
+    bool is_current(uint64_t h) const { //句柄是否还指向槽位上的这个连接，而不是已关闭的旧连接或复用同一fd的新连接
+        return m_gen.load(std::memory_order_acquire) == handle_gen(h) && m_sockfd == handle_fd(h);
+    }
+    // WebSocket：以下只在reactor线程上调用
+    bool is_ws() const { return m_ws; }
+    mirror::ws_session* ws() const { return m_ws; }
+    int ws_flush(); //把发送队列尽量写出：1发完，0发送缓冲满，-1出错或close已回完
+    void ws_abort(); //关掉收发，由事件循环发现挂断后关闭连接
+    bool ws_ping(); //定时器到期时发ping，上一个ping还没有回应时返回false
+    // Server-Sent Events：同样只在reactor线程上调用
+    bool is_sse() const { return m_sse; }
+    mirror::sse_session* sse() const { return m_sse; }
+    int sse_flush(); //把积压的事件尽量写出：1发完，0发送缓冲满，-1出错
+    void sse_abort() { ws_abort(); }
+    bool sse_ping(); //定时器到期时发心跳，上次心跳以来积压的事件一点都没发出去时返回false
+    bool is_idle() const { //上一个响应已发完，且还没有收到新的请求数据
+        if(m_ws || m_sse) {
+            return false; //WebSocket和事件流连接本来就长时间不说话，由ping或心跳判断死活，不参与空闲驱逐
+        }
+        if(m_h2) {
+            return m_h2->idle() && m_read_idx == 0 && m_bytes_to_send == 0;
+        }
+        return m_check_stat == CHECK_STATE_REQUESTLINE && m_read_idx == 0 && m_write_idx == 0;
+    }
 
-    util_timer* timer;//定时器
-
-    int m_sockfd; //这个HTTP连接的socket
-    sockaddr_in m_saddr; //通信的地址信息
-
-    char m_read_buf[READ_BUFFER_SIZE];
-    
 private:
-    
-    int m_read_idx; //已经读入的下一个位置
-
-    char m_file_dir[FILEPATH_LEN];
-
-    char m_write_buf[WRITE_BUFFER_SIZE];
-    int m_write_idx;
-
     void init_stat();
     HTTP_CODE process_read();//解析HTTP请求
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
     HTTP_CODE parse_content(char *text);
     HTTP_CODE do_request();
+    HTTP_CODE resolve_request();
     LINE_STATE parse_line();
     bool process_write(HTTP_CODE ret);
+    void set_iov(char* body, size_t body_len);
+    void set_copy_iov(const void* data, size_t len);
+    int flush();
+    void reset_budget();
+    ssize_t recv_some(char* buf, size_t len);
+    ssize_t send_some();
+    bool split_send() const;
+    mirror::task<bool> tls_accept(mirror::coro_reactor& reactor);
+    mirror::task<bool> send_response(mirror::coro_reactor& reactor);
+    void h2_start();
+    void h2_process();
+    void h2_warm();
+    bool h2_stage();
+    bool h2_write();
+    mirror::task<> serve_h2(mirror::coro_reactor& reactor, long long idle_ms);
+    static void h2_resolve(void* owner, mirror::h2_stream& stream);
+    mirror::task<bool> proxy_pass(mirror::coro_reactor& reactor);
+    mirror::task<HTTP_CODE> proxy_exchange(mirror::coro_reactor& reactor, mirror::upstream& up);
+    mirror::task<int> upstream_send(mirror::coro_reactor& reactor, int fd, const char* data, size_t len, long long timeout_ms);
+    mirror::task<int> relay(mirror::coro_reactor& reactor, int from, int to, size_t len, long long timeout_ms, bool to_client);
+    mirror::task<int> relay_chunked(mirror::coro_reactor& reactor, int to, mirror::chunked_scanner& scanner, long long timeout_ms);
+    bool client_plain_rx() const;
+    bool client_plain_tx() const;
+    void proxy_request_head(std::string& out);
+    bool call_handler();
+    bool ws_start();
+    bool ws_process();
+    mirror::task<> serve_ws(mirror::coro_reactor& reactor, long long idle_ms);
+    bool sse_start();
+    bool sse_process();
+    mirror::task<> serve_sse(mirror::coro_reactor& reactor, long long idle_ms);
+    ssize_t write_iov(const struct iovec* iov, int n);
 
     char* get_line() {return &m_read_buf[m_start_line_idx];}//获取一行数据
+    void unmap();
+    bool add_response( const char* format, ... );
+    bool add_content( const char* content );
+    bool add_content_type();
+    bool add_status_line( int status, const char* title );
+    bool add_headers( int content_length );
+    bool add_content_length( int content_length );
+    bool add_linger();
+    bool add_date();
+    bool add_blank_line();
+
+    // 读写缓冲和文件路径这些大块数据放在单独分配的内存里，连接对象只保留指针；
+    // 一个槽位第一次被使用时分配，之后连接复用这个槽位时接着用
+    struct buffers {
+        char read[READ_BUFFER_SIZE + 1];    // 多一个字节给parse_content写结尾的\0
+        char write[WRITE_BUFFER_SIZE];
+        char file_dir[FILEPATH_LEN];
+    };
 
+    // 数据成员按访问频率排列：开头四个缓存行是每个请求都要读写的状态，偶尔才用的放在后面。
+    // 整个对象按缓存行对齐，users[]里相邻的两个连接被不同线程处理时不会落在同一个缓存行上。
+public:
+    util_timer* timer;//定时器
+    int m_sockfd; //这个HTTP连接的socket
+private:
+    std::atomic<uint32_t> m_gen; //槽位的代数，每关闭一个连接加一
+public:
+    uint64_t m_rate_key; //限流表中的键，由地址前缀算出，0表示不限流
+    char* m_read_buf; //读缓冲，指向m_buffers
+private:
+    char* m_write_buf;
+    int m_read_idx; //已经读入的下一个位置
     int m_checked_idx; // 当前分析的字符在读缓冲区的位置
     int m_start_line_idx; // 当前解析行起始位置
-
     CHECK_STATE m_check_stat; //主状态机状态
+    int m_write_idx;
+    int m_iv_count;
+    struct iovec m_iv[2];                   // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
+    size_t m_bytes_to_send;                 // m_iv中还没有发出去的字节数
+    size_t m_budget;                        // 这一轮可写事件还能发出的字节数
+    unsigned long long m_sent;              // 连接上累计发出的字节数
+    mirror::h2_session* m_h2;               // 非空表示连接已切换到HTTP/2
+    int m_armed;                            // 最近一次注册的epoll事件
+    uint32_t m_trace_id;                    // 当前请求的追踪号，0表示没有被采样
+    METHOD m_method;
+    int m_content_length;
+    mirror::pool_lane m_lane;
+    bool m_keep_alive;
+    bool m_chunked;                         // 请求体是chunked编码
+    bool m_accept_gzip;
+    bool m_file_cold;                       // 映射的文件有页不在页缓存中，发送前需要预读
+    bool m_on_reactor;                      // 正在reactor线程上内联解析，不能做阻塞的事
+    bool m_deferred;                        // 请求已在reactor上解析完，工作线程从resolve_request继续
+    bool m_zc_body;                         // 当前响应体用MSG_ZEROCOPY发送
+    bool m_corked;                          // 正在用TCP_CORK攒头部和正文
+    bool m_tls_handshaking;                 // HTTPS连接还在握手
 
     char* m_url;
     char* m_version;
     char* m_host;
-    bool m_keep_alive;
-    METHOD m_method;
-
-    int m_content_length; 
-
-
+    char* m_if_none_match;
+    const pack::pack_entry* m_asset_entry;  // 资源包中命中的条目
+    const pack::pack_body* m_asset;         // 选中的编码（原始或gzip）
     char* m_file_address;                   // 客户请求的目标文件被mmap到内存中的起始位置
+    mirror::proxy_route* m_route;           // 命中的代理路由，为空表示静态文件
+    mirror::route_match m_handler;          // 命中的请求处理器
+    char* m_http2_settings;                 // HTTP2-Settings头部的值
+    char* m_ws_key;                         // Sec-WebSocket-Key头部的值
+    bool m_upgrade_h2c;                     // 请求带了Upgrade: h2c
+    bool m_upgrade_ws;                      // 请求带了Upgrade: websocket
+    bool m_ws_upgrading;                    // 正在发送101，发完后切换到WebSocket
+    bool m_sse_starting;                    // 正在发送事件流的响应头，发完后加入频道
+
+    // 以下是冷数据：只在建立连接、走文件系统、TLS、HTTP/2或零拷贝时才用到
+    buffers* m_buffers;
+    char* m_file_dir;
+    int m_tls_want;                         // 握手需要等待的事件
+#ifdef WITH_TLS
+    SSL* m_ssl;                             // 为空表示明文连接
+    bool m_ktls_tx;                         // 内核接管了加密，直接writev
+    bool m_ktls_rx;                         // 内核接管了解密，直接recv
+#endif
+    size_t m_h2_chunk;                      // 当前m_iv中会话数据的长度，发完后从会话中消费
+    mirror::sock_profile* m_profile;        // 所属监听端口的socket选项
+    mirror::zc_buffer* m_zc_buf;            // 被零拷贝发送引用的文件映射，为空表示没有或是常驻的资源包
+    mirror::ws_session* m_ws;               // 非空表示连接已升级到WebSocket
+    mirror::sse_session* m_sse;             // 非空表示连接是事件流的订阅者
+    unsigned long long m_send_mark;         // 上次检查发送速率时的m_sent
+    long long m_send_mark_ms;               // 上次检查（或开始发送响应）的时刻
+public:
+    sockaddr_storage m_saddr; //通信的地址信息，IPv4、IPv6或Unix域socket
+private:
     struct stat m_file_stat;                // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2];                   // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
-    int m_iv_count;
-    void unmap();
-    bool add_response( const char* format, ... );
-    bool add_content( const char* content );
-    bool add_content_type();
-    bool add_status_line( int status, const char* title );
-    bool add_headers( int content_length );
-    bool add_content_length( int content_length );
-    bool add_linger();
-    bool add_blank_line();
+    mirror::zc_sender m_zc;                 // 零拷贝发送的完成通知跟踪
 };
 
+// 到期的定时器是否还属于槽位上的连接；连接已关闭时顺带清掉槽位上指向它的指针，定时器随后被删除
+bool timer_current(util_timer* timer) {
+    if(!timer->handle || timer->user_data->is_current(timer->handle)) {
+        return true;
+    }
+    if(timer->user_data->timer == timer) {
+        timer->user_data->timer = nullptr;
+    }
+    return false;
+}
+
 // 定义HTTP响应的一些状态信息
 const char* ok_200_title = "OK";
+const char* not_modified_304_title = "Not Modified";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title = "Forbidden";
 const char* error_403_form = "You do not have permission to get file from this server.\n";
 const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
+const char* switching_101_title = "Switching Protocols";
+const char* error_405_title = "Method Not Allowed";
+const char* error_405_form = "The request method is not supported for the requested resource.\n";
+const char* error_411_title = "Length Required";
+const char* error_411_form = "A chunked request body is only accepted on proxied paths, please send Content-Length.\n";
+const char* error_429_title = "Too Many Requests";
+const char* error_429_form = "You are sending requests too fast, please retry later.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+const char* error_502_title = "Bad Gateway";
+const char* error_502_form = "The upstream server could not be reached or sent an invalid response.\n";
+const char* error_504_title = "Gateway Timeout";
+const char* error_504_form = "The upstream server did not respond in time.\n";
 
 // 网站的根目录
 const char* doc_root = "/home/mirror/Documents/webserver/resources";
 
 int http_conn::m_epfd = -1;
 int http_conn::m_user_cnt = 0;
+asset_pack http_conn::m_assets;
+mirror::residency_cache http_conn::m_residency;
+mirror::io_offload* http_conn::m_io_offload = nullptr;
+mirror::proxy_table* http_conn::m_proxy = nullptr;
+mirror::router* http_conn::m_router = nullptr;
+mirror::ws_hub<http_conn>* http_conn::m_ws_hub = nullptr;
+mirror::sse_hub<http_conn>* http_conn::m_sse_hub = nullptr;
+mirror::rate_limiter* http_conn::m_req_limiter = nullptr;
+int http_conn::m_rate_prefix = 32;
+int http_conn::m_rate_prefix_v6 = 64;
+size_t http_conn::m_zerocopy_min = 0;
+size_t http_conn::m_write_budget = 0;
+unsigned int http_conn::m_min_send_rate = 0;
+long long http_conn::m_send_check_ms = 15000;
+#ifdef WITH_TLS
+SSL_CTX* http_conn::m_ssl_ctx = nullptr;
+#endif
 
 
 void http_conn::process() {
-    HTTP_CODE read_ret = process_read();
+    mirror::trace::mark(m_trace_id, mirror::trace::DEQUEUE, m_sockfd);
+    // 先验连接（prior knowledge）直接以连接前言开头
+    if(!m_h2 && m_read_idx >= 3 && memcmp(m_read_buf, mirror::H2_PREFACE, 3) == 0) {
+        h2_start();
+    }
+    if(m_h2) {
+        h2_process();
+        return;
+    }
+    HTTP_CODE read_ret;
+    if(m_deferred) {
+        m_deferred = false;
+        mirror::trace::scope ts(m_trace_id, mirror::trace::DO_REQUEST, m_sockfd);
+        read_ret = resolve_request();
+    } else {
+        read_ret = process_read();
+    }
     if(read_ret == NO_REQUEST) {//请求不完整，继续读
-        epoll_mod(m_epfd, m_sockfd, EPOLLIN);//由于有ONESHOT，重新注册
+        arm(EPOLLIN);//由于有ONESHOT，重新注册
         return;
     }
+    if(m_file_cold) {
+        //工作线程本来就在主循环之外，缺页就在这里发生
+        mirror::prefetch(m_file_address, m_file_stat.st_size);
+        m_residency.mark_warm(m_file_stat);
+    }
 
     bool write_ret = process_write(read_ret);
+    if(m_h2) {
+        h2_warm(); // h2c升级时流1的文件也可能是冷的
+    }
     if(!write_ret) {
         close_conn();
     }
-    epoll_mod(m_epfd, m_sockfd, EPOLLOUT);
+    arm(EPOLLOUT);
+}
+
+// 混合模式：reactor读完数据后先在本线程解析，资源包命中、304、错误回复这类不碰文件系统的请求
+// 直接组装响应并立即尝试发送，写不完才等EPOLLOUT；需要访问文件系统或切换协议的请求再交给线程池，
+// 这样命中缓存的请求只需要一次唤醒，省掉两次跨线程交接和一轮epoll。
+int http_conn::process_inline() {
+    if(m_ws) {
+        return ws_process() ? 1 : -1;
+    }
+    if(m_sse) {
+        return sse_process() ? 1 : -1;
+    }
+    m_lane = mirror::LANE_NORMAL;
+    if(m_h2 || (m_read_idx >= 3 && memcmp(m_read_buf, mirror::H2_PREFACE, 3) == 0)) {
+        return 0;
+    }
+    m_on_reactor = true;
+    HTTP_CODE read_ret = process_read();
+    m_on_reactor = false;
+    if(read_ret == NO_REQUEST) {
+        arm(EPOLLIN);
+        return 1;
+    }
+    if(read_ret == SLOW_REQUEST) {
+        m_deferred = true;
+        return 0;
+    }
+    if(!process_write(read_ret)) {
+        return -1;
+    }
+    return write() ? 1 : -1;
 }
 
-void http_conn::init(int fd, const sockaddr_in & addr) {
+void http_conn::init(int fd, const sockaddr_storage & addr, bool tls, mirror::sock_profile* profile) {
     m_sockfd = fd;
     m_saddr = addr;
-    sock_reuseaddr(m_sockfd);
+    if(!m_buffers) {
+        m_buffers = new buffers;
+        m_read_buf = m_buffers->read;
+        m_write_buf = m_buffers->write;
+        m_file_dir = m_buffers->file_dir;
+    }
+    m_rate_key = mirror::rate_key_or_exempt(addr, m_rate_prefix, m_rate_prefix_v6);
+    m_profile = profile;
+    m_corked = false;
+    if(profile) {
+        profile->on_accept(fd);
+    }
+
+    m_tls_handshaking = false;
+    m_tls_want = EPOLLIN;
+    m_h2 = nullptr;
+    m_h2_chunk = 0;
+    m_on_reactor = false;
+    m_deferred = false;
+    m_lane = mirror::LANE_NORMAL;
+    m_armed = EPOLLIN;
+    m_zc_body = false;
+    m_zc_buf = nullptr;
+    m_ws = nullptr;
+    m_ws_upgrading = false;
+    m_sse = nullptr;
+    m_sse_starting = false;
+    m_sent = 0;
+    reset_budget();
+#ifdef WITH_TLS
+    m_ssl = nullptr;
+    m_ktls_tx = m_ktls_rx = false;
+    if(tls && m_ssl_ctx) {
+        m_ssl = SSL_new(m_ssl_ctx);
+        SSL_set_fd(m_ssl, fd);
+        SSL_set_accept_state(m_ssl);
+        m_tls_handshaking = true;
+    }
+#endif
 
-    epoll_add(m_epfd, m_sockfd, true);
+    epoll_add(m_epfd, m_sockfd, true, handle());
     ++m_user_cnt;
 
     init_stat();
+    mirror::trace::mark(m_trace_id, mirror::trace::ACCEPT, fd);
+}
+
+int http_conn::tls_handshake() {
+#ifdef WITH_TLS
+    int ret = SSL_do_handshake(m_ssl);
+    if(ret == 1) {
+        m_tls_handshaking = false;
+        m_ktls_tx = mirror::tls_ktls_send(m_ssl);
+        m_ktls_rx = mirror::tls_ktls_recv(m_ssl);
+        // arg的三位依次是kTLS发送、kTLS接收、会话复用
+        mirror::trace::mark(m_trace_id, mirror::trace::TLS_HANDSHAKE, m_sockfd,
+                            m_ktls_tx | m_ktls_rx << 1 | (SSL_session_reused(m_ssl) ? 4 : 0));
+        if(mirror::tls_alpn_is_h2(m_ssl)) {
+            h2_start();
+        }
+        return 1;
+    }
+    switch(SSL_get_error(m_ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            m_tls_want = EPOLLIN;
+            return 0;
+        case SSL_ERROR_WANT_WRITE:
+            m_tls_want = EPOLLOUT;
+            return 0;
+        default:
+            ERR_clear_error();
+            return -1;
+    }
+#else
+    return -1;
+#endif
+}
+
+// 协程模式的握手：按OpenSSL的要求等待可读或可写
+mirror::task<bool> http_conn::tls_accept(mirror::coro_reactor& reactor) {
+    int ret;
+    while ( ( ret = tls_handshake() ) == 0 ) {
+        bool ready = co_await ( m_tls_want == EPOLLIN ? reactor.readable( m_sockfd, 3000 ) : reactor.writable( m_sockfd, 3000 ) );
+        if ( !ready ) {
+            co_return false;
+        }
+    }
+    co_return ret > 0;
+}
+
+// 明文或kTLS连接直接recv，否则由OpenSSL解密；没有数据时返回-1且errno为EAGAIN
+ssize_t http_conn::recv_some(char* buf, size_t len) {
+#ifdef WITH_TLS
+    if(m_ssl && !m_ktls_rx) {
+        int ret = SSL_read(m_ssl, buf, len);
+        if(ret > 0) {
+            return ret;
+        }
+        int err = SSL_get_error(m_ssl, ret);
+        if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            errno = EAGAIN;
+            return -1;
+        }
+        ERR_clear_error();
+        return err == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+    }
+#endif
+    return recv(m_sockfd, buf, len, 0);
+}
+
+// 明文或kTLS连接直接分散写，否则由OpenSSL加密m_iv的第一块；写不进去时返回-1且errno为EAGAIN
+ssize_t http_conn::send_some() {
+#ifdef WITH_TLS
+    if(m_ssl && !m_ktls_tx) {
+        int ret = SSL_write(m_ssl, m_iv[ 0 ].iov_base, m_iv[ 0 ].iov_len);
+        if(ret > 0) {
+            return ret;
+        }
+        int err = SSL_get_error(m_ssl, ret);
+        errno = (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) ? EAGAIN : EIO;
+        ERR_clear_error();
+        return -1;
+    }
+#endif
+    if(m_zc_body) {
+        if(m_iv_count == 2) {
+            // 头部在写缓冲里，下一个响应就会覆盖它，只能拷贝发送；MSG_MORE让它和正文尽量合成一个段
+            return send(m_sockfd, m_iv[0].iov_base, m_iv[0].iov_len, MSG_MORE | MSG_NOSIGNAL);
+        }
+        if(m_file_address && !m_asset && !m_zc_buf) { //处理器引用的常驻内存不用计数
+            m_zc_buf = new mirror::zc_buffer(m_file_address, m_file_stat.st_size);
+        }
+        return m_zc.send(m_sockfd, m_iv[0].iov_base, m_iv[0].iov_len, m_zc_buf);
+    }
+    return writev(m_sockfd, m_iv, m_iv_count);
+}
+
+bool http_conn::reap_zerocopy() {
+    if(m_sockfd == -1 || !m_zc.tried() || m_zc.reap(m_sockfd) < 0) {
+        return false;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    return getsockopt(m_sockfd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
 }
 
 void http_conn::close_conn() {
     if(m_sockfd != -1) {
-        epoll_rm(m_epfd, m_sockfd);
+        delete m_h2;
+        m_h2 = nullptr;
+        if(m_ws) {
+            m_ws_hub->leave(this);
+            delete m_ws;
+            m_ws = nullptr;
+        }
+        if(m_sse) {
+            m_sse_hub->leave(this);
+            delete m_sse;
+            m_sse = nullptr;
+        }
+        if(m_zc_buf) {
+            m_zc_buf->unref();
+            m_zc_buf = nullptr;
+            m_file_address = 0;
+        }
+        m_zc.reset();
+#ifdef WITH_TLS
+        if(m_ssl) {
+            SSL_free(m_ssl);
+            m_ssl = nullptr;
+        }
+#endif
+        // 先作废旧句柄再关闭fd：fd一关，主循环就可能accept到同一个号并在这个槽位上init新连接
+        int fd = m_sockfd;
         m_sockfd = -1;
+        uint32_t gen = m_gen.load(std::memory_order_relaxed) + 1;
+        m_gen.store(gen ? gen : 1, std::memory_order_release); //0留给非连接的fd
+        epoll_rm(m_epfd, fd);
         --m_user_cnt;
     }
 }
@@ -145,9 +562,11 @@ bool http_conn::read() {
         return false;
     }
 
+    mirror::trace::scope ts(m_trace_id, mirror::trace::READ, m_sockfd);
+    int start_idx = m_read_idx;
     int bytes_read = 0;
-    while(true) {
-        bytes_read = recv(m_sockfd, &m_read_buf[m_read_idx], READ_BUFFER_SIZE - m_read_idx, 0);
+    while(m_read_idx < READ_BUFFER_SIZE) { //缓冲满了就先交给上层处理，不能用0长度去recv
+        bytes_read = recv_some(&m_read_buf[m_read_idx], READ_BUFFER_SIZE - m_read_idx);
         if(bytes_read == -1) {
             if(errno == EAGAIN || errno == EWOULDBLOCK) {
                 //没数据了
@@ -161,55 +580,949 @@ bool http_conn::read() {
         }
         m_read_idx += bytes_read;
     }
+    ts.set_arg(m_read_idx - start_idx);
     printf("request read!\n");
     //printf("request read:\n%s", m_read_buf);
     return true;
 }
 
 bool http_conn::write() {
-    int temp = 0;
-    int bytes_have_send = 0;    // 已经发送的字节
-    int bytes_to_send = m_write_idx;// 将要发送的字节 （m_write_idx）写缓冲区中待发送的字节数
-    
-    if ( bytes_to_send == 0 ) {
+    reset_budget();
+    if ( m_h2 ) {
+        return h2_write();
+    }
+    if ( m_ws ) {
+        return ws_flush() >= 0;
+    }
+    if ( m_sse ) {
+        return sse_flush() >= 0;
+    }
+    if ( m_bytes_to_send == 0 ) {
         // 将要发送的字节为0，这一次响应结束。
-        epoll_mod( m_epfd, m_sockfd, EPOLLIN ); 
+        arm( EPOLLIN ); 
+        init_stat();
+        return true;
+    }
+
+    int ret = flush();
+    if ( ret == 0 ) {
+        // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
+        // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
+        arm( EPOLLOUT );
+        return true;
+    }
+    unmap();
+    if ( ret < 0 ) {
+        return false;
+    }
+    mirror::trace::mark( m_trace_id, mirror::trace::DONE, m_sockfd );
+    if ( m_ws_upgrading ) {
+        return ws_start();
+    }
+    if ( m_sse_starting ) {
+        return sse_start();
+    }
+    // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
+    if(m_keep_alive) {
         init_stat();
+        arm( EPOLLIN );
+        return true;
+    } else {
+        arm( EPOLLIN );
+        return false;
+    } 
+}
+
+// 分散写尽可能多的剩余数据：1表示发送完毕，0表示TCP写缓冲已满或这一轮的预算用完，-1表示出错。
+// 预算用完时socket其实还可写，重新注册EPOLLOUT后它排在就绪队列末尾，下一轮再接着发，
+// 一个读得快的大下载不会一直占着主循环，其它连接的小响应不用排在它后面
+int http_conn::flush() {
+    // 头部和正文要分两次发出时（OpenSSL逐块加密、零拷贝），先塞住，避免头部单独成一个小段
+    if ( !m_corked && m_iv_count == 2 && m_profile && m_profile->cork && split_send() ) {
+        mirror::set_cork( m_sockfd, true );
+        m_corked = true;
+    }
+    while ( m_bytes_to_send > 0 ) {
+        if ( m_budget == 0 ) {
+            return 0;
+        }
+        mirror::trace::scope ts( m_trace_id, mirror::trace::WRITEV, m_sockfd );
+        ssize_t temp = send_some();
+        ts.set_arg( temp );
+        if ( temp < 0 ) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        m_bytes_to_send -= temp;
+        m_sent += temp;
+        m_budget -= std::min( m_budget, ( size_t )temp );
+        // 跳过已经发出的部分，下次从断点继续
+        size_t left = temp;
+        while ( m_iv_count > 0 && left >= m_iv[ 0 ].iov_len ) {
+            left -= m_iv[ 0 ].iov_len;
+            m_iv[ 0 ] = m_iv[ 1 ];
+            --m_iv_count;
+        }
+        if ( m_iv_count > 0 ) {
+            m_iv[ 0 ].iov_base = ( char* )m_iv[ 0 ].iov_base + left;
+            m_iv[ 0 ].iov_len -= left;
+        }
+    }
+    if ( m_corked ) {
+        mirror::set_cork( m_sockfd, false );
+        m_corked = false;
+    }
+    return 1;
+}
+
+void http_conn::reset_budget() {
+    m_budget = m_write_budget ? m_write_budget : SIZE_MAX;
+}
+
+// 从上次检查（或响应开始发送）到现在，平均每秒被读走的字节数是否达到m_min_send_rate。
+// 读得太慢的客户端会长期占着连接和被映射的文件，由调用者断开
+bool http_conn::send_progressing() {
+    if ( m_bytes_to_send == 0 ) {
+        return false;
+    }
+    long long now = coarse_clock::now_ms();
+    bool ok = ( m_sent - m_send_mark ) * 1000 >= ( unsigned long long )m_min_send_rate * ( now - m_send_mark_ms );
+    m_send_mark = m_sent;
+    m_send_mark_ms = now;
+    return ok;
+}
+
+// send_some是否会把头部和正文分成两次系统调用
+bool http_conn::split_send() const {
+#ifdef WITH_TLS
+    if ( m_ssl && !m_ktls_tx ) {
         return true;
     }
+#endif
+    return m_zc_body;
+}
 
-    while(1) {
-        // 分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
-        if ( temp <= -1 ) {
-            // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
-            // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
-            if( errno == EAGAIN ) {
-                epoll_mod( m_epfd, m_sockfd, EPOLLOUT );
-                return true;
+// 协程模式：等待可读 -> 读取并解析 -> 发送响应，全部在reactor线程上顺序完成，
+// 取代process/read/write之间靠CHECK_STATE和ONESHOT重注册串起来的流程。
+mirror::task<> http_conn::serve(mirror::coro_reactor& reactor, long long idle_ms) {
+    reactor.set_handle( m_sockfd, handle() );
+    bool ok = !m_tls_handshaking || co_await tls_accept( reactor );
+    while ( ok && !m_h2 ) {
+        bool ready = co_await reactor.readable( m_sockfd, idle_ms );
+        if ( !ready || !read() ) {
+            break; // 空闲超时、被驱逐或对方关闭
+        }
+        if ( m_read_idx >= 3 && memcmp( m_read_buf, mirror::H2_PREFACE, 3 ) == 0 ) {
+            h2_start();
+            break;
+        }
+        HTTP_CODE ret = process_read();
+        if ( ret == NO_REQUEST ) {
+            continue;
+        }
+        if ( ret == H2C_UPGRADE ) {
+            process_write( ret );
+            break;
+        }
+        if ( ret == PROXY_REQUEST ) {
+            if ( !co_await proxy_pass( reactor ) || !m_keep_alive ) {
+                break;
+            }
+            init_stat();
+            continue;
+        }
+        if ( m_file_cold ) {
+            // 交给阻塞I/O线程预读，完成后再回到主循环发送
+            if ( m_io_offload ) {
+                co_await m_io_offload->prefetch( m_file_address, m_file_stat.st_size );
+            } else {
+                mirror::prefetch( m_file_address, m_file_stat.st_size );
+            }
+            m_residency.mark_warm( m_file_stat );
+        }
+        if ( !process_write( ret ) ) {
+            break;
+        }
+        reset_budget();
+        bool sent = co_await send_response( reactor );
+        unmap();
+        if ( sent ) {
+            mirror::trace::mark( m_trace_id, mirror::trace::DONE, m_sockfd );
+        }
+        if ( sent && m_ws_upgrading ) {
+            if ( ws_start() ) {
+                co_await serve_ws( reactor, idle_ms );
+            }
+            break;
+        }
+        if ( sent && m_sse_starting ) {
+            if ( sse_start() ) {
+                co_await serve_sse( reactor, idle_ms );
             }
-            unmap();
+            break;
+        }
+        if ( !sent || !m_keep_alive ) {
+            break;
+        }
+        init_stat();
+    }
+    if ( m_h2 ) {
+        co_await serve_h2( reactor, idle_ms );
+    }
+    unmap();
+    if ( m_sockfd != -1 ) {
+        reactor.set_handle( m_sockfd, 0 );
+    }
+    close_conn();
+}
+
+// 写不下或预算用完时让出reactor等下一次可写；每隔m_send_check_ms检查一次发送速率，
+// 对方一直不读时等待超时也会走到检查，不会永远挂着
+mirror::task<bool> http_conn::send_response(mirror::coro_reactor& reactor) {
+    int ret;
+    while ( ( ret = flush() ) == 0 ) {
+        bool ready = co_await reactor.writable( m_sockfd, m_send_check_ms );
+        if ( !ready && reactor.reason( m_sockfd ) != mirror::coro_reactor::WAKE_TIMEOUT ) {
+            co_return false;
+        }
+        if ( coarse_clock::now_ms() - m_send_mark_ms >= m_send_check_ms && !send_progressing() ) {
+            co_return false;
+        }
+        reset_budget();
+    }
+    co_return ret > 0;
+}
+
+void http_conn::h2_start() {
+    m_h2 = new mirror::h2_session( h2_resolve, this );
+    m_bytes_to_send = 0;
+}
+
+// 工作线程：把读到的字节交给会话解析，请求在这里找到文件，然后由主线程发送
+void http_conn::h2_process() {
+    m_h2->feed( m_read_buf, m_read_idx );
+    m_read_idx = 0;
+    h2_warm();
+    arm( EPOLLOUT );
+}
+
+// 工作线程：冷文件的流在这里预读，缺页发生在本线程
+void http_conn::h2_warm() {
+    while ( mirror::h2_stream* s = m_h2->next_cold() ) {
+        mirror::prefetch( s->body, s->body_len );
+        m_residency.mark_warm( s->file_stat );
+        m_h2->warmed( *s );
+    }
+}
+
+// 从会话调度出下一段帧放进m_iv，没有可发的数据时返回false
+bool http_conn::h2_stage() {
+    m_h2->pump( H2_SEND_BUDGET );
+    m_h2_chunk = m_h2->out_len();
+    if ( m_h2_chunk == 0 ) {
+        return false;
+    }
+    set_copy_iov( m_h2->out_data(), m_h2_chunk );
+    m_send_mark = m_sent;
+    m_send_mark_ms = coarse_clock::now_ms();
+    return true;
+}
+
+// 主线程：发到写缓冲满或者所有流都在等对方的WINDOW_UPDATE为止
+bool http_conn::h2_write() {
+    while ( m_bytes_to_send > 0 || h2_stage() ) {
+        int ret = flush();
+        if ( ret == 0 ) {
+            arm( EPOLLOUT );
+            return true;
+        }
+        if ( ret < 0 ) {
             return false;
         }
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if ( bytes_to_send <= bytes_have_send ) {
-            // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
-            unmap();
-            if(m_keep_alive) {
-                init_stat();
-                epoll_mod( m_epfd, m_sockfd, EPOLLIN );
-                return true;
+        m_h2->consumed( m_h2_chunk );
+    }
+    if ( m_h2->closed() ) {
+        return false;
+    }
+    arm( EPOLLIN );
+    return true;
+}
+
+mirror::task<> http_conn::serve_h2(mirror::coro_reactor& reactor, long long idle_ms) {
+    while ( true ) {
+        if ( m_read_idx > 0 ) {
+            m_h2->feed( m_read_buf, m_read_idx );
+            m_read_idx = 0;
+        }
+        while ( mirror::h2_stream* s = m_h2->next_cold() ) {
+            if ( m_io_offload ) {
+                co_await m_io_offload->prefetch( s->body, s->body_len );
             } else {
-                epoll_mod( m_epfd, m_sockfd, EPOLLIN );
-                return false;
-            } 
+                mirror::prefetch( s->body, s->body_len );
+            }
+            m_residency.mark_warm( s->file_stat );
+            m_h2->warmed( *s );
+        }
+        reset_budget();
+        while ( h2_stage() ) {
+            if ( !co_await send_response( reactor ) ) {
+                co_return;
+            }
+            m_h2->consumed( m_h2_chunk );
+        }
+        if ( m_h2->closed() ) {
+            co_return;
+        }
+        bool ready = co_await reactor.readable( m_sockfd, idle_ms );
+        if ( !ready || !read() ) {
+            co_return;
+        }
+    }
+}
+
+// 101已发出：建立会话、加入广播频道，和升级请求一起读进来的帧接着解析
+bool http_conn::ws_start() {
+    int left = m_read_idx - m_checked_idx;
+    memmove( m_read_buf, m_read_buf + m_checked_idx, left );
+    init_stat();
+    m_read_idx = left;
+    m_ws_upgrading = false;
+    m_ws = new mirror::ws_session;
+    m_ws_hub->join( this );
+    return ws_process();
+}
+
+// 解析读缓冲里完整的帧，收到的消息广播给频道里的其他连接。返回false表示协议错误，应关闭连接。
+// 消息在读缓冲里原地拼接，超过READ_BUFFER_SIZE的消息由parse回close 1009
+bool http_conn::ws_process() {
+    int left = m_ws->parse( m_read_buf, m_read_idx, READ_BUFFER_SIZE, [ this ]( int opcode, const char* data, size_t len ) {
+        mirror::ws_frame* f = mirror::ws_frame::make( opcode, data, len );
+        m_ws_hub->broadcast( f, this );
+    } );
+    if ( left < 0 ) {
+        return false;
+    }
+    m_read_idx = left;
+    if ( m_ws->pending() ) {
+        // 有pong、close要回（或者本轮收到了广播），由hub的flush发送并重新注册事件
+        m_ws_hub->mark( this );
+        m_armed = 0; // ONESHOT已被这次事件消耗
+    } else {
+        arm( EPOLLIN );
+    }
+    return true;
+}
+
+// 广播帧和事件这类排队的小块：明文或kTLS直接writev，否则OpenSSL一次加密一块。
+// 发送缓冲满时返回-1且errno为EAGAIN
+ssize_t http_conn::write_iov(const struct iovec* iov, int n) {
+#ifdef WITH_TLS
+    if ( m_ssl && !m_ktls_tx ) {
+        int r = SSL_write( m_ssl, iov[ 0 ].iov_base, iov[ 0 ].iov_len );
+        int err = r > 0 ? SSL_ERROR_NONE : SSL_get_error( m_ssl, r );
+        errno = ( err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ ) ? EAGAIN : EIO;
+        if ( r <= 0 ) {
+            ERR_clear_error();
+        }
+        return r > 0 ? r : -1;
+    }
+#endif
+    return writev( m_sockfd, iov, n );
+}
+
+int http_conn::ws_flush() {
+    struct iovec iov[ 64 ];
+    while ( m_ws->pending() ) {
+        int n = m_ws->fill_iov( iov, 64 );
+        ssize_t ret = write_iov( iov, n );
+        if ( ret < 0 ) {
+            if ( errno != EAGAIN ) {
+                return -1;
+            }
+            break;
+        }
+        m_ws->consume( ret );
+    }
+    if ( !m_ws->pending() && m_ws->closing() ) {
+        return -1; // close已经回给对方，可以断开了
+    }
+    // 订阅者多数时候已经按EPOLLIN注册着，广播发完后不用再调一次epoll_ctl
+    int want = EPOLLIN | ( m_ws->pending() ? ( uint32_t )EPOLLOUT : 0u );
+    if ( want != m_armed ) {
+        arm( want );
+    }
+    return m_ws->pending() ? 0 : 1;
+}
+
+// 广播途中发现订阅者积压过多或写出错时调用，这时还在遍历订阅者数组，不能直接关闭。
+// shutdown之后重新注册，事件循环收到挂断再走正常的关闭流程
+void http_conn::ws_abort() {
+    shutdown( m_sockfd, SHUT_RDWR );
+    arm( EPOLLIN );
+}
+
+bool http_conn::ws_ping() {
+    if ( !m_ws || m_ws->ping_outstanding() ) {
+        return false;
+    }
+    m_ws->ping();
+    m_ws_hub->mark( this );
+    return true;
+}
+
+// 协程模式的WebSocket循环：空闲超时先发ping，再超时还没有回应就断开
+mirror::task<> http_conn::serve_ws(mirror::coro_reactor& reactor, long long idle_ms) {
+    while ( true ) {
+        m_armed = EPOLLIN | ( m_ws->pending() ? ( uint32_t )EPOLLOUT : 0u );
+        co_await reactor.wait( m_sockfd, m_armed, idle_ms );
+        mirror::coro_reactor::wake_reason why = reactor.reason( m_sockfd );
+        if ( why == mirror::coro_reactor::WAKE_CANCEL ) {
+            co_return;
+        }
+        if ( why == mirror::coro_reactor::WAKE_TIMEOUT ) {
+            if ( !ws_ping() ) {
+                co_return;
+            }
+            continue;
+        }
+        if ( m_ws->pending() && ws_flush() < 0 ) {
+            co_return;
+        }
+        if ( !read() || !ws_process() ) {
+            co_return;
+        }
+    }
+}
+
+// 事件流的响应头已发出：加入频道，之后只往下推事件。订阅请求之后客户端不该再发数据
+bool http_conn::sse_start() {
+    init_stat();
+    m_sse_starting = false;
+    m_sse = new mirror::sse_session( m_sse_hub->max_queued() );
+    m_sse_hub->join( this );
+    arm( EPOLLIN );
+    return true;
+}
+
+// 订阅者发来的数据没有意义，丢掉；对方关闭由read()发现
+bool http_conn::sse_process() {
+    m_read_idx = 0;
+    int want = EPOLLIN | ( m_sse->pending() ? ( uint32_t )EPOLLOUT : 0u );
+    arm( want );
+    return true;
+}
+
+int http_conn::sse_flush() {
+    struct iovec iov[ 64 ];
+    while ( m_sse->pending() ) {
+        int n = m_sse->fill_iov( iov, 64 );
+        ssize_t ret = write_iov( iov, n );
+        if ( ret < 0 ) {
+            if ( errno != EAGAIN ) {
+                return -1;
+            }
+            break;
+        }
+        m_sse->consume( ret );
+    }
+    // 订阅者多数时候已经按EPOLLIN注册着，发完后不用再调一次epoll_ctl
+    int want = EPOLLIN | ( m_sse->pending() ? ( uint32_t )EPOLLOUT : 0u );
+    if ( want != m_armed ) {
+        arm( want );
+    }
+    return m_sse->pending() ? 0 : 1;
+}
+
+bool http_conn::sse_ping() {
+    if ( !m_sse || m_sse->aborted || !m_sse->heartbeat( m_sse_hub->policy() ) ) {
+        return false;
+    }
+    m_sse_hub->mark( this );
+    return true;
+}
+
+// 协程模式的事件流循环：空闲超时就发心跳，积压的事件一直发不出去时断开
+mirror::task<> http_conn::serve_sse(mirror::coro_reactor& reactor, long long idle_ms) {
+    while ( true ) {
+        m_armed = EPOLLIN | ( m_sse->pending() ? ( uint32_t )EPOLLOUT : 0u );
+        co_await reactor.wait( m_sockfd, m_armed, idle_ms );
+        mirror::coro_reactor::wake_reason why = reactor.reason( m_sockfd );
+        if ( why == mirror::coro_reactor::WAKE_CANCEL ) {
+            co_return;
+        }
+        if ( why == mirror::coro_reactor::WAKE_TIMEOUT ) {
+            if ( !sse_ping() ) {
+                co_return;
+            }
+            continue;
+        }
+        if ( m_sse->pending() && sse_flush() < 0 ) {
+            co_return;
+        }
+        // 没有可读数据时read()返回true，对方关闭或出错时返回false
+        if ( !read() ) {
+            co_return;
+        }
+        m_read_idx = 0;
+    }
+}
+
+// 与do_request相同的查找顺序：资源包、再文件系统，结果写进流里由调度器发送
+void http_conn::h2_resolve(void* owner, mirror::h2_stream& s) {
+    http_conn* conn = ( http_conn* )owner;
+    auto error = [&s](int status, const char* form) {
+        s.status = status;
+        s.body = form;
+        s.body_len = strlen( form );
+        s.headers.emplace_back( "content-type", "text/html" );
+        s.headers.emplace_back( "content-length", std::to_string( s.body_len ) );
+    };
+    bool head = s.method == "HEAD";
+    // 和HTTP/1.1一样每个请求扣一个令牌，一个连接上多路复用的流不能绕过限流
+    if ( m_req_limiter && conn->m_rate_key && !m_req_limiter->allow( conn->m_rate_key ) ) {
+        error( 429, error_429_form );
+        s.headers.emplace_back( "retry-after", "1" );
+    } else if ( !head && s.method != "GET" ) {
+        error( 400, error_400_form );
+    } else if ( const pack::pack_entry* e = m_assets.find( s.path.data(), s.path.size() ) ) {
+        size_t len = strlen( e->etag ) - 1;
+        if ( !s.if_none_match.empty() && s.if_none_match.compare( 0, len, e->etag, len ) == 0 &&
+             ( s.if_none_match.compare( len, std::string::npos, "\"" ) == 0 ||
+               s.if_none_match.compare( len, std::string::npos, "-gz\"" ) == 0 ) ) {
+            s.status = 304;
+            s.headers.emplace_back( "etag", e->etag );
+        } else {
+            const pack::pack_body* b = ( s.accept_gzip && e->has_gzip ) ? &e->gzip : &e->identity;
+            // 预先生成的是HTTP/1.1头部，跳过状态行，字段名转小写
+            std::string_view hdr( m_assets.at( b->hdr_off ), b->hdr_len );
+            size_t pos = hdr.find( "\r\n" ) + 2;
+            size_t end;
+            while ( ( end = hdr.find( "\r\n", pos ) ) != std::string_view::npos && end > pos ) {
+                std::string_view line = hdr.substr( pos, end - pos );
+                size_t colon = line.find( ':' );
+                std::string name( line.substr( 0, colon ) );
+                for ( char& c : name ) {
+                    c = tolower( c );
+                }
+                std::string_view value = line.substr( colon + 1 );
+                value.remove_prefix( std::min( value.find_first_not_of( ' ' ), value.size() ) );
+                s.headers.emplace_back( std::move( name ), std::string( value ) );
+                pos = end + 2;
+            }
+            s.status = 200;
+            s.body = m_assets.at( b->body_off );
+            s.body_len = b->body_len;
+        }
+    } else {
+        std::string path = std::string( doc_root ) + s.path;
+        struct stat st;
+        int fd = -1;
+        if ( stat( path.c_str(), &st ) < 0 ) {
+            error( 404, error_404_form );
+        } else if ( !( st.st_mode & S_IROTH ) ) {
+            error( 403, error_403_form );
+        } else if ( S_ISDIR( st.st_mode ) ) {
+            error( 400, error_400_form );
+        } else if ( ( fd = open( path.c_str(), O_RDONLY ) ) < 0 ) {
+            error( 500, error_500_form );
+        } else {
+            mirror::advise_open( fd, st );
+            void* addr = st.st_size ? mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) : nullptr;
+            close( fd );
+            if ( addr == MAP_FAILED ) {
+                error( 500, error_500_form );
+            } else {
+                s.status = 200;
+                s.mapped = addr;
+                s.mapped_len = st.st_size;
+                s.body = ( const char* )addr;
+                s.body_len = st.st_size;
+                // 和do_request一样检查文件页是否在页缓存中，冷文件由连接在主循环之外预读后再调度
+                if ( !head && addr && !m_residency.recently_warm( st ) ) {
+                    if ( mirror::is_resident( addr, st.st_size ) ) {
+                        m_residency.mark_warm( st );
+                    } else {
+                        s.cold = true;
+                        s.file_stat = st;
+                    }
+                }
+                s.headers.emplace_back( "content-type", "text/html" );
+                s.headers.emplace_back( "content-length", std::to_string( st.st_size ) );
+            }
+        }
+    }
+    s.headers.emplace_back( "date", coarse_clock::http_date() );
+    if ( head ) {
+        s.body_len = 0;
+    }
+}
+
+// 反向代理：选一个上游，转发请求并把响应写回客户端。返回false表示客户端连接不能再用
+mirror::task<bool> http_conn::proxy_pass(mirror::coro_reactor& reactor) {
+    mirror::upstream& up = *m_proxy->pick( *m_route );
+    ++up.outstanding;
+    HTTP_CODE ret = co_await proxy_exchange( reactor, up );
+    --up.outstanding;
+    if ( ret == FILE_REQUEST ) {
+        co_return true;
+    }
+    if ( ret == CLOSED_CONNECTION ) {
+        co_return false; // 响应已经开始发送，只能断开
+    }
+    if ( ret != BAD_REQUEST ) {
+        printf( "proxy %s: %d\n", up.name.c_str(), ret == GATEWAY_TIMEOUT ? 504 : 502 );
+    }
+    // 请求体可能没有读完，回复错误后关闭
+    m_keep_alive = false;
+    m_write_idx = 0;
+    if ( !process_write( ret ) ) {
+        co_return false;
+    }
+    co_await send_response( reactor );
+    co_return false;
+}
+
+// 完成一次上游交换：FILE_REQUEST表示响应已完整转发，BAD_GATEWAY/GATEWAY_TIMEOUT表示
+// 还没有向客户端发送任何数据，BAD_REQUEST表示客户端的chunked请求体格式错误，CLOSED_CONNECTION表示中途失败
+mirror::task<http_conn::HTTP_CODE> http_conn::proxy_exchange(mirror::coro_reactor& reactor, mirror::upstream& up) {
+    std::string head;
+    proxy_request_head( head );
+    // 和头部一起读进来的那部分请求体；chunked请求体由扫描器找到结束位置
+    mirror::chunked_scanner req_scanner;
+    size_t body_buffered = m_chunked ? req_scanner.feed( m_read_buf + m_checked_idx, m_read_idx - m_checked_idx )
+                                     : std::min( ( size_t )( m_read_idx - m_checked_idx ), ( size_t )m_content_length );
+    if ( req_scanner.failed() ) {
+        co_return BAD_REQUEST;
+    }
+    head.append( m_read_buf + m_checked_idx, body_buffered );
+    size_t body_left = m_chunked ? 0 : m_content_length - body_buffered;
+
+    int fd = -1;
+    int ret = 0;
+    std::string resp;
+    size_t head_end = std::string::npos;
+    // 复用的连接可能刚被上游关掉，请求体还没从客户端取走时换一条新连接重试一次
+    for ( int attempt = 0; attempt < 2 && head_end == std::string::npos; ++attempt ) {
+        bool reused = true;
+        fd = m_proxy->take_idle( up );
+        if ( fd == -1 ) {
+            reused = false;
+            fd = m_proxy->connect_to( up );
+            if ( fd == -1 ) {
+                co_return BAD_GATEWAY;
+            }
+            if ( !co_await reactor.writable( fd, up.timeout_ms ) ) {
+                epoll_rm( m_epfd, fd );
+                co_return GATEWAY_TIMEOUT;
+            }
+            int err = 0;
+            socklen_t len = sizeof( err );
+            if ( getsockopt( fd, SOL_SOCKET, SO_ERROR, &err, &len ) == -1 || err != 0 ) {
+                epoll_rm( m_epfd, fd );
+                co_return BAD_GATEWAY;
+            }
+        }
+        ret = co_await upstream_send( reactor, fd, head.data(), head.size(), up.timeout_ms );
+        if ( ret > 0 && body_left > 0 ) {
+            // 剩下的请求体从客户端直接转给上游
+            ret = co_await relay( reactor, m_sockfd, fd, body_left, up.timeout_ms, false );
+            body_left = 0;
+            attempt = 1;
+        } else if ( ret > 0 && m_chunked && !req_scanner.done() ) {
+            ret = co_await relay_chunked( reactor, fd, req_scanner, up.timeout_ms );
+            attempt = 1;
+        }
+        // 读响应头
+        while ( ret > 0 && ( head_end = resp.find( "\r\n\r\n" ) ) == std::string::npos ) {
+            if ( resp.size() >= 16384 ) {
+                ret = -1;
+                break;
+            }
+            size_t old = resp.size();
+            resp.resize( old + 4096 );
+            ssize_t n = recv( fd, &resp[ old ], 4096, 0 );
+            resp.resize( old + std::max( n, ( ssize_t )0 ) );
+            if ( n > 0 ) {
+                continue;
+            }
+            if ( n == -1 && errno == EAGAIN ) {
+                ret = co_await reactor.readable( fd, up.timeout_ms ) ? 1 : 0;
+            } else {
+                ret = -1;
+            }
+        }
+        if ( head_end == std::string::npos ) {
+            epoll_rm( m_epfd, fd );
+            if ( ret == 0 ) {
+                co_return GATEWAY_TIMEOUT;
+            }
+            if ( !reused || !resp.empty() ) {
+                co_return BAD_GATEWAY;
+            }
+        }
+    }
+    if ( head_end == std::string::npos ) {
+        co_return BAD_GATEWAY;
+    }
+
+    // 解析状态行与决定响应体长度的头部
+    int status = 0;
+    int minor = 1;
+    if ( sscanf( resp.c_str(), "HTTP/1.%d %d", &minor, &status ) != 2 ) {
+        epoll_rm( m_epfd, fd );
+        co_return BAD_GATEWAY;
+    }
+    bool upstream_keep_alive = minor >= 1;
+    bool chunked = false;
+    long long content_length = -1;
+    std::string out;
+    out.reserve( head_end + 64 );
+    size_t line = resp.find( "\r\n" ) + 2;
+    out.append( resp, 0, line );
+    while ( line < head_end + 2 ) {
+        size_t end = resp.find( "\r\n", line );
+        const char* text = resp.c_str() + line;
+        if ( strncasecmp( text, "Connection:", 11 ) == 0 ) {
+            if ( strncasecmp( text + 11 + strspn( text + 11, " \t" ), "close", 5 ) == 0 ) {
+                upstream_keep_alive = false;
+            } else if ( strncasecmp( text + 11 + strspn( text + 11, " \t" ), "keep-alive", 10 ) == 0 ) {
+                upstream_keep_alive = true;
+            }
+        } else if ( strncasecmp( text, "Keep-Alive:", 11 ) != 0 ) {
+            if ( strncasecmp( text, "Content-Length:", 15 ) == 0 ) {
+                content_length = atoll( text + 15 );
+            } else if ( strncasecmp( text, "Transfer-Encoding:", 18 ) == 0 ) {
+                chunked = strcasestr( text, "chunked" ) != NULL;
+            }
+            out.append( resp, line, end + 2 - line );
+        }
+        line = end + 2;
+    }
+
+    // 没有响应体、按长度、chunked、读到上游关闭为止
+    bool no_body = m_method == HEAD || status / 100 == 1 || status == 204 || status == 304;
+    bool until_close = !no_body && !chunked && content_length < 0;
+    if ( until_close ) {
+        upstream_keep_alive = false;
+        m_keep_alive = false; // 客户端只能靠关闭连接判断响应结束
+    }
+    out.append( m_keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n" );
+
+    // 响应头和已经读到的那部分响应体一起发出
+    size_t extra = resp.size() - head_end - 4;
+    size_t body_left_resp = 0;
+    mirror::chunked_scanner scanner;
+    if ( no_body ) {
+        extra = 0;
+    } else if ( chunked ) {
+        extra = scanner.feed( resp.data() + head_end + 4, extra );
+        if ( scanner.failed() ) {
+            epoll_rm( m_epfd, fd );
+            co_return BAD_GATEWAY;
+        }
+    } else if ( content_length >= 0 ) {
+        extra = std::min( extra, ( size_t )content_length );
+        body_left_resp = content_length - extra;
+    } else {
+        body_left_resp = SIZE_MAX;
+    }
+    out.append( resp, head_end + 4, extra );
+    set_copy_iov( out.data(), out.size() );
+    if ( !co_await send_response( reactor ) ) {
+        epoll_rm( m_epfd, fd );
+        co_return CLOSED_CONNECTION;
+    }
+
+    ret = 1;
+    if ( chunked && !scanner.done() ) {
+        // chunked要边转发边找结束位置，只能经过用户态
+        char buf[ 4096 ];
+        while ( !scanner.done() ) {
+            ssize_t n = recv( fd, buf, sizeof( buf ), 0 );
+            if ( n > 0 ) {
+                n = scanner.feed( buf, n );
+                if ( scanner.failed() ) {
+                    ret = -1;
+                    break;
+                }
+                set_copy_iov( buf, n );
+                if ( !co_await send_response( reactor ) ) {
+                    ret = -1;
+                    break;
+                }
+            } else if ( n == -1 && errno == EAGAIN ) {
+                if ( !co_await reactor.readable( fd, up.timeout_ms ) ) {
+                    ret = 0;
+                    break;
+                }
+            } else {
+                ret = -1;
+                break;
+            }
+        }
+    } else if ( body_left_resp > 0 ) {
+        ret = co_await relay( reactor, fd, m_sockfd, body_left_resp, up.timeout_ms, true );
+        if ( until_close && ret < 0 ) {
+            ret = 1; // 上游关闭就是响应结束
+        }
+    }
+    if ( ret <= 0 ) {
+        epoll_rm( m_epfd, fd );
+        co_return CLOSED_CONNECTION;
+    }
+    if ( upstream_keep_alive ) {
+        m_proxy->release( up, fd );
+    } else {
+        epoll_rm( m_epfd, fd );
+    }
+    co_return FILE_REQUEST;
+}
+
+// 重新组装发往上游的请求头：去掉逐跳字段，上游连接总是keep-alive
+void http_conn::proxy_request_head(std::string& out) {
+    static const char* method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+    out.reserve( m_checked_idx + 128 );
+    out.append( method_names[ m_method ] ).append( " " ).append( m_url ).append( " HTTP/1.1\r\n" );
+    // parse_line把每行的\r\n改成了\0\0，逐行取出
+    int idx = m_version - m_read_buf + strlen( m_version ) + 2;
+    while ( idx < m_checked_idx && m_read_buf[ idx ] != '\0' ) {
+        const char* text = m_read_buf + idx;
+        size_t len = strlen( text );
+        if ( strncasecmp( text, "Connection:", 11 ) != 0 && strncasecmp( text, "Keep-Alive:", 11 ) != 0 &&
+             strncasecmp( text, "Proxy-Connection:", 17 ) != 0 && strncasecmp( text, "Upgrade:", 8 ) != 0 &&
+             strncasecmp( text, "HTTP2-Settings:", 15 ) != 0 ) {
+            out.append( text, len ).append( "\r\n" );
+        }
+        idx += len + 2;
+    }
+    char ip[ INET6_ADDRSTRLEN ];
+    sock_ntop( m_saddr, ip, sizeof( ip ) );
+    out.append( "X-Forwarded-For: " ).append( ip ).append( "\r\nConnection: keep-alive\r\n\r\n" );
+}
+
+// 1发送完毕，0超时，-1出错
+mirror::task<int> http_conn::upstream_send(mirror::coro_reactor& reactor, int fd, const char* data, size_t len, long long timeout_ms) {
+    while ( len > 0 ) {
+        ssize_t n = send( fd, data, len, MSG_NOSIGNAL );
+        if ( n > 0 ) {
+            data += n;
+            len -= n;
+        } else if ( n == -1 && errno == EAGAIN ) {
+            if ( !co_await reactor.writable( fd, timeout_ms ) ) {
+                co_return 0;
+            }
+        } else {
+            co_return -1;
+        }
+    }
+    co_return 1;
+}
+
+// 把客户端剩下的chunked请求体转给上游：要边转发边找结束位置，只能经过用户态。
+// 结束之后同一次recv读到的字节不转发（服务器不处理流水线请求）。1完成，0超时，-1出错
+mirror::task<int> http_conn::relay_chunked(mirror::coro_reactor& reactor, int to, mirror::chunked_scanner& scanner, long long timeout_ms) {
+    char buf[ 4096 ];
+    while ( !scanner.done() ) {
+        ssize_t n = recv_some( buf, sizeof( buf ) );
+        if ( n > 0 ) {
+            size_t used = scanner.feed( buf, n );
+            if ( scanner.failed() ) {
+                co_return -1;
+            }
+            int ret = co_await upstream_send( reactor, to, buf, used, timeout_ms );
+            if ( ret <= 0 ) {
+                co_return ret;
+            }
+        } else if ( n == -1 && errno == EAGAIN ) {
+            if ( !co_await reactor.readable( m_sockfd, timeout_ms ) ) {
+                co_return 0;
+            }
+        } else {
+            co_return -1;
+        }
+    }
+    co_return 1;
+}
+
+bool http_conn::client_plain_rx() const {
+#ifdef WITH_TLS
+    return !m_ssl || m_ktls_rx;
+#else
+    return true;
+#endif
+}
+
+bool http_conn::client_plain_tx() const {
+#ifdef WITH_TLS
+    return !m_ssl || m_ktls_tx;
+#else
+    return true;
+#endif
+}
+
+// 在两个socket之间搬运len字节（SIZE_MAX表示直到from关闭）。两端都是内核里的明文时
+// 经管道splice，不经过用户态；客户端一侧由OpenSSL加解密时退回recv/send拷贝。1完成，0超时，-1出错
+mirror::task<int> http_conn::relay(mirror::coro_reactor& reactor, int from, int to, size_t len, long long timeout_ms, bool to_client) {
+    if ( to_client ? client_plain_tx() : client_plain_rx() ) {
+        int* p = m_proxy->take_pipe();
+        if ( p ) {
+            size_t in_pipe = 0;
+            int ret = 1;
+            while ( ret > 0 && ( len > 0 || in_pipe > 0 ) ) {
+                if ( in_pipe == 0 ) {
+                    ssize_t n = splice( from, NULL, p[ 1 ], NULL, std::min( len, ( size_t )65536 ), SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+                    if ( n > 0 ) {
+                        in_pipe = n;
+                        len -= len == SIZE_MAX ? 0 : n;
+                    } else if ( n == -1 && errno == EAGAIN ) {
+                        ret = co_await reactor.readable( from, timeout_ms ) ? 1 : 0;
+                    } else {
+                        ret = -1; // 对端提前关闭
+                    }
+                    continue;
+                }
+                ssize_t n = splice( p[ 0 ], NULL, to, NULL, in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+                if ( n > 0 ) {
+                    in_pipe -= n;
+                } else if ( n == -1 && errno == EAGAIN ) {
+                    ret = co_await reactor.writable( to, timeout_ms ) ? 1 : 0;
+                } else {
+                    ret = -1;
+                }
+            }
+            m_proxy->give_pipe( p, in_pipe == 0 );
+            co_return ret;
         }
     }
+    char buf[ 4096 ];
+    while ( len > 0 ) {
+        ssize_t n = to_client ? recv( from, buf, std::min( len, sizeof( buf ) ), 0 ) : recv_some( buf, std::min( len, sizeof( buf ) ) );
+        if ( n > 0 ) {
+            len -= len == SIZE_MAX ? 0 : n;
+            if ( to_client ) {
+                set_copy_iov( buf, n );
+                if ( !co_await send_response( reactor ) ) {
+                    co_return -1;
+                }
+            } else {
+                int ret = co_await upstream_send( reactor, to, buf, n, timeout_ms );
+                if ( ret <= 0 ) {
+                    co_return ret;
+                }
+            }
+        } else if ( n == -1 && errno == EAGAIN ) {
+            if ( !co_await reactor.readable( from, timeout_ms ) ) {
+                co_return 0;
+            }
+        } else {
+            co_return -1;
+        }
+    }
+    co_return 1;
 }
 
 //主状态机
 http_conn::HTTP_CODE http_conn::process_read() {
+    mirror::trace::scope ts(m_trace_id, mirror::trace::PROCESS_READ, m_sockfd);
     LINE_STATE line_status = LINE_OK;
     HTTP_CODE ret = NO_REQUEST;
     char* text = 0;
@@ -231,8 +1544,8 @@ http_conn::HTTP_CODE http_conn::process_read() {
             break;
         case CHECK_STATE_HEADER:
             ret = parse_headers(text);
-            if(ret == BAD_REQUEST) {
-                return BAD_REQUEST;
+            if(ret == BAD_REQUEST || ret == LENGTH_REQUIRED) {
+                return ret;
             }
             else if(ret == GET_REQUEST) {
                 //请求完成，解析具体内容
@@ -256,6 +1569,74 @@ http_conn::HTTP_CODE http_conn::process_read() {
 }
 
 http_conn::HTTP_CODE http_conn::do_request() {
+    mirror::trace::scope ts( m_trace_id, mirror::trace::DO_REQUEST, m_sockfd );
+    // 请求完整后才扣令牌，一次令牌对应一个请求
+    if ( m_req_limiter && m_rate_key && !m_req_limiter->allow( m_rate_key ) ) {
+        return TOO_MANY_REQUESTS;
+    }
+    return resolve_request();
+}
+
+// 按URL找到响应内容。在reactor上内联解析时，只回答资源包能直接给出的请求，其余返回SLOW_REQUEST，
+// 由工作线程从这里重新开始
+http_conn::HTTP_CODE http_conn::resolve_request() {
+    if ( m_route ) {
+        return PROXY_REQUEST;
+    }
+    // 管理入口，只对本机开放：/__trace 导出追踪记录，/__trace?sample=N 修改采样率
+    if ( strncmp( m_url, "/__trace", 8 ) == 0 && mirror::is_loopback( m_saddr ) ) {
+        if ( m_on_reactor ) {
+            m_lane = mirror::LANE_FAST; // 导出要写文件，但不该排在一堆大文件后面
+            return SLOW_REQUEST;
+        }
+        const char* arg = strstr( m_url, "sample=" );
+        if ( arg ) {
+            mirror::trace::set_sampling( atoi( arg + 7 ) );
+            snprintf( m_file_dir, FILEPATH_LEN, "sampling 1/%d\n", atoi( arg + 7 ) );
+        } else {
+            snprintf( m_file_dir, FILEPATH_LEN, "%s\n", mirror::trace::dump_file().c_str() );
+        }
+        return ADMIN_REQUEST;
+    }
+    if ( m_upgrade_ws && m_ws_key && m_ws_hub && m_method == GET && strcmp( m_url, m_ws_hub->path() ) == 0 ) {
+        return WS_UPGRADE;
+    }
+    if ( m_sse_hub && m_method == GET && strcmp( m_url, m_sse_hub->path() ) == 0 ) {
+        return SSE_SUBSCRIBE;
+    }
+    if ( m_upgrade_h2c && m_http2_settings && m_content_length == 0 ) {
+        return m_on_reactor ? SLOW_REQUEST : H2C_UPGRADE;
+    }
+    if ( m_handler.r ) {
+        if ( m_handler.r->local_only && ! mirror::is_loopback( m_saddr ) ) {
+            return FORBIDDEN_REQUEST;
+        }
+        // 声明会阻塞的处理器不在reactor上执行
+        return m_on_reactor && m_handler.r->blocking ? SLOW_REQUEST : HANDLER_REQUEST;
+    }
+    if ( m_handler.method_mismatch ) {
+        return METHOD_NOT_ALLOWED;
+    }
+    // 先查资源包，命中则不再访问文件系统
+    m_asset_entry = m_assets.find( m_url, strlen( m_url ) );
+    if ( m_asset_entry ) {
+        if ( m_if_none_match ) {
+            // 原始编码的ETag为"xxx"，gzip编码为"xxx-gz"
+            size_t len = strlen( m_asset_entry->etag ) - 1;
+            const char* rest = m_if_none_match + len;
+            if ( strncmp( m_if_none_match, m_asset_entry->etag, len ) == 0 &&
+                 ( strcmp( rest, "\"" ) == 0 || strcmp( rest, "-gz\"" ) == 0 ) ) {
+                return NOT_MODIFIED;
+            }
+        }
+        m_asset = ( m_accept_gzip && m_asset_entry->has_gzip ) ? &m_asset_entry->gzip : &m_asset_entry->identity;
+        return ASSET_REQUEST;
+    }
+    if ( m_on_reactor ) {
+        m_lane = mirror::LANE_BULK;
+        return SLOW_REQUEST; // stat、open、mmap和可能的缺页都留给工作线程
+    }
+
     strcpy( m_file_dir, doc_root );
     int len = strlen( doc_root );
     strncpy( m_file_dir + len, m_url, FILEPATH_LEN - len - 1 );
@@ -276,21 +1657,44 @@ http_conn::HTTP_CODE http_conn::do_request() {
 
     // 以只读方式打开文件
     int fd = open( m_file_dir, O_RDONLY );
+    mirror::advise_open( fd, m_file_stat );
     // 创建内存映射
     m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
     close( fd );
+    if ( m_file_address == MAP_FAILED ) {
+        m_file_address = 0;
+        return INTERNAL_ERROR;
+    }
+    if ( m_file_stat.st_size >= mirror::LARGE_FILE_SIZE ) {
+        madvise( m_file_address, m_file_stat.st_size, MADV_SEQUENTIAL );
+    }
+    // 检查文件页是否都在页缓存中，冷文件在发送前预读，避免主循环在writev里缺页
+    if ( !m_residency.recently_warm( m_file_stat ) ) {
+        if ( mirror::is_resident( m_file_address, m_file_stat.st_size ) ) {
+            m_residency.mark_warm( m_file_stat );
+        } else {
+            m_file_cold = true;
+        }
+    }
     return FILE_REQUEST;
 }
 
 void http_conn::unmap() {
-    if( m_file_dir )
+    // 资源包的内存常驻，不能释放；还被零拷贝发送引用着的映射等最后一个完成通知到达时再释放
+    if( m_zc_buf ) {
+        m_zc_buf->unref();
+        m_zc_buf = nullptr;
+    }
+    else if( m_file_address && !m_asset )
     {
-        munmap( m_file_dir, m_file_stat.st_size );
-        m_file_address = 0;
+        munmap( m_file_address, m_file_stat.st_size );
     }
+    m_file_address = 0;
+    m_asset = 0;
 }
 
 bool http_conn::process_write(HTTP_CODE ret) {
+    mirror::trace::scope ts( m_trace_id, mirror::trace::PROCESS_WRITE, m_sockfd );
     switch (ret)
     {
         case INTERNAL_ERROR:
@@ -321,24 +1725,177 @@ bool http_conn::process_write(HTTP_CODE ret) {
                 return false;
             }
             break;
+        case ADMIN_REQUEST:
+            // 结果文字放在m_file_dir里
+            add_status_line( 200, ok_200_title );
+            add_headers( strlen( m_file_dir ) );
+            if ( ! add_content( m_file_dir ) ) {
+                return false;
+            }
+            break;
+        case METHOD_NOT_ALLOWED:
+            add_status_line( 405, error_405_title );
+            add_headers( strlen( error_405_form ) );
+            if ( ! add_content( error_405_form ) ) {
+                return false;
+            }
+            break;
+        case LENGTH_REQUIRED:
+            add_status_line( 411, error_411_title );
+            add_headers( strlen( error_411_form ) );
+            if ( ! add_content( error_411_form ) ) {
+                return false;
+            }
+            break;
+        case HANDLER_REQUEST:
+            if ( ! call_handler() ) {
+                // 处理器的响应超出了写缓冲
+                m_write_idx = 0;
+                return process_write( INTERNAL_ERROR );
+            }
+            return true;
+        case TOO_MANY_REQUESTS:
+            // 超限的客户端直接断开，不再为它保持连接
+            m_keep_alive = false;
+            add_status_line( 429, error_429_title );
+            add_response( "Retry-After: 1\r\n" );
+            add_headers( strlen( error_429_form ) );
+            if ( ! add_content( error_429_form ) ) {
+                return false;
+            }
+            break;
+        case BAD_GATEWAY:
+            add_status_line( 502, error_502_title );
+            add_headers( strlen( error_502_form ) );
+            if ( ! add_content( error_502_form ) ) {
+                return false;
+            }
+            break;
+        case GATEWAY_TIMEOUT:
+            add_status_line( 504, error_504_title );
+            add_headers( strlen( error_504_form ) );
+            if ( ! add_content( error_504_form ) ) {
+                return false;
+            }
+            break;
         case FILE_REQUEST:
             add_status_line(200, ok_200_title );
             add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf;
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
+            set_iov( m_file_address, m_file_stat.st_size );
+            return true;
+        case ASSET_REQUEST:
+            // 预先生成的头部直接拷进写缓冲，只补上与连接相关的部分
+            if ( m_asset->hdr_len >= WRITE_BUFFER_SIZE ) {
+                return false;
+            }
+            memcpy( m_write_buf, m_assets.at( m_asset->hdr_off ), m_asset->hdr_len );
+            m_write_idx = m_asset->hdr_len;
+            if ( ! ( add_linger() && add_date() && add_blank_line() ) ) {
+                return false;
+            }
+            m_file_address = ( char* )m_assets.at( m_asset->body_off );
+            set_iov( m_file_address, m_asset->body_len );
+            return true;
+        case NOT_MODIFIED:
+            add_status_line( 304, not_modified_304_title );
+            if ( ! ( add_response( "ETag: %s\r\n", m_asset_entry->etag ) && add_linger() && add_date() && add_blank_line() ) ) {
+                return false;
+            }
+            break;
+        case WS_UPGRADE:
+        {
+            // 会话等101发完后在ws_start里建立，之前读缓冲里剩下的字节已经是帧
+            char accept[ 32 ];
+            mirror::ws_accept_key( m_ws_key, accept );
+            add_status_line( 101, switching_101_title );
+            if ( ! add_response( "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept ) ) {
+                return false;
+            }
+            m_ws_upgrading = true;
+            break;
+        }
+        case SSE_SUBSCRIBE:
+            // 不带Content-Length，连接一直开着；retry告诉浏览器断线后多久重连
+            add_status_line( 200, ok_200_title );
+            if ( ! ( add_response( "Content-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: keep-alive\r\n" ) &&
+                     add_date() && add_blank_line() && add_response( "retry: 3000\n\n" ) ) ) {
+                return false;
+            }
+            m_keep_alive = true;
+            m_sse_starting = true;
+            break;
+        case H2C_UPGRADE:
+            // 101之后的字节（通常是连接前言）已经属于HTTP/2
+            h2_start();
+            m_h2->upgrade( m_http2_settings, m_url, m_accept_gzip, m_if_none_match );
+            m_h2->feed( m_read_buf + m_checked_idx, m_read_idx - m_checked_idx );
+            m_read_idx = 0;
             return true;
         default:
             return false;
     }
 
+    set_iov( NULL, 0 );
+    return true;
+}
+
+// 把请求各部分的视图交给处理器，处理器直接往写缓冲里写响应
+bool http_conn::call_handler() {
+    static const char* method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+    mirror::http_request req;
+    size_t path_len = strcspn( m_url, "?" );
+    req.method = method_names[ m_method ];
+    req.path = std::string_view( m_url, path_len );
+    req.query = m_url[ path_len ] == '?' ? std::string_view( m_url + path_len + 1 ) : std::string_view();
+    req.rest = req.path.substr( m_handler.prefix_len );
+    req.body = m_content_length > 0 ? std::string_view( m_read_buf + m_start_line_idx, m_content_length ) : std::string_view();
+    req.headers = m_version + strlen( m_version ) + 2;
+    req.headers_end = m_read_buf + m_checked_idx;
+
+    mirror::response_builder res( m_write_buf, WRITE_BUFFER_SIZE );
+    m_handler.r->handler( req, res );
+    char common[ 96 ];
+    snprintf( common, sizeof( common ), "Date: %s\r\nConnection: %s\r\n", coarse_clock::http_date(),
+              m_keep_alive ? "keep-alive" : "close" );
+    size_t len = res.finish( common, m_method == HEAD );
+    if ( len == 0 ) {
+        return false;
+    }
+    m_write_idx = len;
+    set_iov( ( char* )res.ref(), res.ref_len() );
+    return true;
+}
+
+// 第一块是写缓冲中的响应头，第二块（如果有）是文件内容
+void http_conn::set_iov( char* body, size_t body_len ) {
     m_iv[ 0 ].iov_base = m_write_buf;
     m_iv[ 0 ].iov_len = m_write_idx;
     m_iv_count = 1;
-    return true;
+    if ( body ) {
+        m_iv[ 1 ].iov_base = body;
+        m_iv[ 1 ].iov_len = body_len;
+        m_iv_count = 2;
+    }
+    m_bytes_to_send = m_write_idx + ( body ? body_len : 0 );
+    m_send_mark = m_sent;
+    m_send_mark_ms = coarse_clock::now_ms();
+    // 足够大的响应体用MSG_ZEROCOPY发送，只限明文连接（kTLS和OpenSSL都要先加密一遍）
+    bool plain = true;
+#ifdef WITH_TLS
+    plain = !m_ssl;
+#endif
+    m_zc_body = body && m_zerocopy_min > 0 && body_len >= m_zerocopy_min && plain && m_zc.usable( m_sockfd );
 }
+// 发送一块随后就会被复用或释放的缓冲（h2输出、代理转发的栈缓冲）：不能走MSG_ZEROCOPY，
+// 否则send返回后内核还引用着这些页，对端可能收到被改写的数据
+void http_conn::set_copy_iov( const void* data, size_t len ) {
+    m_iv[ 0 ].iov_base = ( void* )data;
+    m_iv[ 0 ].iov_len = len;
+    m_iv_count = 1;
+    m_bytes_to_send = len;
+    m_zc_body = false;
+}
+
 // 往写缓冲中写入待发送的数据
 bool http_conn::add_response( const char* format, ... ) {
     if( m_write_idx >= WRITE_BUFFER_SIZE ) {
@@ -362,6 +1919,7 @@ bool http_conn::add_status_line( int status, const char* title ) {
 bool http_conn::add_headers(int content_len) {
     return add_content_length(content_len) &&
     add_content_type() && 
+    add_date() && 
     add_linger() && 
     add_blank_line();
 }
@@ -375,6 +1933,11 @@ bool http_conn::add_linger()
     return add_response( "Connection: %s\r\n", ( m_keep_alive == true ) ? "keep-alive" : "close" );
 }
 
+bool http_conn::add_date()
+{
+    return add_response( "Date: %s\r\n", coarse_clock::http_date() );
+}
+
 bool http_conn::add_blank_line()
 {
     return add_response( "%s", "\r\n" );
@@ -391,13 +1954,30 @@ bool http_conn::add_content_type() {
 
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
     m_url = strpbrk(text, " \t");
-
+    if(!m_url) {
+        return BAD_REQUEST;
+    }
     *m_url++ = '\0';
 
     char* method = text;
     if(strcasecmp(method, "GET") == 0) {
         m_method = GET;
     }
+    else if(strcasecmp(method, "POST") == 0) {
+        m_method = POST;
+    }
+    else if(strcasecmp(method, "HEAD") == 0) {
+        m_method = HEAD;
+    }
+    else if(strcasecmp(method, "PUT") == 0) {
+        m_method = PUT;
+    }
+    else if(strcasecmp(method, "DELETE") == 0) {
+        m_method = DELETE;
+    }
+    else if(strcasecmp(method, "OPTIONS") == 0) {
+        m_method = OPTIONS;
+    }
     else return BAD_REQUEST;
 
     m_version = strpbrk(m_url, " \t");
@@ -418,6 +1998,16 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
         return BAD_REQUEST;
     }
 
+    // 先找代理路由，再找请求处理器；静态文件只支持GET
+    m_route = m_proxy ? m_proxy->match(m_url) : nullptr;
+    m_handler = mirror::route_match();
+    if(!m_route && m_router) {
+        m_handler = m_router->match(1u << m_method, std::string_view(m_url, strcspn(m_url, "?")));
+    }
+    if(m_method != GET && !m_route && !m_handler.r && !m_handler.method_mismatch) {
+        return BAD_REQUEST;
+    }
+
     m_check_stat = CHECK_STATE_HEADER;
  
     return NO_REQUEST;
@@ -428,7 +2018,17 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text) {
     if( text[0] == '\0' ) {
         // 如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，
         // 状态机转移到CHECK_STATE_CONTENT状态
-        if ( m_content_length != 0 ) {
+        // chunked请求体只有代理路由能边转发边找结束位置，本地的处理器和文件都要求Content-Length；
+        // 两者同时出现时无法确定哪个算数，是请求走私的常见手法
+        if ( m_chunked ) {
+            m_keep_alive = m_keep_alive && m_route && m_content_length == 0;
+            if ( m_content_length != 0 ) {
+                return BAD_REQUEST;
+            }
+            return m_route ? GET_REQUEST : LENGTH_REQUIRED;
+        }
+        // 代理请求的消息体边收边转发，不在读缓冲里攒齐
+        if ( m_content_length != 0 && !m_route ) {
             m_check_stat = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
@@ -442,10 +2042,52 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text) {
             m_keep_alive = true;
         }
     } else if ( strncasecmp( text, "Content-Length:", 15 ) == 0 ) {
-        // 处理Content-Length头部字段
+        // 处理Content-Length头部字段：只接受十进制数字，负数、溢出或夹杂其它字符的请求体长度说不清，
+        // 之后的字节无法划分，直接400并关闭连接
+        text += 15;
+        text += strspn( text, " \t" );
+        long long len = 0;
+        char* p = text;
+        for ( ; *p >= '0' && *p <= '9'; ++p ) {
+            len = len * 10 + ( *p - '0' );
+            if ( len > MAX_CONTENT_LENGTH ) {
+                break;
+            }
+        }
+        if ( p == text || len > MAX_CONTENT_LENGTH || p[ strspn( p, " \t" ) ] != '\0' ) {
+            m_keep_alive = false;
+            return BAD_REQUEST;
+        }
+        m_content_length = len;
+    } else if ( strncasecmp( text, "Transfer-Encoding:", 18 ) == 0 ) {
+        // 只认识单独的chunked，其它编码无法确定请求体在哪里结束
+        text += 18;
+        text += strspn( text, " \t" );
+        if ( strcasecmp( text, "chunked" ) != 0 ) {
+            m_keep_alive = false;
+            return BAD_REQUEST;
+        }
+        m_chunked = true;
+    } else if ( strncasecmp( text, "If-None-Match:", 14 ) == 0 ) {
+        text += 14;
+        text += strspn( text, " \t" );
+        m_if_none_match = text;
+    } else if ( strncasecmp( text, "Accept-Encoding:", 16 ) == 0 ) {
+        text += 16;
+        m_accept_gzip = strstr( text, "gzip" ) != NULL;
+    } else if ( strncasecmp( text, "Upgrade:", 8 ) == 0 ) {
+        text += 8;
+        text += strspn( text, " \t" );
+        m_upgrade_h2c = strcasecmp( text, "h2c" ) == 0;
+        m_upgrade_ws = strcasecmp( text, "websocket" ) == 0;
+    } else if ( strncasecmp( text, "Sec-WebSocket-Key:", 18 ) == 0 ) {
+        text += 18;
+        text += strspn( text, " \t" );
+        m_ws_key = text;
+    } else if ( strncasecmp( text, "HTTP2-Settings:", 15 ) == 0 ) {
         text += 15;
         text += strspn( text, " \t" );
-        m_content_length = atol(text);
+        m_http2_settings = text;
     } else if ( strncasecmp( text, "Host:", 5 ) == 0 ) {
         // 处理Host头部字段
         text += 5;
@@ -501,14 +2143,28 @@ void http_conn::init_stat() {
     m_start_line_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
+    m_bytes_to_send = 0;
+    m_zc_body = false;
     m_method = GET;
     m_url = 0;
     m_version = 0;
     m_keep_alive = false;
+    m_chunked = false;
     m_host = 0;
-    bzero(m_read_buf, READ_BUFFER_SIZE); 
-    bzero(m_write_buf, WRITE_BUFFER_SIZE); 
-    bzero(m_file_dir, FILEPATH_LEN); 
+    m_if_none_match = 0;
+    m_accept_gzip = false;
+    m_route = 0;
+    m_handler = mirror::route_match();
+    m_trace_id = mirror::trace::sample();
+    m_upgrade_h2c = false;
+    m_upgrade_ws = false;
+    m_http2_settings = 0;
+    m_ws_key = 0;
+    m_asset_entry = 0;
+    m_asset = 0;
+    m_file_address = 0;
+    m_file_cold = false;
+    // 缓冲不用清零：解析只看m_read_idx之前的字节，响应头和路径都是带\0写入的
     m_content_length = 0;   
 }
 
@@ -0,0 +1,74 @@
+#ifndef IDLE_LRU_H
+#define IDLE_LRU_H
+
+#include <vector>
+
+// 空闲 keep-alive 连接的 LRU 表，以 fd 为下标的双向链表，只在主循环线程中使用。
+// 一个响应发送完毕且连接保持时 touch()，连接再次可读或被关闭时 remove()。
+// fd 或内存不足时从表头（最久未活动）开始驱逐，而不是拒绝新客户端。
+class idle_lru {
+public:
+    idle_lru(int max_fd, int max_idle)
+        : m_prev(max_fd, -1), m_next(max_fd, -1), m_linked(max_fd, false),
+          m_head(-1), m_tail(-1), m_size(0), m_max_idle(max_idle) {}
+
+    // 把 fd 放到表尾（最近活动）
+    void touch(int fd) {
+        if(fd < 0 || fd >= (int)m_linked.size()) {
+            return;
+        }
+        if(m_linked[fd]) {
+            unlink(fd);
+        }
+        m_prev[fd] = m_tail;
+        m_next[fd] = -1;
+        if(m_tail != -1) {
+            m_next[m_tail] = fd;
+        } else {
+            m_head = fd;
+        }
+        m_tail = fd;
+        m_linked[fd] = true;
+        ++m_size;
+    }
+
+    void remove(int fd) {
+        if(fd < 0 || fd >= (int)m_linked.size() || !m_linked[fd]) {
+            return;
+        }
+        unlink(fd);
+    }
+
+    // 取出最久未活动的 fd，表空返回 -1
+    int pop_lru() {
+        int fd = m_head;
+        if(fd != -1) {
+            unlink(fd);
+        }
+        return fd;
+    }
+
+    bool over_limit() const { return m_size > m_max_idle; }
+    int size() const { return m_size; }
+    int max_idle() const { return m_max_idle; }
+
+private:
+    void unlink(int fd) {
+        int p = m_prev[fd], n = m_next[fd];
+        if(p != -1) m_next[p] = n; else m_head = n;
+        if(n != -1) m_prev[n] = p; else m_tail = p;
+        m_prev[fd] = m_next[fd] = -1;
+        m_linked[fd] = false;
+        --m_size;
+    }
+
+    std::vector<int> m_prev;
+    std::vector<int> m_next;
+    std::vector<bool> m_linked;
+    int m_head;
+    int m_tail;
+    int m_size;
+    int m_max_idle;
+};
+
+#endif
@@ -6,10 +6,14 @@
 #include <arpa/inet.h>
 
 #include "http_conn.h"
+#include "coarse_clock.h"
 
 #define BUFFER_SIZE 64
 
 class http_conn;
+class util_timer;
+bool timer_current(util_timer* timer); //定义在http_conn.h，这里http_conn还不完整
+
 // 定时器类
 class util_timer {
 public:
@@ -19,6 +23,7 @@ public:
    time_t expire;   // 任务超时时间，这里使用绝对时间
    void (*cb_func)( http_conn* ); // 任务回调函数，回调函数处理的客户数据，由定时器的执行者传递给回调函数
    http_conn* user_data; 
+   uint64_t handle = 0; // 创建定时器时连接的句柄，连接已关闭（槽位可能已给了新连接）的定时器到期时直接丢弃
    util_timer* prev;    // 指向前一个定时器
    util_timer* next;    // 指向后一个定时器
 };
@@ -123,7 +128,7 @@ public:
             return;
         }
         printf( "timer tick\n" );
-        time_t cur = time( NULL );  // 获取当前系统时间
+        time_t cur = coarse_clock::now();  // 获取主循环缓存的单调时间
         util_timer* tmp = head;
         // 从头节点开始依次处理每个定时器，直到遇到一个尚未到期的定时器
         while( tmp ) {
@@ -134,7 +139,9 @@ public:
             }
 
             // 调用定时器的回调函数，以执行定时任务
-            tmp->cb_func( tmp->user_data );
+            if( timer_current( tmp ) ) {
+                tmp->cb_func( tmp->user_data );
+            }
             // 执行完定时器中的定时任务之后，就将它从链表中删除，并重置链表头节点
             head = tmp->next;
             if( head ) {
@@ -179,4 +186,97 @@ private:
     util_timer* tail;   // 尾结点
 };
 
+// 时间轮：定时器按到期的秒数散列到SLOTS个槽里，每个槽是带哨兵的环形双向链表，
+// 添加、删除、调整都是O(1)。有序链表在上万个连接时，每次建连和续期都要从头找插入位置，
+// 时间轮没有这个问题。到期时间超过一圈的定时器先留在槽里，轮到它那一圈时才处理。
+// 接口与sort_timer_lst相同，由server_policy选用
+class timer_wheel {
+public:
+    static const int SLOTS = 64;
+
+    timer_wheel() : m_last( 0 ) {
+        for( int i = 0; i < SLOTS; ++i ) {
+            m_slots[i].prev = m_slots[i].next = &m_slots[i];
+        }
+    }
+    ~timer_wheel() {
+        for( int i = 0; i < SLOTS; ++i ) {
+            util_timer* tmp = m_slots[i].next;
+            while( tmp != &m_slots[i] ) {
+                util_timer* next = tmp->next;
+                delete tmp;
+                tmp = next;
+            }
+        }
+    }
+    timer_wheel( const timer_wheel& ) = delete;
+    timer_wheel& operator=( const timer_wheel& ) = delete;
+
+    void add_timer( util_timer* timer ) {
+        if( !timer ) {
+            return;
+        }
+        // 已经过了的时刻对应的槽要转一圈才会再扫到，放到下一个要扫的槽里
+        time_t t = timer->expire > m_last ? timer->expire : m_last + 1;
+        util_timer* head = &m_slots[t % SLOTS];
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+
+    // 超时时间变了（延长或缩短都可以），换到新的槽里
+    void adjust_timer( util_timer* timer ) {
+        if( !timer ) {
+            return;
+        }
+        unlink( timer );
+        add_timer( timer );
+    }
+
+    void del_timer( util_timer* timer ) {
+        if( !timer ) {
+            return;
+        }
+        unlink( timer );
+        delete timer;
+    }
+
+    // 扫过上次tick之后走过的每一秒对应的槽；隔了一圈以上就把所有槽都扫一遍
+    void tick() {
+        time_t cur = coarse_clock::now();
+        if( cur <= m_last ) {
+            return;
+        }
+        printf( "timer tick\n" );
+        time_t steps = cur - m_last < SLOTS ? cur - m_last : SLOTS;
+        for( time_t t = cur - steps + 1; t <= cur; ++t ) {
+            util_timer* head = &m_slots[t % SLOTS];
+            util_timer* tmp = head->next;
+            while( tmp != head ) {
+                util_timer* next = tmp->next; // 回调里续期的新定时器不会到期，挂在哪个槽都不影响这里
+                if( tmp->expire <= cur ) {
+                    unlink( tmp );
+                    if( timer_current( tmp ) ) {
+                        tmp->cb_func( tmp->user_data );
+                    }
+                    delete tmp;
+                }
+                tmp = next;
+            }
+        }
+        m_last = cur;
+    }
+
+private:
+    static void unlink( util_timer* timer ) {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = timer->next = NULL;
+    }
+
+    util_timer m_slots[SLOTS];  // 各槽的哨兵，只用prev和next
+    time_t m_last;              // 上次tick扫到的时刻
+};
+
 #endif
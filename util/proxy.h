@@ -0,0 +1,309 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <ctype.h>
+#include "epoll_manage.h"
+
+// 反向代理：按路径前缀把请求转发给一组上游地址。
+// 每个上游在本 reactor 上保留若干 keep-alive 连接，选上游时挑当前未完成请求最少的，
+// 连接、读写的超时由 coro_reactor 的定时器负责。
+namespace mirror {
+
+    const size_t PROXY_MAX_IDLE = 32;          // 每个上游最多保留的空闲连接
+    const long long PROXY_TIMEOUT_MS = 5000;   // 配置里没写超时时使用
+
+    struct upstream {
+        sockaddr_in addr;
+        std::string name;                      // ip:port，打日志用
+        long long timeout_ms;                  // 连接和每次等待读写的超时
+        int outstanding = 0;                   // 正在转发中的请求数
+        std::vector<int> idle;                 // 可复用的keep-alive连接
+    };
+
+    struct proxy_route {
+        std::string prefix;
+        std::vector<upstream*> pool;
+        size_t next = 0;                       // 未完成请求数相同时轮转
+    };
+
+    const int CHUNK_SIZE_DIGITS = 16;          // 分块长度最多几位十六进制，再多就溢出了
+
+    // 原样转发chunked响应时跟踪分块边界，只为了知道响应在哪里结束
+    class chunked_scanner {
+    public:
+        // 返回已经消费的字节数，done()为真时之后的字节不属于这个响应；
+        // failed()为真时格式错误，这次交换只能放弃
+        size_t feed(const char* p, size_t n) {
+            size_t i = 0;
+            while(i < n && m_state < DONE) {
+                char c = p[i];
+                switch(m_state) {
+                    case SIZE:
+                        if(isxdigit((unsigned char)c)) {
+                            if(++m_digits > CHUNK_SIZE_DIGITS) {
+                                m_state = FAILED;
+                                return i;
+                            }
+                            m_left = m_left * 16 + (isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10));
+                        } else if(m_digits == 0) {
+                            m_state = FAILED; // 长度行没有数字
+                            return i;
+                        } else {
+                            m_state = c == '\n' ? size_done() : SIZE_EXT;
+                        }
+                        ++i;
+                        break;
+                    case SIZE_EXT: // 分块扩展和\r，直到行尾
+                        if(c == '\n') {
+                            m_state = size_done();
+                        }
+                        ++i;
+                        break;
+                    case DATA: {
+                        size_t take = std::min((size_t)m_left, n - i);
+                        m_left -= take;
+                        i += take;
+                        if(m_left == 0) {
+                            m_state = DATA_END;
+                        }
+                        break;
+                    }
+                    case DATA_END: // 数据后的\r\n
+                        if(c == '\n') {
+                            m_state = SIZE;
+                            m_digits = 0;
+                        }
+                        ++i;
+                        break;
+                    case TRAILER: // 尾部字段，空行结束
+                        if(c == '\n') {
+                            m_state = m_line_len == 0 ? DONE : TRAILER;
+                            m_line_len = 0;
+                        } else if(c != '\r') {
+                            ++m_line_len;
+                        }
+                        ++i;
+                        break;
+                    default:
+                        break;
+                }
+            }
+            return i;
+        }
+        bool done() const { return m_state == DONE; }
+        bool failed() const { return m_state == FAILED; }
+
+    private:
+        enum state {SIZE, SIZE_EXT, DATA, DATA_END, TRAILER, DONE, FAILED};
+        state size_done() {
+            if(m_left == 0) {
+                m_line_len = 0;
+                return TRAILER;
+            }
+            return DATA;
+        }
+        state m_state = SIZE;
+        unsigned long long m_left = 0;
+        int m_digits = 0;                      // 当前长度行已读的十六进制位数
+        size_t m_line_len = 0;
+    };
+
+    class proxy_table {
+    public:
+        proxy_table() = default;
+        proxy_table(const proxy_table&) = delete;
+        ~proxy_table() {
+            for(auto& up : m_upstreams) {
+                for(int fd : up->idle) {
+                    close(fd);
+                }
+            }
+            for(int* p : m_pipes) {
+                close(p[0]);
+                close(p[1]);
+                delete[] p;
+            }
+        }
+
+        // 配置文件每行：前缀 ip:port[,ip:port...] [超时毫秒]，#开头为注释；返回加载的路由数
+        int load(const char* path) {
+            FILE* fp = fopen(path, "r");
+            if(!fp) {
+                return 0;
+            }
+            char line[512];
+            while(fgets(line, sizeof(line), fp)) {
+                char prefix[256], addrs[256];
+                long long timeout_ms = PROXY_TIMEOUT_MS;
+                if(line[0] == '#' || sscanf(line, "%255s %255s %lld", prefix, addrs, &timeout_ms) < 2) {
+                    continue;
+                }
+                if(!add_route(prefix, addrs, timeout_ms)) {
+                    printf("proxy: bad upstream list %s\n", addrs);
+                }
+            }
+            fclose(fp);
+            return m_routes.size();
+        }
+
+        bool add_route(const char* prefix, const char* addrs, long long timeout_ms) {
+            proxy_route route;
+            route.prefix = prefix;
+            std::string list(addrs);
+            size_t pos = 0;
+            while(pos <= list.size()) {
+                size_t comma = list.find(',', pos);
+                std::string item = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+                size_t colon = item.rfind(':');
+                if(colon == std::string::npos) {
+                    return false;
+                }
+                std::unique_ptr<upstream> up(new upstream);
+                memset(&up->addr, 0, sizeof(up->addr));
+                up->addr.sin_family = AF_INET;
+                up->addr.sin_port = htons(atoi(item.c_str() + colon + 1));
+                if(inet_pton(AF_INET, item.substr(0, colon).c_str(), &up->addr.sin_addr) != 1) {
+                    return false;
+                }
+                up->name = item;
+                up->timeout_ms = timeout_ms;
+                route.pool.push_back(up.get());
+                m_upstreams.push_back(std::move(up));
+                if(comma == std::string::npos) {
+                    break;
+                }
+                pos = comma + 1;
+            }
+            printf("proxy: %s -> %s, timeout %lldms\n", prefix, addrs, timeout_ms);
+            m_routes.push_back(std::move(route));
+            return true;
+        }
+
+        // 最长前缀匹配，只在路径段边界上匹配：/api匹配/api、/api/x、/api?q，不匹配/apixyz
+        proxy_route* match(const char* url) {
+            proxy_route* best = nullptr;
+            for(auto& r : m_routes) {
+                size_t n = r.prefix.size();
+                if(strncmp(url, r.prefix.c_str(), n) == 0 &&
+                   (r.prefix.back() == '/' || url[n] == '\0' || url[n] == '/' || url[n] == '?') &&
+                   (!best || n > best->prefix.size())) {
+                    best = &r;
+                }
+            }
+            return best;
+        }
+
+        // 最少未完成请求
+        upstream* pick(proxy_route& route) {
+            upstream* best = nullptr;
+            size_t n = route.pool.size();
+            for(size_t i = 0; i < n; ++i) {
+                upstream* up = route.pool[(route.next + i) % n];
+                if(!best || up->outstanding < best->outstanding) {
+                    best = up;
+                }
+            }
+            route.next = (route.next + 1) % n;
+            return best;
+        }
+
+        // 取一条还活着的空闲连接，没有则返回-1
+        int take_idle(upstream& up) {
+            while(!up.idle.empty()) {
+                int fd = up.idle.back();
+                up.idle.pop_back();
+                char c;
+                ssize_t ret = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+                if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    return fd;
+                }
+                epoll_rm(m_epfd, fd); // 上游已关闭或发来了多余的数据
+            }
+            return -1;
+        }
+
+        // 响应完整读完的连接放回池中，池满就关掉
+        void release(upstream& up, int fd) {
+            if(up.idle.size() < PROXY_MAX_IDLE) {
+                up.idle.push_back(fd);
+            } else {
+                epoll_rm(m_epfd, fd);
+            }
+        }
+
+        // 非阻塞connect并注册到epoll（ONESHOT，等待时由reactor重新注册）；返回fd，失败-1
+        int connect_to(upstream& up) {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if(fd == -1) {
+                return -1;
+            }
+            if(fd >= m_max_fd) { // reactor按fd下标保存等待者
+                close(fd);
+                return -1;
+            }
+            if(connect(fd, (sockaddr*)&up.addr, sizeof(up.addr)) == -1 && errno != EINPROGRESS) {
+                close(fd);
+                return -1;
+            }
+            struct epoll_event event;
+            event.data.u64 = conn_handle(fd, 0);
+            event.events = EPOLLRDHUP | EPOLLONESHOT;
+            epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &event);
+            return fd;
+        }
+
+        // splice用的管道，用完归还；管道里不会留数据
+        int* take_pipe() {
+            if(!m_pipes.empty()) {
+                int* p = m_pipes.back();
+                m_pipes.pop_back();
+                return p;
+            }
+            int* p = new int[2];
+            if(pipe2(p, O_NONBLOCK | O_CLOEXEC) == -1) {
+                delete[] p;
+                return nullptr;
+            }
+            return p;
+        }
+        // 传输中途出错时管道里可能还有数据，不能再给别人用
+        void give_pipe(int* p, bool clean) {
+            if(clean) {
+                m_pipes.push_back(p);
+                return;
+            }
+            close(p[0]);
+            close(p[1]);
+            delete[] p;
+        }
+
+        void init(int epfd, int max_fd) {
+            m_epfd = epfd;
+            m_max_fd = max_fd;
+        }
+        int max_fd() const { return m_max_fd; }
+        bool empty() const { return m_routes.empty(); }
+
+    private:
+        int m_epfd = -1;
+        int m_max_fd = 0;
+        std::vector<proxy_route> m_routes;
+        std::vector<std::unique_ptr<upstream>> m_upstreams;
+        std::vector<int*> m_pipes;
+    };
+}
+
+#endif
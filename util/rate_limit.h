@@ -0,0 +1,217 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "coarse_clock.h"
+
+// 按客户端IP的令牌桶限流。表按哈希分片，槽位是两个原子量（键、状态），
+// 状态把上次补充令牌的时间和剩余令牌打包在一个64位里，用CAS更新，
+// 主线程和工作线程可以同时检查而不用加锁；时间取coarse_clock，一次检查只是几次原子操作。
+namespace mirror {
+
+    // IPv4按前缀（默认/32）、IPv6按前缀（默认/64）归并成一个键，同一网段共享一个桶
+    inline uint64_t rate_key(const sockaddr_in& addr, int prefix = 32) {
+        uint32_t ip = ntohl(addr.sin_addr.s_addr);
+        uint32_t mask = prefix >= 32 ? 0xffffffffu : prefix <= 0 ? 0 : ~(0xffffffffu >> prefix);
+        return (uint64_t)(ip & mask) | (1ULL << 32); // 与IPv6的键区分开
+    }
+
+    // 本机来的连接（压测、同机的前置代理）不限流，键为0
+    inline uint64_t rate_key_or_exempt(const sockaddr_in& addr, int prefix = 32) {
+        return (ntohl(addr.sin_addr.s_addr) >> 24) == 127 ? 0 : rate_key(addr, prefix);
+    }
+
+    inline uint64_t rate_key(const sockaddr_in6& addr, int prefix = 64, int prefix_v4 = 32) {
+        const uint8_t* b = addr.sin6_addr.s6_addr;
+        if(IN6_IS_ADDR_V4MAPPED(&addr.sin6_addr)) {
+            // 双栈监听socket上的IPv4客户端，和IPv4监听socket上的同一客户端共用一个桶
+            sockaddr_in v4;
+            memcpy(&v4.sin_addr, b + 12, 4);
+            return rate_key(v4, prefix_v4);
+        }
+        uint64_t hi = 0;
+        for(int i = 0; i < 8; ++i) {
+            hi = (hi << 8) | b[i];
+        }
+        // 只看前64位，更长的前缀也按/64处理
+        return prefix >= 64 ? hi : prefix <= 0 ? 0 : hi & ~(~0ULL >> prefix);
+    }
+
+    // 对端是否在本机：127/8、::1、映射成IPv6的127/8，以及Unix域socket
+    inline bool is_loopback(const sockaddr_storage& addr) {
+        if(addr.ss_family == AF_INET) {
+            return (ntohl(((const sockaddr_in&)addr).sin_addr.s_addr) >> 24) == 127;
+        }
+        if(addr.ss_family == AF_INET6) {
+            const in6_addr& a6 = ((const sockaddr_in6&)addr).sin6_addr;
+            return IN6_IS_ADDR_LOOPBACK(&a6) || (IN6_IS_ADDR_V4MAPPED(&a6) && a6.s6_addr[12] == 127);
+        }
+        return addr.ss_family == AF_UNIX;
+    }
+
+    // 任意地址族的accept结果，本机来的连接键为0
+    inline uint64_t rate_key_or_exempt(const sockaddr_storage& addr, int prefix_v4 = 32, int prefix_v6 = 64) {
+        if(is_loopback(addr)) {
+            return 0;
+        }
+        if(addr.ss_family == AF_INET6) {
+            return rate_key((const sockaddr_in6&)addr, prefix_v6, prefix_v4);
+        }
+        return addr.ss_family == AF_INET ? rate_key((const sockaddr_in&)addr, prefix_v4) : 0;
+    }
+
+    class rate_limiter {
+    public:
+        // rate：每秒补充的令牌数；burst：桶容量（最多65535）
+        rate_limiter(unsigned int rate, unsigned int burst)
+            : m_rate_units(rate * UNIT), m_burst_units(std::min(burst, 65535u) * UNIT), m_shards(SHARDS) {}
+
+        // 取一个令牌，桶空了返回false。表满时放行（宁可不限，也不能误伤）
+        bool allow(uint64_t key, long long now_ms = coarse_clock::now_ms()) {
+            uint64_t tag = key + 1; // 0表示空槽，TOMB表示删除过的槽
+            if(tag == 0 || tag == TOMB) {
+                tag = TOMB - 1; // 只有ffff:ffff:ffff:ffff::/64附近的键会并到一起
+            }
+            uint64_t h = hash(tag);
+            shard& sh = m_shards[h & (SHARDS - 1)];
+            // 探测链遇到空槽才结束，删除过的槽要跨过去继续找；没找到就占链上第一个空槽或TOMB。
+            // 和回收并发时偶尔会给同一个键占两个槽，多出的只是一个满桶，过期后回收，不会误限
+            for(int attempt = 0; attempt < 2; ++attempt) {
+                slot* free_slot = nullptr;
+                uint64_t free_key = 0;
+                size_t idx = (h >> 16) & (SLOTS - 1);
+                for(int probe = 0; probe < PROBES; ++probe, idx = (idx + 1) & (SLOTS - 1)) {
+                    slot& s = sh.slots[idx];
+                    uint64_t cur = s.key.load(std::memory_order_acquire);
+                    if(cur == tag) {
+                        return take(s, now_ms);
+                    }
+                    if((cur == 0 || cur == TOMB) && !free_slot) {
+                        free_slot = &s;
+                        free_key = cur;
+                    }
+                    if(cur == 0) {
+                        break;
+                    }
+                }
+                if(!free_slot) {
+                    return true;
+                }
+                if(free_slot->key.compare_exchange_strong(free_key, tag, std::memory_order_acq_rel) || free_key == tag) {
+                    return take(*free_slot, now_ms);
+                }
+                // 被别的键抢走了，重新找一遍
+            }
+            return true;
+        }
+
+        // 删除桶已经自然补满的条目（删了等于满桶，不改变限流结果），由定时器周期调用
+        void expire(long long now_ms = coarse_clock::now_ms()) {
+            long long full_ms = m_rate_units ? (long long)m_burst_units * 1000 / m_rate_units + 1 : 0;
+            for(auto& sh : m_shards) {
+                for(auto& s : sh.slots) {
+                    uint64_t st = s.state.load(std::memory_order_relaxed);
+                    uint64_t key = s.key.load(std::memory_order_relaxed);
+                    if(key == 0 || key == TOMB || st == DEAD) {
+                        continue;
+                    }
+                    if(st != 0 && now_ms - (long long)(st >> TOKEN_BITS) <= full_ms) {
+                        continue;
+                    }
+                    // 先把状态标成DEAD，检查方看到DEAD会直接放行，再把键换成TOMB。
+                    // 不能直接清零：后面的槽里可能有探测时经过这里的键，清零会让它们再也找不到
+                    if(s.state.compare_exchange_strong(st, DEAD, std::memory_order_acq_rel)) {
+                        s.key.store(TOMB, std::memory_order_release);
+                        s.state.store(0, std::memory_order_release);
+                    }
+                }
+                // 下一个槽是空的，经过这个TOMB的探测链到这里就结束了，可以变回空槽。
+                // 从后往前扫，连续的一串TOMB一次就能收回；跨过表尾的下次再收
+                for(size_t i = SLOTS; i-- > 0;) {
+                    uint64_t tomb = TOMB;
+                    if(sh.slots[(i + 1) & (SLOTS - 1)].key.load(std::memory_order_acquire) == 0) {
+                        sh.slots[i].key.compare_exchange_strong(tomb, 0, std::memory_order_acq_rel);
+                    }
+                }
+            }
+        }
+
+        // 当前占用的条目数，用于观察
+        size_t size() const {
+            size_t n = 0;
+            for(auto& sh : m_shards) {
+                for(auto& s : sh.slots) {
+                    uint64_t key = s.key.load(std::memory_order_relaxed);
+                    n += key != 0 && key != TOMB;
+                }
+            }
+            return n;
+        }
+
+    private:
+        static const int SHARDS = 16;
+        static const size_t SLOTS = 4096;       // 每个分片的槽位数
+        static const int PROBES = 8;            // 线性探测的最大步数
+        static const int TOKEN_BITS = 24;       // 状态的低24位是令牌数，高40位是毫秒时间
+        static const uint32_t UNIT = 256;       // 一个令牌 = 256个单位，保留补充时的小数部分
+        static const uint64_t DEAD = ~0ULL;
+        static const uint64_t TOMB = ~0ULL;     // 键：条目已删除，查找时跨过，插入时可以复用
+
+        struct slot {
+            std::atomic<uint64_t> key{0};
+            std::atomic<uint64_t> state{0};     // 0表示刚占用的满桶
+        };
+        struct alignas(64) shard {
+            slot slots[SLOTS];
+        };
+
+        bool take(slot& s, long long now_ms) {
+            uint64_t st = s.state.load(std::memory_order_relaxed);
+            while(true) {
+                if(st == DEAD) {
+                    return true; // 正在被回收
+                }
+                uint64_t tokens = m_burst_units;
+                uint64_t last = now_ms;
+                if(st != 0) {
+                    tokens = st & ((1ULL << TOKEN_BITS) - 1);
+                    last = st >> TOKEN_BITS;
+                    if((uint64_t)now_ms > last) {
+                        uint64_t add = ((uint64_t)now_ms - last) * m_rate_units / 1000;
+                        if(add > 0) {
+                            tokens = std::min<uint64_t>(m_burst_units, tokens + add);
+                            last = now_ms;
+                        }
+                    }
+                }
+                bool ok = tokens >= UNIT;
+                if(ok) {
+                    tokens -= UNIT;
+                }
+                uint64_t next = (last << TOKEN_BITS) | tokens;
+                if(next == st || s.state.compare_exchange_weak(st, next, std::memory_order_relaxed)) {
+                    return ok;
+                }
+            }
+        }
+
+        static uint64_t hash(uint64_t x) {
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdULL;
+            x ^= x >> 33;
+            return x;
+        }
+
+        uint64_t m_rate_units;
+        uint64_t m_burst_units;
+        std::vector<shard> m_shards;
+    };
+}
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string_view>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+
+// 请求处理器：按方法和路径把请求分给C++函数，在静态文件服务器上直接提供轻量的JSON接口。
+// 路由表在启动时建好，之后只读，多个线程同时匹配不用加锁。匹配、请求对象和响应都不分配堆内存：
+// 请求是指向连接读缓冲的string_view，响应直接写进连接的写缓冲。
+namespace mirror {
+
+    // 顺序与http_conn::METHOD一致，方法对应的位是1 << METHOD
+    enum route_method : unsigned {
+        ROUTE_GET = 1 << 0,
+        ROUTE_POST = 1 << 1,
+        ROUTE_HEAD = 1 << 2,
+        ROUTE_PUT = 1 << 3,
+        ROUTE_DELETE = 1 << 4,
+        ROUTE_OPTIONS = 1 << 6,
+        ROUTE_ANY = 0xff
+    };
+
+    // 请求的各部分都指向连接的读缓冲，只在处理器返回前有效
+    struct http_request {
+        std::string_view method;
+        std::string_view path;    // 不含查询串
+        std::string_view query;   // ?之后的部分，没有时为空
+        std::string_view rest;    // 前缀路由匹配后剩下的部分，如/api/users/*匹配/api/users/42时为"42"
+        std::string_view body;
+        const char* headers;      // 头部区域：parse_line把每行的\r\n改成了\0\0，以空行结束
+        const char* headers_end;
+
+        // 按名字找头部（不区分大小写），返回去掉前导空白的值，没有时为空
+        std::string_view header(std::string_view name) const {
+            const char* p = headers;
+            while(p && p < headers_end && *p) {
+                size_t len = strlen(p);
+                if(len > name.size() && p[name.size()] == ':' && strncasecmp(p, name.data(), name.size()) == 0) {
+                    std::string_view value(p + name.size() + 1, len - name.size() - 1);
+                    value.remove_prefix(std::min(value.find_first_not_of(" \t"), value.size()));
+                    return value;
+                }
+                p += len + 2;
+            }
+            return std::string_view();
+        }
+
+        // 查询串里name=value的值，不做百分号解码；没有时为空
+        std::string_view param(std::string_view name) const {
+            std::string_view q = query;
+            while(!q.empty()) {
+                size_t amp = q.find('&');
+                std::string_view item = q.substr(0, amp);
+                if(item.size() > name.size() && item[name.size()] == '=' && item.compare(0, name.size(), name) == 0) {
+                    return item.substr(name.size() + 1);
+                }
+                q = amp == std::string_view::npos ? std::string_view() : q.substr(amp + 1);
+            }
+            return std::string_view();
+        }
+    };
+
+    // 直接往连接写缓冲里组装响应。处理器按任意顺序设置状态、头部、正文，
+    // finish时在前面补上状态行和Content-Length等公共头部。写缓冲放不下时ok()为false，连接改回500
+    class response_builder {
+    public:
+        response_builder(char* buf, size_t cap) : m_buf(buf), m_cap(cap) {}
+
+        response_builder& status(int code, const char* reason) {
+            m_status = code;
+            m_reason = reason;
+            return *this;
+        }
+        response_builder& content_type(std::string_view type) {
+            m_has_type = true;
+            return header("Content-Type", type);
+        }
+        // 头部插在已写的头部之后、正文之前，正文很短，挪动一下的开销可以忽略
+        response_builder& header(std::string_view name, std::string_view value) {
+            size_t n = name.size() + value.size() + 4;
+            if(!reserve(n)) {
+                return *this;
+            }
+            memmove(m_buf + m_hdr_end + n, m_buf + m_hdr_end, m_len - m_hdr_end);
+            char* p = m_buf + m_hdr_end;
+            memcpy(p, name.data(), name.size());
+            memcpy(p + name.size(), ": ", 2);
+            memcpy(p + name.size() + 2, value.data(), value.size());
+            memcpy(p + n - 2, "\r\n", 2);
+            m_hdr_end += n;
+            m_len += n;
+            return *this;
+        }
+        response_builder& write(std::string_view data) {
+            if(reserve(data.size())) {
+                memcpy(m_buf + m_len, data.data(), data.size());
+                m_len += data.size();
+            }
+            return *this;
+        }
+        response_builder& printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+            va_list args;
+            va_start(args, format);
+            int n = m_ok ? vsnprintf(m_buf + m_len, m_cap - m_len, format, args) : -1;
+            va_end(args);
+            if(n < 0 || (size_t)n >= m_cap - m_len) {
+                m_ok = false;
+            } else {
+                m_len += n;
+            }
+            return *this;
+        }
+        // 写一个JSON字符串（带引号），转义引号、反斜杠和控制字符
+        response_builder& json_string(std::string_view s) {
+            write("\"");
+            size_t from = 0;
+            for(size_t i = 0; i < s.size(); ++i) {
+                unsigned char c = s[i];
+                if(c != '"' && c != '\\' && c >= 0x20) {
+                    continue;
+                }
+                write(s.substr(from, i - from));
+                if(c == '"' || c == '\\') {
+                    char esc[2] = {'\\', (char)c};
+                    write(std::string_view(esc, 2));
+                } else {
+                    printf("\\u%04x", c);
+                }
+                from = i + 1;
+            }
+            write(s.substr(from));
+            return write("\"");
+        }
+        // 正文引用一段常驻内存（资源包、静态字符串），不拷进写缓冲，和之前write的内容互斥
+        response_builder& body_ref(const char* data, size_t len) {
+            m_ref = data;
+            m_ref_len = len;
+            return *this;
+        }
+
+        bool ok() const { return m_ok; }
+        const char* ref() const { return m_ref; }
+        size_t ref_len() const { return m_ref_len; }
+
+        // 补上状态行和公共头部，没有设置Content-Type时按JSON处理；HEAD请求去掉正文但保留长度。
+        // 返回写缓冲中响应的总长度，放不下时返回0
+        size_t finish(const char* extra_headers, bool head) {
+            if(!m_has_type) {
+                content_type("application/json");
+            }
+            char prefix[128];
+            size_t body_len = m_ref ? m_ref_len : m_len - m_hdr_end;
+            int n = snprintf(prefix, sizeof(prefix), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n",
+                             m_status, m_reason, body_len);
+            size_t extra = strlen(extra_headers);
+            if(!reserve(n + extra + 2)) {
+                return 0;
+            }
+            // [头部][正文] -> [状态行、长度][公共头部][头部]\r\n[正文]
+            memmove(m_buf + m_hdr_end + n + extra + 2, m_buf + m_hdr_end, m_len - m_hdr_end);
+            memmove(m_buf + n + extra, m_buf, m_hdr_end);
+            memcpy(m_buf, prefix, n);
+            memcpy(m_buf + n, extra_headers, extra);
+            m_hdr_end += n + extra;
+            memcpy(m_buf + m_hdr_end, "\r\n", 2);
+            m_hdr_end += 2;
+            m_len += n + extra + 2;
+            if(head) {
+                m_ref = nullptr;
+                m_len = m_hdr_end;
+            }
+            return m_len;
+        }
+
+    private:
+        bool reserve(size_t n) {
+            m_ok = m_ok && m_len + n <= m_cap;
+            return m_ok;
+        }
+
+        char* m_buf;
+        size_t m_cap;
+        size_t m_hdr_end = 0;  // 处理器设置的头部在[0, m_hdr_end)，正文在[m_hdr_end, m_len)
+        size_t m_len = 0;
+        int m_status = 200;
+        const char* m_reason = "OK";
+        bool m_has_type = false;
+        bool m_ok = true;
+        const char* m_ref = nullptr;
+        size_t m_ref_len = 0;
+    };
+
+    typedef void (*route_handler)(const http_request& req, response_builder& res);
+
+    struct route {
+        unsigned methods;     // route_method的组合，GET路由也接受HEAD
+        route_handler handler;
+        bool blocking;        // 处理器会阻塞（读文件、等锁），多线程版本交给线程池，不在reactor上执行
+        bool local_only;      // 只对本机客户端开放，其他地址回复403
+    };
+
+    struct route_match {
+        const route* r = nullptr;
+        size_t prefix_len = 0;        // 前缀路由匹配掉的长度
+        bool method_mismatch = false; // 路径有路由但不接受这个方法，回复405
+    };
+
+    // 路径的压缩前缀树（radix tree）。"/api/users"只匹配这个路径本身，
+    // "/api/users/*"匹配以"/api/users/"开头的所有路径，多个前缀都匹配时取最长的
+    class router {
+    public:
+        void add(unsigned methods, std::string_view pattern, route_handler handler, bool blocking = false, bool local_only = false) {
+            bool prefix = !pattern.empty() && pattern.back() == '*';
+            if(prefix) {
+                pattern.remove_suffix(1);
+            }
+            node* n = insert(&m_root, pattern);
+            (prefix ? n->prefix : n->exact).push_back({methods, handler, blocking, local_only});
+            ++m_count;
+        }
+
+        size_t size() const { return m_count; }
+
+        // 沿树往下走一遍，不分配内存
+        route_match match(unsigned method, std::string_view path) const {
+            route_match best;
+            bool matched_path = false;
+            const node* n = &m_root;
+            size_t pos = 0;
+            while(true) {
+                if(const route* r = pick(n->prefix, method)) {
+                    best.r = r;
+                    best.prefix_len = pos;
+                }
+                matched_path = matched_path || !n->prefix.empty();
+                if(pos == path.size()) {
+                    if(const route* r = pick(n->exact, method)) {
+                        best.r = r;
+                        best.prefix_len = pos;
+                    }
+                    matched_path = matched_path || !n->exact.empty();
+                    break;
+                }
+                const node* next = nullptr;
+                for(const auto& child : n->children) {
+                    if(child->label[0] == path[pos]) {
+                        next = child.get();
+                        break;
+                    }
+                }
+                if(!next || path.compare(pos, next->label.size(), next->label) != 0) {
+                    break;
+                }
+                pos += next->label.size();
+                n = next;
+            }
+            best.method_mismatch = !best.r && matched_path;
+            return best;
+        }
+
+    private:
+        struct node {
+            std::string label;                          // 从父节点到这里的这段路径
+            std::vector<std::unique_ptr<node>> children; // 首字符各不相同
+            std::vector<route> exact;                   // 路径正好在这里结束的路由
+            std::vector<route> prefix;                  // 以这里为前缀的路由
+        };
+
+        static const route* pick(const std::vector<route>& routes, unsigned method) {
+            unsigned accept = method == ROUTE_HEAD ? (ROUTE_HEAD | ROUTE_GET) : method;
+            for(const route& r : routes) {
+                if(r.methods & accept) {
+                    return &r;
+                }
+            }
+            return nullptr;
+        }
+
+        // 插入时按公共前缀拆分已有的边
+        static node* insert(node* n, std::string_view path) {
+            while(!path.empty()) {
+                node* child = nullptr;
+                for(auto& c : n->children) {
+                    if(c->label[0] == path[0]) {
+                        child = c.get();
+                        break;
+                    }
+                }
+                if(!child) {
+                    n->children.push_back(std::make_unique<node>());
+                    n->children.back()->label = std::string(path);
+                    return n->children.back().get();
+                }
+                size_t common = 0;
+                while(common < child->label.size() && common < path.size() && child->label[common] == path[common]) {
+                    ++common;
+                }
+                if(common < child->label.size()) {
+                    // child的边比公共部分长，拆成 公共部分 -> 剩余部分
+                    auto tail = std::make_unique<node>();
+                    tail->label = child->label.substr(common);
+                    tail->children = std::move(child->children);
+                    tail->exact = std::move(child->exact);
+                    tail->prefix = std::move(child->prefix);
+                    child->label.resize(common);
+                    child->children.clear();
+                    child->exact.clear();
+                    child->prefix.clear();
+                    child->children.push_back(std::move(tail));
+                }
+                n = child;
+                path.remove_prefix(common);
+            }
+            return n;
+        }
+
+        node m_root;
+        size_t m_count = 0;
+    };
+}
+
+#endif
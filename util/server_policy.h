@@ -0,0 +1,50 @@
+#ifndef SERVER_POLICY_H
+#define SERVER_POLICY_H
+
+#include "lst_timer.h"
+#include "thread_pool_2.0.h"
+
+// 服务器核心的编译期策略：定时器结构、线程池伸缩方式和出队方式在编译时选定，主循环里直接用具体类型，
+// 热路径上没有虚调用或运行时开关。每种组合由CMake单独编译成一个可执行文件，见CMakeLists.txt：
+//   SERVER_TIMER_WHEEL  连接定时器用时间轮（O(1)），默认是有序链表
+//   SERVER_POOL_FIXED   线程池固定为最小线程数，默认按排队时间伸缩
+//   SERVER_QUEUE_FIFO   线程池不分优先级，按入队先后出队，默认按权重在各优先级队列间轮询
+// 事件模型（线程池reactor或协程）仍由CORO_CONN选择
+namespace mirror {
+
+    template<typename Timers, typename Sizing, typename Queue>
+    struct server_policy {
+        using timer_list = Timers;
+        template<typename Task>
+        using pool = thread_pool<Task, Sizing, Queue>;
+    };
+
+    template<typename T> struct policy_name;
+    template<> struct policy_name<sort_timer_lst> { static constexpr const char* value = "timer list"; };
+    template<> struct policy_name<timer_wheel> { static constexpr const char* value = "timer wheel"; };
+    template<> struct policy_name<queue_latency_policy> { static constexpr const char* value = "adaptive pool"; };
+    template<> struct policy_name<fixed_size_policy> { static constexpr const char* value = "fixed pool"; };
+    template<> struct policy_name<swrr_lanes> { static constexpr const char* value = "weighted lanes"; };
+    template<> struct policy_name<fifo_lanes> { static constexpr const char* value = "fifo queue"; };
+
+#ifdef SERVER_TIMER_WHEEL
+    using selected_timers = timer_wheel;
+#else
+    using selected_timers = sort_timer_lst;
+#endif
+#ifdef SERVER_POOL_FIXED
+    using selected_sizing = fixed_size_policy;
+#else
+    using selected_sizing = queue_latency_policy;
+#endif
+
+#ifdef SERVER_QUEUE_FIFO
+    using selected_queue = fifo_lanes;
+#else
+    using selected_queue = swrr_lanes;
+#endif
+
+    using selected_policy = server_policy<selected_timers, selected_sizing, selected_queue>;
+}
+
+#endif
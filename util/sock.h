@@ -3,8 +3,14 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
 #include "error_check.h"
+#include "sock_profile.h"
 
 void sock_reuseaddr(int lfd) {
     int reuse = 1;
@@ -12,28 +18,128 @@ void sock_reuseaddr(int lfd) {
     ERROR_CHK(ret, -1, "setsockopt");
 }
 
-int listen_init(const char* addr, const char* port, bool any) {
+// 把对端地址写成文本：IPv4映射的IPv6地址还原成a.b.c.d，Unix域socket的对端没有地址，写"unix:"（同nginx）
+void sock_ntop(const sockaddr_storage& addr, char* buf, socklen_t len) {
+    if(addr.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((const sockaddr_in&)addr).sin_addr, buf, len);
+    }
+    else if(addr.ss_family == AF_INET6) {
+        const in6_addr& a6 = ((const sockaddr_in6&)addr).sin6_addr;
+        if(IN6_IS_ADDR_V4MAPPED(&a6)) {
+            inet_ntop(AF_INET, a6.s6_addr + 12, buf, len);
+        }
+        else {
+            inet_ntop(AF_INET6, &a6, buf, len);
+        }
+    }
+    else {
+        snprintf(buf, len, "unix:");
+    }
+}
+
+// 按地址创建socket并bind，family返回地址族；type为SOCK_STREAM或SOCK_DGRAM；profile非空时在bind之前
+// 把它的选项设在socket上（Unix域socket除外）。地址的写法：
+//   8080                   IPv6双栈，IPv4客户端以::ffff:a.b.c.d的形式接入；内核没有IPv6时只监听IPv4
+//   0.0.0.0:8080           只监听IPv4
+//   [::1]:8080             只监听IPv6
+//   unix:/tmp/tws.sock     文件系统中的Unix域socket，先删除上次留下的socket文件
+//   unix:@tws              抽象命名空间的Unix域socket，不在文件系统中留下文件，进程退出即消失
+int bind_on(const char* spec, int type, int* family, const mirror::sock_profile* profile = nullptr) {
     int ret = 0;
-    int lfd = socket(AF_INET, SOCK_STREAM, 0);
-    ERROR_CHK(lfd, -1, "socket");
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    socklen_t len = 0;
+    bool dual = false;
+    const char* colon = strrchr(spec, ':');
+    if(strncmp(spec, "unix:", 5) == 0) {
+        sockaddr_un& un = (sockaddr_un&)ss;
+        const char* path = spec + 5;
+        size_t n = strlen(path);
+        if(n == 0 || n >= sizeof(un.sun_path)) {
+            printf("bad unix socket path: %s\n", spec);
+            exit(-1);
+        }
+        un.sun_family = AF_UNIX;
+        memcpy(un.sun_path, path, n);
+        if(path[0] == '@') {
+            un.sun_path[0] = '\0'; //抽象地址以\0开头，按长度比较，不能带结尾的\0
+        }
+        else {
+            unlink(path);
+        }
+        len = offsetof(sockaddr_un, sun_path) + n + (path[0] != '@');
+    }
+    else if(spec[0] == '[') {
+        sockaddr_in6& a6 = (sockaddr_in6&)ss;
+        const char* end = strchr(spec, ']');
+        std::string host(spec + 1, end ? end - spec - 1 : 0);
+        a6.sin6_family = AF_INET6;
+        ret = end && end[1] == ':' ? inet_pton(AF_INET6, host.c_str(), &a6.sin6_addr) : 0;
+        if(ret != 1) {
+            printf("bad listen address: %s\n", spec);
+            exit(-1);
+        }
+        a6.sin6_port = htons(atoi(end + 2));
+        len = sizeof(a6);
+    }
+    else if(colon) {
+        sockaddr_in& a4 = (sockaddr_in&)ss;
+        std::string host(spec, colon - spec);
+        a4.sin_family = AF_INET;
+        if(inet_pton(AF_INET, host.c_str(), &a4.sin_addr) != 1) {
+            printf("bad listen address: %s\n", spec);
+            exit(-1);
+        }
+        a4.sin_port = htons(atoi(colon + 1));
+        len = sizeof(a4);
+    }
+    else {
+        sockaddr_in6& a6 = (sockaddr_in6&)ss;
+        a6.sin6_family = AF_INET6;
+        a6.sin6_addr = in6addr_any;
+        a6.sin6_port = htons(atoi(spec));
+        len = sizeof(a6);
+        dual = true;
+    }
 
-    sock_reuseaddr(lfd);
+    int lfd = socket(ss.ss_family, type, 0);
+    if(lfd == -1 && dual && errno == EAFNOSUPPORT) {
+        //内核关掉了IPv6，退回只监听IPv4
+        int port = ((sockaddr_in6&)ss).sin6_port;
+        memset(&ss, 0, sizeof(ss));
+        sockaddr_in& a4 = (sockaddr_in&)ss;
+        a4.sin_family = AF_INET;
+        a4.sin_addr.s_addr = INADDR_ANY;
+        a4.sin_port = port;
+        len = sizeof(a4);
+        dual = false;
+        lfd = socket(AF_INET, type, 0);
+    }
+    ERROR_CHK(lfd, -1, "socket");
+    *family = ss.ss_family;
 
-    int i_port = atoi(port);
-    struct sockaddr_in saddr;
-    saddr.sin_family = AF_INET;
-    saddr.sin_port = htons(i_port);
-    if(any) {
-        saddr.sin_addr.s_addr = INADDR_ANY;
+    if(ss.ss_family == AF_INET6) {
+        int v6only = !dual; //不依赖net.ipv6.bindv6only的系统默认值
+        ret = setsockopt(lfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        ERROR_CHK(ret, -1, "setsockopt");
     }
-    else {
-        ret = inet_pton(AF_INET, addr, &saddr.sin_addr.s_addr);
-        ERROR_CHK(ret, -1, "pton");
+    if(ss.ss_family != AF_UNIX) {
+        sock_reuseaddr(lfd);
+        if(profile) {
+            profile->apply_listener(lfd); //连接从监听socket继承这些选项
+        }
     }
-    ret = bind(lfd, (struct sockaddr*)&saddr, sizeof(saddr));
+    //Unix域socket没有TCP选项，缓冲大小也不从监听socket继承，只用profile里的backlog
+
+    ret = bind(lfd, (struct sockaddr*)&ss, len);
     ERROR_CHK(ret, -1, "bind");
-    
-    ret = listen(lfd, 5); //第二个参数控制请求队列长度，accept后ESTABLISHED状态队列+1，新连接到达在SYN_RCVD状态队列-1
+    return lfd;
+}
+
+// 按监听地址创建监听socket，一个进程可以有多个监听socket，地址的写法见bind_on
+int listen_on(const char* spec, const mirror::sock_profile* profile, int* family) {
+    int lfd = bind_on(spec, SOCK_STREAM, family, profile);
+    int ret = listen(lfd, profile ? profile->backlog : 5); //第二个参数控制请求队列长度，accept后ESTABLISHED状态队列+1，新连接到达在SYN_RCVD状态队列-1
     ERROR_CHK(ret, -1, "listen");
 
     return lfd;
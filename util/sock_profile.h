@@ -0,0 +1,142 @@
+#ifndef SOCK_PROFILE_H
+#define SOCK_PROFILE_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <cstdio>
+
+// 每个监听端口一套socket选项。能继承的选项在listen之前设在监听socket上，accept出来的连接
+// 自动带上，不用每个连接再setsockopt；第一个连接到来时检查一次哪些确实继承了，没继承的之后逐个补上。
+namespace mirror {
+
+    inline void set_cork(int fd, bool on) {
+        int v = on;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &v, sizeof(v));
+    }
+
+    struct sock_profile {
+        int backlog = 1024;       // 全连接队列长度，太小时突发的新连接会被丢SYN，客户端要等1秒重传
+        bool nodelay = true;      // 关闭Nagle，小响应不用等上一个段的ACK
+        bool cork = true;         // 头部和正文分两次发出时（OpenSSL加密、零拷贝）用TCP_CORK合成整段
+        int sndbuf = 0;           // 字节，0表示交给内核自动调整
+        int rcvbuf = 0;
+        int notsent_lowat = 0;    // 发送缓冲里未发出的数据超过这么多字节就不再报可写，0表示不限
+        int busy_poll_us = 0;     // 读时忙等网卡队列的微秒数，需要网卡支持
+        int keepalive_idle = 0;   // 空闲多少秒后发TCP keepalive探测，0表示不开
+        int keepalive_intvl = 10; // 探测间隔秒数
+        int keepalive_cnt = 3;    // 探测失败多少次断开
+
+        // 解析"nodelay=0,sndbuf=262144,keepalive_idle=60"这样的覆盖项，有不认识的键返回false
+        bool parse(const char* spec) {
+            struct field { const char* name; int* value; };
+            int nd = nodelay, ck = cork;
+            field fields[] = {{"backlog", &backlog}, {"nodelay", &nd}, {"cork", &ck}, {"sndbuf", &sndbuf},
+                              {"rcvbuf", &rcvbuf}, {"notsent_lowat", &notsent_lowat}, {"busy_poll_us", &busy_poll_us},
+                              {"keepalive_idle", &keepalive_idle}, {"keepalive_intvl", &keepalive_intvl},
+                              {"keepalive_cnt", &keepalive_cnt}};
+            bool ok = true;
+            char buf[512];
+            snprintf(buf, sizeof(buf), "%s", spec);
+            char* save = nullptr;
+            for(char* item = strtok_r(buf, ", ", &save); item; item = strtok_r(nullptr, ", ", &save)) {
+                char* eq = strchr(item, '=');
+                bool found = false;
+                if(eq) {
+                    *eq = '\0';
+                    for(auto& f : fields) {
+                        if(strcmp(item, f.name) == 0) {
+                            *f.value = atoi(eq + 1);
+                            found = true;
+                        }
+                    }
+                }
+                ok = ok && found;
+            }
+            nodelay = nd;
+            cork = ck;
+            return ok;
+        }
+
+        // 在bind之前调用：接收缓冲要在listen前定下来，窗口扩大因子在握手时协商
+        void apply_listener(int lfd) const {
+            opt list[MAX_OPTS];
+            int n = options(list);
+            for(int i = 0; i < n; ++i) {
+                if(setsockopt(lfd, list[i].level, list[i].name, &list[i].value, sizeof(int)) == -1) {
+                    printf("sock_profile: %s=%d not applied: %s\n", list[i].label, list[i].value, strerror(errno));
+                }
+            }
+        }
+
+        // 每个新连接调用：第一次逐个比对是否从监听socket继承，之后只补没继承的选项
+        void on_accept(int fd) {
+            opt list[MAX_OPTS];
+            int n = options(list);
+            if(m_reapply == -1) {
+                m_reapply = 0;
+                for(int i = 0; i < n; ++i) {
+                    int got = 0;
+                    socklen_t len = sizeof(got);
+                    getsockopt(fd, list[i].level, list[i].name, &got, &len);
+                    // 内核保存的缓冲大小是设置值的两倍
+                    bool same = list[i].level == SOL_SOCKET && (list[i].name == SO_SNDBUF || list[i].name == SO_RCVBUF)
+                                ? got >= list[i].value : got == list[i].value;
+                    if(!same) {
+                        m_reapply |= 1 << i;
+                        printf("sock_profile: %s not inherited from listener, set per connection\n", list[i].label);
+                    }
+                }
+            }
+            for(int i = 0; i < n && m_reapply; ++i) {
+                if(m_reapply & (1 << i)) {
+                    setsockopt(fd, list[i].level, list[i].name, &list[i].value, sizeof(int));
+                }
+            }
+        }
+
+        void print(const char* name) const {
+            printf("%s: backlog %d nodelay %d cork %d sndbuf %d rcvbuf %d notsent_lowat %d busy_poll_us %d keepalive %d/%d/%d\n",
+                   name, backlog, nodelay, cork, sndbuf, rcvbuf, notsent_lowat, busy_poll_us,
+                   keepalive_idle, keepalive_intvl, keepalive_cnt);
+        }
+
+    private:
+        static const int MAX_OPTS = 10;
+        struct opt { int level; int name; int value; const char* label; };
+
+        // 需要设置的选项，保持默认值的不列出
+        int options(opt* list) const {
+            int n = 0;
+            if(nodelay) {
+                list[n++] = {IPPROTO_TCP, TCP_NODELAY, 1, "nodelay"};
+            }
+            if(sndbuf > 0) {
+                list[n++] = {SOL_SOCKET, SO_SNDBUF, sndbuf, "sndbuf"};
+            }
+            if(rcvbuf > 0) {
+                list[n++] = {SOL_SOCKET, SO_RCVBUF, rcvbuf, "rcvbuf"};
+            }
+            if(notsent_lowat > 0) {
+                list[n++] = {IPPROTO_TCP, TCP_NOTSENT_LOWAT, notsent_lowat, "notsent_lowat"};
+            }
+            if(busy_poll_us > 0) {
+                list[n++] = {SOL_SOCKET, SO_BUSY_POLL, busy_poll_us, "busy_poll_us"};
+            }
+            if(keepalive_idle > 0) {
+                list[n++] = {SOL_SOCKET, SO_KEEPALIVE, 1, "keepalive"};
+                list[n++] = {IPPROTO_TCP, TCP_KEEPIDLE, keepalive_idle, "keepalive_idle"};
+                list[n++] = {IPPROTO_TCP, TCP_KEEPINTVL, keepalive_intvl, "keepalive_intvl"};
+                list[n++] = {IPPROTO_TCP, TCP_KEEPCNT, keepalive_cnt, "keepalive_cnt"};
+            }
+            return n;
+        }
+
+        int m_reapply = -1; // 需要逐个连接补设的选项位图，-1表示还没检查过
+    };
+}
+
+#endif
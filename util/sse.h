@@ -0,0 +1,216 @@
+#ifndef SSE_H
+#define SSE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "fanout.h"
+
+// Server-Sent Events（text/event-stream）：订阅者发一个GET后连接一直开着，服务器按
+//   id: 7\nevent: name\ndata: 第一行\ndata: 第二行\n\n
+// 的格式往下推事件。和WebSocket的广播一样，一个事件只序列化一次，各订阅者的发送队列引用同一份
+namespace mirror {
+
+    // 序列化好的事件，最后一个发完的订阅者释放。发布可以在任何线程，之后的引用计数只在reactor线程上增减
+    class sse_event : public shared_chunk {
+    public:
+        // name为空时省略event行（浏览器按message处理）；name只取到第一个CR或LF，不能借它插进别的字段。
+        // data按行拆成多个data行，和浏览器一样把CRLF、LF、单独的CR都当作换行，否则裸CR后面的内容
+        // 会被客户端当成新的一行（比如伪造的event:或id:）
+        static sse_event* make(unsigned long long id, std::string_view name, std::string_view data) {
+            name = name.substr(0, std::min(name.find_first_of("\r\n"), name.size()));
+            size_t lines = 1;
+            for(char c : data) {
+                lines += c == '\n' || c == '\r';
+            }
+            size_t cap = 64 + name.size() + data.size() + lines * 7; // id和event行的开销加上每行"data: "和换行
+            sse_event* e = alloc<sse_event>(cap);
+            char* p = e->data();
+            size_t n = snprintf(p, cap, "id: %llu\n", id);
+            if(!name.empty()) {
+                n += snprintf(p + n, cap - n, "event: %.*s\n", (int)name.size(), name.data());
+            }
+            while(true) {
+                size_t end = std::min(data.find_first_of("\r\n"), data.size());
+                memcpy(p + n, "data: ", 6);
+                memcpy(p + n + 6, data.data(), end);
+                n += 6 + end;
+                p[n++] = '\n';
+                if(end == data.size()) {
+                    break;
+                }
+                bool crlf = data[end] == '\r' && end + 1 < data.size() && data[end + 1] == '\n';
+                data.remove_prefix(end + (crlf ? 2 : 1));
+            }
+            p[n++] = '\n';
+            e->set_size(n);
+            return e;
+        }
+
+        // 注释行，浏览器忽略；用作心跳，让中间的代理不因为没有数据而断开，也顺便发现对端已死
+        static sse_event* heartbeat() {
+            static const char beat[] = ": ping\n\n";
+            sse_event* e = alloc<sse_event>(sizeof(beat) - 1);
+            memcpy(e->data(), beat, sizeof(beat) - 1);
+            return e;
+        }
+    };
+
+    // 订阅者积压满时的处理
+    enum sse_slow_policy {
+        SSE_DROP_OLDEST = 0,   // 丢掉最旧的还没开始发的事件，客户端从id的跳号知道漏了
+        SSE_DISCONNECT         // 断开订阅者，客户端重连后从头订阅
+    };
+
+    // 一个订阅连接的发送队列：有上限的环形队列，元素是事件的引用
+    class sse_session : public fanout_queue {
+    public:
+        explicit sse_session(size_t max_queued) : fanout_queue(max_queued) {}
+
+        // 加入队列，调用者已经给e加过这次的引用。队列满时按policy丢掉最旧的事件腾地方，
+        // 或者返回false（引用仍归调用者）
+        bool push(sse_event* e, sse_slow_policy policy) {
+            if(full()) {
+                if(policy == SSE_DISCONNECT) {
+                    return false;
+                }
+                drop_oldest();
+                ++m_dropped;
+            }
+            return fanout_queue::push(e);
+        }
+
+        // 定时器到期时调用：上次心跳以来有数据积压却一个字节都没发出去，说明对方不再读了，返回false；
+        // 否则排一个心跳
+        bool heartbeat(sse_slow_policy policy) {
+            if(pending() && sent() == m_beat_mark) {
+                return false;
+            }
+            m_beat_mark = sent();
+            sse_event* e = sse_event::heartbeat();
+            if(!push(e, policy)) {
+                e->unref();
+                return false;
+            }
+            return true;
+        }
+
+        unsigned long long dropped() const { return m_dropped; }
+
+        bool aborted = false;  // 已因积压被断开，等事件循环关闭，不再往里放事件
+
+    private:
+        unsigned long long m_beat_mark = 0; // 上次心跳时的sent()
+        unsigned long long m_dropped = 0;
+    };
+
+    struct sse_stats {
+        unsigned long long published = 0;     // 发布的事件数
+        unsigned long long deliveries = 0;    // 挂到订阅者队列上的次数
+        unsigned long long dropped = 0;       // 因订阅者积压而丢掉的事件数
+        unsigned long long disconnected = 0;  // 因积压被断开的订阅者数
+    };
+
+    // 一个事件频道。publish可以在任何线程调用（比如线程池上执行的接口处理器）：事件在调用线程上序列化好，
+    // 放进加锁的收件箱；主循环每轮flush时取出，把同一个事件的引用挂到各订阅者的队列上，
+    // 再对每个有新数据的订阅者做一次writev，同一轮里的多个事件合在一起发。
+    // conn需要提供 sse_session* sse()、int sse_flush()（1发完，0发送缓冲满，-1出错）和 void sse_abort()
+    template<typename conn>
+    struct sse_access {
+        static sse_session* queue(conn* c) { return c->sse(); }
+        static int flush(conn* c) { return c->sse_flush(); }
+        static void abort(conn* c) { c->sse_abort(); }
+    };
+
+    template<typename conn>
+    class sse_hub : public fanout_hub<conn, sse_access<conn>> {
+    public:
+        sse_hub(const char* path, size_t max_queued, sse_slow_policy policy)
+            : m_path(path), m_max_queued(max_queued), m_policy(policy) {}
+        ~sse_hub() {
+            for(sse_event* e : m_inbox) {
+                e->unref();
+            }
+        }
+
+        const char* path() const { return m_path; }
+        size_t max_queued() const { return m_max_queued; }
+        sse_slow_policy policy() const { return m_policy; }
+        void set_policy(sse_slow_policy policy, size_t max_queued) {
+            m_policy = policy;
+            m_max_queued = max_queued;
+        }
+
+        // join、leave、mark和flush只在reactor线程上调用
+
+        // 主循环每轮调用一次
+        void flush() {
+            if(m_pending.load(std::memory_order_acquire)) {
+                std::vector<sse_event*> inbox;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    inbox.swap(m_inbox);
+                    m_pending.store(false, std::memory_order_relaxed);
+                }
+                for(sse_event* e : inbox) {
+                    fan_out(e);
+                }
+            }
+            fanout_hub<conn, sse_access<conn>>::flush();
+        }
+
+        // 发布一个事件，返回分配的id。在下一次flush时发给当时的所有订阅者
+        unsigned long long publish(std::string_view name, std::string_view data) {
+            unsigned long long id = m_next_id.fetch_add(1, std::memory_order_relaxed);
+            sse_event* e = sse_event::make(id, name, data);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_inbox.push_back(e);
+            m_pending.store(true, std::memory_order_release);
+            return id;
+        }
+
+        // 只在reactor线程上读
+        const sse_stats& stats() const { return m_stats; }
+
+    private:
+        void fan_out(sse_event* e) {
+            e->ref(this->m_subs.size());
+            for(conn* c : this->m_subs) {
+                sse_session* s = c->sse();
+                unsigned long long before = s->dropped();
+                if(s->aborted || !s->push(e, m_policy)) {
+                    e->unref();
+                    if(!s->aborted) {
+                        s->aborted = true;
+                        ++m_stats.disconnected;
+                        c->sse_abort(); // 积压太多，断开这个订阅者，连接由事件循环关闭
+                    }
+                    continue;
+                }
+                m_stats.dropped += s->dropped() - before;
+                this->mark(c);
+            }
+            e->unref();
+            ++m_stats.published;
+            m_stats.deliveries += this->m_subs.size();
+        }
+
+        const char* m_path;
+        size_t m_max_queued;
+        sse_slow_policy m_policy;
+        std::mutex m_mutex;
+        std::vector<sse_event*> m_inbox;      // 已发布、还没有发给订阅者的事件，受m_mutex保护
+        std::atomic<bool> m_pending{false};   // 收件箱非空，主循环没有新事件时不用加锁
+        std::atomic<unsigned long long> m_next_id{1};
+        sse_stats m_stats;
+    };
+}
+
+#endif
@@ -7,72 +7,564 @@
 
 #include <thread>
 #include <vector>
-#include <queue>
+#include <deque>
+#include <unordered_map>
 #include <mutex>
 #include <semaphore>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace mirror {
 
     const int MAX_REQUESTS = 10000;
 
-    template<typename taskType>
+    // 优先级队列：工作线程按出队策略从各队列取任务，默认按权重轮流，大文件堆积时小请求仍能按比例得到线程
+    enum pool_lane {
+        LANE_FAST,   // 管理入口等需要尽快回答的请求
+        LANE_NORMAL, // 一般请求
+        LANE_BULK,   // 读文件系统的大响应、缓存填充、压缩等后台工作
+        LANE_NUM
+    };
+
+    // 类型擦除的小任务：可调用对象不超过INLINE_SIZE字节时直接放在对象内部，入队不分配堆内存；
+    // 捕获更多东西的lambda编译不过，需要时改成捕获一个指针
+    class small_task {
+    public:
+        static const size_t INLINE_SIZE = 48;
+
+        small_task() : m_ops(nullptr) {}
+        template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, small_task>>>
+        small_task(F&& f) {
+            using fn = std::decay_t<F>;
+            static_assert(sizeof(fn) <= INLINE_SIZE && alignof(fn) <= alignof(std::max_align_t),
+                          "small_task: capture too large, capture a pointer instead");
+            static_assert(std::is_nothrow_move_constructible_v<fn>, "small_task: callable must be nothrow movable");
+            new (m_buf) fn(std::forward<F>(f));
+            m_ops = &ops_of<fn>::ops;
+        }
+        small_task(small_task&& other) noexcept : m_ops(other.m_ops) {
+            if(m_ops) {
+                m_ops->move(m_buf, other.m_buf);
+                other.m_ops = nullptr;
+            }
+        }
+        small_task& operator=(small_task&& other) noexcept {
+            if(this != &other) {
+                reset();
+                m_ops = other.m_ops;
+                if(m_ops) {
+                    m_ops->move(m_buf, other.m_buf);
+                    other.m_ops = nullptr;
+                }
+            }
+            return *this;
+        }
+        ~small_task() { reset(); }
+
+        explicit operator bool() const { return m_ops != nullptr; }
+        void operator()() { m_ops->call(m_buf); }
+        void reset() {
+            if(m_ops) {
+                m_ops->destroy(m_buf);
+                m_ops = nullptr;
+            }
+        }
+
+    private:
+        struct ops_table {
+            void (*call)(void*);
+            void (*move)(void* dst, void* src); // 移动构造到dst并析构src
+            void (*destroy)(void*);
+        };
+        template<typename fn>
+        struct ops_of {
+            static void call(void* p) { (*static_cast<fn*>(p))(); }
+            static void move(void* dst, void* src) {
+                new (dst) fn(std::move(*static_cast<fn*>(src)));
+                static_cast<fn*>(src)->~fn();
+            }
+            static void destroy(void* p) { static_cast<fn*>(p)->~fn(); }
+            static constexpr ops_table ops = {call, move, destroy};
+        };
+
+        alignas(std::max_align_t) unsigned char m_buf[INLINE_SIZE];
+        const ops_table* m_ops;
+    };
+
+    // 一个采样周期内线程池的运行情况，交给伸缩策略做决定
+    struct pool_sample {
+        unsigned int threads;     // 当前线程数
+        unsigned int min_threads;
+        unsigned int max_threads;
+        size_t queue_len;         // 采样时刻排队的任务数
+        double avg_wait_us;       // 本周期出队任务的平均排队时间
+        double utilization;       // 本周期工作线程忙碌时间占比 [0, 1]
+    };
+
+    // 对外暴露的统计信息
+    struct pool_stats {
+        unsigned int threads;
+        size_t queue_len;
+        size_t lane_len[LANE_NUM];        // 各队列排队的任务数
+        double avg_wait_us;
+        double lane_wait_us[LANE_NUM];    // 各队列出队任务的平均排队时间
+        double utilization;
+        unsigned long quota_waits;        // 因为同一客户端占满配额而暂缓的次数
+        unsigned long stale_tasks;        // 排队期间连接已关闭（槽位可能已被新连接复用）而丢弃的任务
+        unsigned long grows;
+        unsigned long shrinks;
+        int last_decision;        // 最近一次策略给出的线程数变化量
+    };
+
+    // 默认伸缩策略：排队时间超过目标且线程都很忙时扩容（阻塞在缺页等操作上的线程也算忙），
+    // 排队时间很短且利用率低时缩容。返回值为线程数变化量。
+    struct queue_latency_policy {
+        double target_wait_us = 1000;
+        double grow_utilization = 0.75;
+        double shrink_utilization = 0.25;
+
+        int decide(const pool_sample& s) const {
+            if(s.avg_wait_us > target_wait_us && s.utilization > grow_utilization) {
+                // 落后得越多一次扩得越多，最多翻倍
+                int step = std::max(1, (int)(s.threads * std::min(1.0, s.avg_wait_us / target_wait_us - 1)));
+                return step;
+            }
+            if(s.avg_wait_us < target_wait_us / 4 && s.utilization < shrink_utilization && s.queue_len == 0) {
+                return -1;
+            }
+            return 0;
+        }
+    };
+
+    // 固定大小，不做伸缩
+    struct fixed_size_policy {
+        int decide(const pool_sample&) const { return 0; }
+    };
+
+    // 出队策略：在有可取任务的队列里选一个。ready[l]表示队列l有可取的任务，front[l]是它队头的入队时间。
+    // 调用时持有线程池的mutex
+
+    // 默认：平滑加权轮询（同nginx的upstream）。每次给有任务的队列加上各自的权重，取当前值最大的，
+    // 再减去这一轮的权重和；权重8:4:1时13次里三个队列各轮到8、4、1次，且交错出现
+    struct swrr_lanes {
+        unsigned int weights[LANE_NUM] = {8, 4, 1};
+        int credits[LANE_NUM] = {};
+
+        void set_weights(const unsigned int w[LANE_NUM]) {
+            for(int l = 0; l < LANE_NUM; ++l) {
+                weights[l] = std::max(1u, w[l]);
+            }
+            std::fill(credits, credits + LANE_NUM, 0);
+        }
+
+        int choose(const bool ready[LANE_NUM], const std::chrono::steady_clock::time_point[LANE_NUM]) {
+            int best = -1;
+            int total = 0;
+            for(int l = 0; l < LANE_NUM; ++l) {
+                if(!ready[l]) {
+                    continue;
+                }
+                credits[l] += weights[l];
+                total += weights[l];
+                if(best == -1 || credits[l] > credits[best]) {
+                    best = l;
+                }
+            }
+            if(best != -1) {
+                credits[best] -= total;
+            }
+            return best;
+        }
+    };
+
+    // 不分优先级：所有队列合起来按入队先后出队，相当于一个加锁的deque，权重不起作用。
+    // 用来和加权轮询对比：大文件堆积时小请求要排在它们后面
+    struct fifo_lanes {
+        void set_weights(const unsigned int[LANE_NUM]) {}
+
+        int choose(const bool ready[LANE_NUM], const std::chrono::steady_clock::time_point front[LANE_NUM]) {
+            int best = -1;
+            for(int l = 0; l < LANE_NUM; ++l) {
+                if(ready[l] && (best == -1 || front[l] < front[best])) {
+                    best = l;
+                }
+            }
+            return best;
+        }
+    };
+
+    template<typename taskType, typename sizingPolicy = queue_latency_policy, typename queuePolicy = swrr_lanes>
     class thread_pool{
     public:
-        explicit thread_pool(unsigned int num = std::thread::hardware_concurrency());
+        explicit thread_pool(unsigned int min_num = std::thread::hardware_concurrency(),
+                             unsigned int max_num = 4 * std::thread::hardware_concurrency(),
+                             sizingPolicy policy = sizingPolicy(),
+                             std::chrono::milliseconds interval = std::chrono::milliseconds(100));
         ~thread_pool();
-        bool append(taskType* task);
+        // key标识任务所属的客户端，同一个非0 key同时最多占用quota个线程，0表示不受配额限制。
+        // handle是入队时连接的句柄（见conn_handle），任务类型提供is_current时，出队后句柄已过期的任务直接丢弃
+        bool append(taskType* task, pool_lane lane = LANE_NORMAL, uint64_t key = 0, uint64_t handle = 0);
+        bool submit(small_task fn, pool_lane lane = LANE_BULK, uint64_t key = 0);
+        void set_weights(unsigned int fast, unsigned int normal, unsigned int bulk);
+        void set_quota(unsigned int n);
+        unsigned int size() const { return alive.load(std::memory_order_relaxed); }
+        pool_stats stats() const;
     private:
+        struct queued_task {
+            taskType* task;  // 为空时执行fn
+            small_task fn;
+            uint64_t key;
+            uint64_t handle;
+            std::chrono::steady_clock::time_point enqueue_time;
+        };
+
+        static bool current(taskType* task, uint64_t handle) {
+            if constexpr (requires { task->is_current(handle); }) {
+                return handle == 0 || task->is_current(handle);
+            }
+            return true;
+        }
+
+        bool push(queued_task&& item, pool_lane lane);
+        bool pick(queued_task& out);
+        void unhold(uint64_t key);
+        void spawn();
+        void worker();
+        void monitor();
+        static long long now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
         bool stop;
         int max_task_num;
+        unsigned int min_threads;
+        unsigned int max_threads;
         std::vector<std::thread> threads;
-        std::queue<taskType*> task_queue;
+        std::vector<std::thread::id> retired; //已退出、等待回收的线程
+        std::deque<queued_task> lanes[LANE_NUM];
+        size_t queued;                   //各队列加上held里的任务总数
+        queuePolicy queue_policy;        //从哪个队列取下一个任务
+        unsigned int quota;              //同一key同时占用的线程上限，0不限
+        std::unordered_map<uint64_t, unsigned int> running; //各key正在执行的任务数
+        //占满配额的key排到队头的任务先移到这里，不挡住后面别的客户端；它有任务结束时再放回原队列的队头
+        std::unordered_map<uint64_t, std::deque<std::pair<pool_lane, queued_task>>> held;
+        unsigned int parked;             //所有可取的任务都受配额限制，等别的任务结束的线程数
+        std::condition_variable quota_cv;
+        unsigned long quota_waits;
+        std::atomic<unsigned long> stale_tasks;
 
         std::mutex mutex;
         std::counting_semaphore<MAX_REQUESTS> sem;
+
+        // 伸缩相关
+        sizingPolicy policy;
+        std::chrono::milliseconds interval;
+        std::thread monitor_thread;
+        std::condition_variable monitor_cv;
+        std::atomic<unsigned int> alive;
+        unsigned int to_retire; //等待退出的线程数，受mutex保护
+        std::atomic<long long> wait_ns_sum;
+        std::atomic<long long> wait_cnt;
+        std::atomic<long long> lane_wait_ns[LANE_NUM];
+        std::atomic<long long> lane_wait_cnt[LANE_NUM];
+        std::atomic<long long> busy_ns_sum;
+        pool_stats last_stats;
+        mutable std::mutex stats_mutex;
     };
 
-    template<typename taskType>
-    bool thread_pool<taskType>::append(taskType *task) {
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    bool thread_pool<taskType, sizingPolicy, queuePolicy>::append(taskType *task, pool_lane lane, uint64_t key, uint64_t handle) {
+        return push({task, small_task(), key, handle, std::chrono::steady_clock::now()}, lane);
+    }
+
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    bool thread_pool<taskType, sizingPolicy, queuePolicy>::submit(small_task fn, pool_lane lane, uint64_t key) {
+        return push({nullptr, std::move(fn), key, 0, std::chrono::steady_clock::now()}, lane);
+    }
+
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    bool thread_pool<taskType, sizingPolicy, queuePolicy>::push(queued_task&& item, pool_lane lane) {
         {
             std::lock_guard<std::mutex> lock(mutex);
-            if (task_queue.size() == max_task_num) {
-                mutex.unlock();
+            if (queued >= (size_t)max_task_num) {
                 return false;
             }
-            task_queue.push(task);
+            lanes[lane].push_back(std::move(item));
+            ++queued;
+            if(parked > 0) {
+                quota_cv.notify_one(); //新任务可能不受配额限制，叫醒一个等着的线程来取
+            }
         }
         sem.release();
         return true;
     }
 
-    template<typename taskType>
-    thread_pool<taskType>::~thread_pool() {
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    void thread_pool<taskType, sizingPolicy, queuePolicy>::set_weights(unsigned int fast, unsigned int normal, unsigned int bulk) {
+        std::lock_guard<std::mutex> lock(mutex);
+        unsigned int w[LANE_NUM];
+        w[LANE_FAST] = fast;
+        w[LANE_NORMAL] = normal;
+        w[LANE_BULK] = bulk;
+        queue_policy.set_weights(w);
+    }
+
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    void thread_pool<taskType, sizingPolicy, queuePolicy>::set_quota(unsigned int n) {
+        std::lock_guard<std::mutex> lock(mutex);
+        quota = n;
+        while(!held.empty()) {
+            unhold(held.begin()->first);
+        }
+        quota_cv.notify_all();
+    }
+
+    // 调用者需持有mutex。把key被搁置的第一个任务放回它原来队列的队头
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    void thread_pool<taskType, sizingPolicy, queuePolicy>::unhold(uint64_t key) {
+        auto h = held.find(key);
+        if(h == held.end()) {
+            return;
+        }
+        lanes[h->second.front().first].push_front(std::move(h->second.front().second));
+        h->second.pop_front();
+        if(h->second.empty()) {
+            held.erase(h);
+        }
+    }
+
+    // 调用者需持有mutex。由出队策略在有任务的队列里选一个；
+    // 队头任务所属的key占满配额时先移到held，每个任务最多移一次；都不可取返回false
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    bool thread_pool<taskType, sizingPolicy, queuePolicy>::pick(queued_task& out) {
+        bool ready[LANE_NUM];
+        std::chrono::steady_clock::time_point front[LANE_NUM];
+        for(int l = 0; l < LANE_NUM; ++l) {
+            auto& lane = lanes[l];
+            while(quota && !lane.empty() && lane.front().key) {
+                auto r = running.find(lane.front().key);
+                if(r == running.end() || r->second < quota) {
+                    break;
+                }
+                held[lane.front().key].emplace_back((pool_lane)l, std::move(lane.front()));
+                lane.pop_front();
+            }
+            ready[l] = !lane.empty();
+            if(ready[l]) {
+                front[l] = lane.front().enqueue_time;
+            }
+        }
+        int best = queue_policy.choose(ready, front);
+        if(best == -1) {
+            return false;
+        }
+        out = std::move(lanes[best].front());
+        lanes[best].pop_front();
+        --queued;
+        if(quota && out.key) {
+            ++running[out.key];
+        }
+        out.key = quota && out.key ? out.key : 0; //开始执行后才改的配额不影响这个任务的计数
+        lane_wait_cnt[best].fetch_add(1, std::memory_order_relaxed);
+        lane_wait_ns[best].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - out.enqueue_time).count(), std::memory_order_relaxed);
+        return true;
+    }
+
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    pool_stats thread_pool<taskType, sizingPolicy, queuePolicy>::stats() const {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        return last_stats;
+    }
+
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    thread_pool<taskType, sizingPolicy, queuePolicy>::~thread_pool() {
         {
             std::lock_guard<std::mutex> lock(mutex);
             stop = true;
         }
+        monitor_cv.notify_all();
+        quota_cv.notify_all();
+        monitor_thread.join();
+        //唤醒所有阻塞在信号量上的线程，让它们看到stop
+        for(size_t i = 0; i < threads.size(); ++i) {
+            sem.release();
+        }
         for(auto& thread : threads) {
             //必须引用，不能复制
             thread.join();
         }
     }
 
-    template<typename taskType>
-    thread_pool<taskType>::thread_pool(unsigned int num) :stop(false), max_task_num(MAX_REQUESTS), sem(std::counting_semaphore<MAX_REQUESTS>(0)){
-        for(int i = 0; i < num; ++i) {
-            threads.emplace_back([this]{
-                while(!stop || !task_queue.empty()) {
-                    taskType* task;
-                    {
-                        sem.acquire();
-                        std::unique_lock<std::mutex> lock(mutex);
-                        if(stop && task_queue.empty()) return;
-                        task = task_queue.front();
-                        task_queue.pop();
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    thread_pool<taskType, sizingPolicy, queuePolicy>::thread_pool(unsigned int min_num, unsigned int max_num,
+                                                     sizingPolicy policy, std::chrono::milliseconds interval)
+            :stop(false), max_task_num(MAX_REQUESTS),
+             min_threads(std::max(1u, min_num)), max_threads(std::max(std::max(1u, min_num), max_num)),
+             queued(0), queue_policy(), quota(0), parked(0), quota_waits(0), stale_tasks(0),
+             sem(0), policy(policy), interval(interval), alive(0), to_retire(0),
+             wait_ns_sum(0), wait_cnt(0), lane_wait_ns{}, lane_wait_cnt{}, busy_ns_sum(0), last_stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(unsigned int i = 0; i < min_threads; ++i) {
+            spawn();
+        }
+        last_stats.threads = min_threads;
+        monitor_thread = std::thread([this]{ monitor(); });
+    }
+
+    // 调用者需持有mutex
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    void thread_pool<taskType, sizingPolicy, queuePolicy>::spawn() {
+        threads.emplace_back([this]{ worker(); });
+        alive.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    void thread_pool<taskType, sizingPolicy, queuePolicy>::worker() {
+        while(true) {
+            queued_task item;
+            {
+                sem.acquire();
+                std::unique_lock<std::mutex> lock(mutex);
+                if(stop && queued == 0) return;
+                if(to_retire > 0 && queued == 0) {
+                    //缩容：这个信号量是monitor为退出而释放的
+                    --to_retire;
+                    alive.fetch_sub(1, std::memory_order_relaxed);
+                    retired.push_back(std::this_thread::get_id());
+                    return;
+                }
+                if(queued == 0) continue;
+                if(!pick(item)) {
+                    //剩下的任务都属于占满配额的客户端，等它们有任务结束或来了新任务再取。
+                    //不可能所有线程都停在这里：占着配额的任务正在别的线程上执行
+                    ++quota_waits;
+                    ++parked;
+                    quota_cv.wait(lock, [&]{ return pick(item); });
+                    --parked;
+                }
+            }
+            long long start = now_ns();
+            wait_ns_sum.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - item.enqueue_time).count(), std::memory_order_relaxed);
+            wait_cnt.fetch_add(1, std::memory_order_relaxed);
+            if(item.task) {
+                if(current(item.task, item.handle)) {
+                    item.task->process();
+                }
+                else {
+                    stale_tasks.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            else {
+                item.fn();
+                item.fn.reset(); //捕获的资源在这里释放，而不是等下一个任务覆盖
+            }
+            busy_ns_sum.fetch_add(now_ns() - start, std::memory_order_relaxed);
+            if(item.key) {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto r = running.find(item.key);
+                if(--r->second == 0) {
+                    running.erase(r);
+                }
+                unhold(item.key);
+                if(parked > 0) {
+                    quota_cv.notify_one();
+                }
+            }
+        }
+    }
+
+    // 周期性采样排队时间与利用率，按策略增减线程
+    template<typename taskType, typename sizingPolicy, typename queuePolicy>
+    void thread_pool<taskType, sizingPolicy, queuePolicy>::monitor() {
+        unsigned long grows = 0, shrinks = 0;
+        long long last = now_ns();
+        std::unique_lock<std::mutex> lock(mutex);
+        while(!stop) {
+            monitor_cv.wait_for(lock, interval);
+            if(stop) break;
+
+            //回收已经退出的线程
+            for(auto id : retired) {
+                auto it = std::find_if(threads.begin(), threads.end(),
+                                       [id](const std::thread& t){ return t.get_id() == id; });
+                if(it != threads.end()) {
+                    it->join();
+                    threads.erase(it);
+                }
+            }
+            retired.clear();
+
+            long long cur = now_ns();
+            long long waits = wait_cnt.exchange(0, std::memory_order_relaxed);
+            long long wait_ns = wait_ns_sum.exchange(0, std::memory_order_relaxed);
+            long long busy_ns = busy_ns_sum.exchange(0, std::memory_order_relaxed);
+            unsigned int n = alive.load(std::memory_order_relaxed) - to_retire;
+
+            pool_sample s;
+            s.threads = n;
+            s.min_threads = min_threads;
+            s.max_threads = max_threads;
+            s.queue_len = queued;
+            s.avg_wait_us = waits ? wait_ns / 1000.0 / waits : 0;
+            s.utilization = std::min(1.0, (double)busy_ns / ((double)(cur - last) * std::max(1u, n)));
+            last = cur;
+            //队列积压但没有任务出队（所有线程都卡住了），按最老任务的等待时间算
+            if(waits == 0 && queued > 0) {
+                auto oldest = std::chrono::steady_clock::now();
+                for(auto& lane : lanes) {
+                    if(!lane.empty()) {
+                        oldest = std::min(oldest, lane.front().enqueue_time);
                     }
-                    task->process();
                 }
-            });
+                s.avg_wait_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - oldest).count();
+                s.utilization = 1.0;
+            }
+
+            int delta = policy.decide(s);
+            int target = std::clamp((int)n + delta, (int)min_threads, (int)max_threads);
+            delta = target - (int)n;
+            if(delta > 0) {
+                for(int i = 0; i < delta; ++i) {
+                    spawn();
+                }
+                ++grows;
+                printf("thread pool grow %u -> %d (wait %.0fus, util %.2f)\n", n, target, s.avg_wait_us, s.utilization);
+            }
+            else if(delta < 0) {
+                to_retire += -delta;
+                sem.release(-delta);
+                ++shrinks;
+                printf("thread pool shrink %u -> %d (wait %.0fus, util %.2f)\n", n, target, s.avg_wait_us, s.utilization);
+            }
+
+            std::lock_guard<std::mutex> stats_lock(stats_mutex);
+            last_stats.threads = target;
+            last_stats.queue_len = s.queue_len;
+            last_stats.avg_wait_us = s.avg_wait_us;
+            for(int l = 0; l < LANE_NUM; ++l) {
+                long long cnt = lane_wait_cnt[l].exchange(0, std::memory_order_relaxed);
+                long long ns = lane_wait_ns[l].exchange(0, std::memory_order_relaxed);
+                last_stats.lane_len[l] = lanes[l].size();
+                last_stats.lane_wait_us[l] = cnt ? ns / 1000.0 / cnt : 0;
+            }
+            last_stats.quota_waits = quota_waits;
+            last_stats.stale_tasks = stale_tasks.load(std::memory_order_relaxed);
+            last_stats.utilization = s.utilization;
+            last_stats.grows = grows;
+            last_stats.shrinks = shrinks;
+            last_stats.last_decision = delta;
         }
     }
 }
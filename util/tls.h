@@ -0,0 +1,85 @@
+#ifndef TLS_H
+#define TLS_H
+
+// HTTPS 终结：握手由 OpenSSL 完成，握手后如果内核支持 kTLS（TLS_TX/TLS_RX），
+// OpenSSL 会通过 setsockopt 把记录层加解密交给内核，之后连接上的 recv/writev
+// 与明文连接完全一样，mmap 的文件体仍然是零拷贝发送。内核不支持时退回用户态 SSL_read/SSL_write。
+#ifdef WITH_TLS
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+
+namespace mirror {
+
+    // ALPN：客户端支持 h2 时优先选 h2，否则 http/1.1
+    inline int tls_alpn_select(SSL*, const unsigned char** out, unsigned char* outlen,
+                               const unsigned char* in, unsigned int inlen, void*) {
+        static const unsigned char protos[] = "\x02h2\x08http/1.1";
+        if(SSL_select_next_proto((unsigned char**)out, outlen, protos, sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+            return SSL_TLSEXT_ERR_NOACK;
+        }
+        return SSL_TLSEXT_ERR_OK;
+    }
+
+    inline bool tls_alpn_is_h2(SSL* ssl) {
+        const unsigned char* proto = nullptr;
+        unsigned int len = 0;
+        SSL_get0_alpn_selected(ssl, &proto, &len);
+        return len == 2 && memcmp(proto, "h2", 2) == 0;
+    }
+
+    // 创建服务端 SSL_CTX：开启 kTLS、会话票据与服务端会话缓存，失败直接退出
+    inline SSL_CTX* tls_ctx_init(const char* cert_file, const char* key_file) {
+        SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+        if(!ctx) {
+            ERR_print_errors_fp(stderr);
+            exit(-1);
+        }
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+        // 用户态加密时允许部分写，并允许重试时缓冲区地址变化（m_iv会前移）
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+        // 会话复用：TLS1.3 每次握手发一张票据，TLS1.2 同时保留服务端缓存
+        static const unsigned char sid_ctx[] = "tinywebserver";
+        SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, 20480);
+        SSL_CTX_set_num_tickets(ctx, 1);
+        SSL_CTX_set_alpn_select_cb(ctx, tls_alpn_select, nullptr);
+
+        if(SSL_CTX_use_certificate_chain_file(ctx, cert_file) <= 0 ||
+           SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) <= 0 ||
+           !SSL_CTX_check_private_key(ctx)) {
+            ERR_print_errors_fp(stderr);
+            exit(-1);
+        }
+        return ctx;
+    }
+
+    // 握手完成后查询是否已经由内核接管收发
+    inline bool tls_ktls_send(SSL* ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+        return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+        return false;
+#endif
+    }
+
+    inline bool tls_ktls_recv(SSL* ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+        return BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#else
+        return false;
+#endif
+    }
+}
+
+#endif
+
+#endif
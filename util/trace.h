@@ -0,0 +1,233 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+// 有systemtap的头文件时生成USDT探针，perf/bpftrace可以挂在
+// tinywebserver:stage_begin / stage_end / stage_mark 上（参数：阶段、fd），没有时为空操作
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, stage, fd) DTRACE_PROBE2(tinywebserver, name, stage, fd)
+#endif
+#endif
+#ifndef TRACE_PROBE
+#define TRACE_PROBE(name, stage, fd) ((void)(stage), (void)(fd))
+#endif
+
+// 按请求的分阶段追踪：按采样率选中的请求在每个阶段记录开始时间和耗时，写进线程自己的环形缓冲，
+// 收到SIGUSR1或者本机访问/__trace时把所有线程的记录导出成Chrome trace JSON，
+// 可以直接拖进chrome://tracing或Perfetto查看一个请求在各线程上的时间线。
+namespace mirror {
+namespace trace {
+
+    enum stage : uint16_t {ACCEPT, TLS_HANDSHAKE, READ, ENQUEUE, DEQUEUE, PROCESS_READ, DO_REQUEST, PROCESS_WRITE, WRITEV, DONE, STAGE_COUNT};
+    inline const char* stage_name(int s) {
+        static const char* names[STAGE_COUNT] = {"accept", "tls_handshake", "read", "enqueue", "dequeue", "process_read",
+                                                 "do_request", "process_write", "writev", "done"};
+        return names[s];
+    }
+
+    const size_t RING_SIZE = 1 << 14; // 每个线程保留的最近事件数
+
+    struct event {
+        uint64_t ts_ns;
+        uint32_t dur_ns;  // 0表示瞬时事件
+        uint16_t stage;
+        uint32_t req;
+        int32_t fd;
+        int64_t arg;      // 读写的字节数等
+    };
+
+    // 单写者环：只有所属线程写，导出时按head判断哪些记录在复制过程中被覆盖了。
+    // 线程退出后环留给下一个新线程接着写，owners按序记下每个写者从第几条开始写（受rings_mutex保护）
+    struct ring {
+        std::vector<std::pair<uint64_t, pid_t>> owners;
+        std::atomic<uint64_t> head{0};
+        event events[RING_SIZE];
+    };
+
+    inline std::atomic<uint32_t>& sample_every() { static std::atomic<uint32_t> v{0}; return v; }
+    inline std::atomic<uint32_t>& next_id() { static std::atomic<uint32_t> v{1}; return v; }
+    inline std::mutex& rings_mutex() { static std::mutex m; return m; }
+    inline std::vector<ring*>& rings() { static std::vector<ring*> v; return v; }
+    inline std::vector<ring*>& free_rings() { static std::vector<ring*> v; return v; } // 线程已退出、等待复用的环
+
+    // 每N个请求追踪一个，0关闭
+    inline void set_sampling(uint32_t every) { sample_every().store(every, std::memory_order_relaxed); }
+
+    // 新请求开始时调用：被采样返回非0的请求号
+    inline uint32_t sample() {
+        uint32_t every = sample_every().load(std::memory_order_relaxed);
+        if(every == 0) {
+            return 0;
+        }
+        thread_local uint32_t counter = 0;
+        if(++counter % every != 0) {
+            return 0;
+        }
+        uint32_t id = next_id().fetch_add(1, std::memory_order_relaxed);
+        return id ? id : next_id().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline uint64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // 线程第一次记录时取一个环：优先复用已退出线程留下的，没有才分配并登记。环不释放（导出时还要读），
+    // 线程池反复创建销毁线程时环的个数只等于同时存活过的线程数的峰值
+    inline ring* local_ring() {
+        struct owner {
+            ring* r = nullptr;
+            ~owner() {
+                if(r) {
+                    std::lock_guard<std::mutex> lock(rings_mutex());
+                    free_rings().push_back(r);
+                }
+            }
+        };
+        thread_local owner self;
+        if(!self.r) {
+            pid_t tid = syscall(SYS_gettid);
+            std::lock_guard<std::mutex> lock(rings_mutex());
+            if(free_rings().empty()) {
+                self.r = new ring;
+                rings().push_back(self.r);
+            } else {
+                self.r = free_rings().back();
+                free_rings().pop_back();
+            }
+            // 记录已经全部被覆盖的旧写者不用再留
+            auto& owners = self.r->owners;
+            uint64_t h = self.r->head.load(std::memory_order_relaxed);
+            while(owners.size() > 1 && owners[1].first + RING_SIZE <= h) {
+                owners.erase(owners.begin());
+            }
+            owners.emplace_back(h, tid);
+        }
+        return self.r;
+    }
+
+    inline void record(uint32_t req, stage s, int fd, uint64_t ts_ns, uint32_t dur_ns, int64_t arg) {
+        ring* r = local_ring();
+        uint64_t h = r->head.load(std::memory_order_relaxed);
+        r->events[h & (RING_SIZE - 1)] = event{ts_ns, dur_ns, s, req, fd, arg};
+        r->head.store(h + 1, std::memory_order_release);
+    }
+
+    // 瞬时事件，如accept、入队
+    inline void mark(uint32_t req, stage s, int fd, int64_t arg = 0) {
+        TRACE_PROBE(stage_mark, s, fd);
+        if(req) {
+            record(req, s, fd, now_ns(), 0, arg);
+        }
+    }
+
+    // 作用域内的阶段，析构时记录耗时
+    class scope {
+    public:
+        scope(uint32_t req, stage s, int fd) : m_req(req), m_stage(s), m_fd(fd), m_arg(0) {
+            TRACE_PROBE(stage_begin, s, fd);
+            m_begin = req ? now_ns() : 0;
+        }
+        ~scope() {
+            TRACE_PROBE(stage_end, m_stage, m_fd);
+            if(m_req) {
+                record(m_req, m_stage, m_fd, m_begin, std::max<uint64_t>(now_ns() - m_begin, 1), m_arg);
+            }
+        }
+        void set_arg(int64_t arg) { m_arg = arg; }
+    private:
+        uint32_t m_req;
+        stage m_stage;
+        int m_fd;
+        int64_t m_arg;
+        uint64_t m_begin;
+    };
+
+    // 把所有线程环里的记录写成Chrome trace JSON，返回写出的事件数
+    inline size_t dump(FILE* fp) {
+        std::vector<ring*> all;
+        std::vector<std::vector<std::pair<uint64_t, pid_t>>> owners;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex());
+            all = rings();
+            for(ring* r : all) {
+                owners.push_back(r->owners);
+            }
+        }
+        pid_t pid = getpid();
+        size_t written = 0;
+        std::vector<event> copy;
+        fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        for(size_t k = 0; k < all.size(); ++k) {
+            ring* r = all[k];
+            uint64_t end = r->head.load(std::memory_order_acquire);
+            uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+            copy.clear();
+            for(uint64_t i = begin; i < end; ++i) {
+                copy.push_back(r->events[i & (RING_SIZE - 1)]);
+            }
+            // 复制期间写者可能已经绕回来覆盖了最旧的几条（包括正在写的那一条），丢掉它们
+            uint64_t now = r->head.load(std::memory_order_acquire);
+            uint64_t valid_from = now >= RING_SIZE ? now - RING_SIZE + 1 : 0;
+            size_t skip = valid_from > begin ? std::min<uint64_t>(valid_from - begin, copy.size()) : 0;
+            size_t owner = 0;
+            for(size_t i = skip; i < copy.size(); ++i) {
+                const event& e = copy[i];
+                // 快照之后才登记的新写者不在owners里，它的记录这一次会被算到上一个写者名下
+                while(owner + 1 < owners[k].size() && owners[k][owner + 1].first <= begin + i) {
+                    ++owner;
+                }
+                pid_t etid = owners[k][owner].second;
+                fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"req\",\"ph\":\"%s\",\"ts\":%.3f,",
+                        written ? ",\n" : "", stage_name(e.stage), e.dur_ns ? "X" : "i", e.ts_ns / 1000.0);
+                if(e.dur_ns) {
+                    fprintf(fp, "\"dur\":%.3f,", e.dur_ns / 1000.0);
+                } else {
+                    fprintf(fp, "\"s\":\"t\",");
+                }
+                fprintf(fp, "\"pid\":%d,\"tid\":%d,\"args\":{\"req\":%u,\"fd\":%d,\"arg\":%lld}}",
+                        pid, etid, e.req, e.fd, (long long)e.arg);
+                ++written;
+                // 入队到出队之间画一条跨线程的flow箭头
+                if(e.stage == ENQUEUE || e.stage == DEQUEUE) {
+                    fprintf(fp, ",\n{\"name\":\"queue\",\"cat\":\"req\",\"ph\":\"%s\",%s\"id\":%u,\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                            e.stage == ENQUEUE ? "s" : "f", e.stage == ENQUEUE ? "" : "\"bp\":\"e\",",
+                            e.req, e.ts_ns / 1000.0, pid, etid);
+                }
+            }
+        }
+        fprintf(fp, "\n]}\n");
+        return written;
+    }
+
+    // 导出到当前目录下的trace-<pid>-<序号>.json，返回文件名，失败返回空串
+    inline std::string dump_file() {
+        static std::atomic<int> seq{0};
+        char path[64];
+        snprintf(path, sizeof(path), "trace-%d-%d.json", getpid(), seq.fetch_add(1));
+        FILE* fp = fopen(path, "w");
+        if(!fp) {
+            return std::string();
+        }
+        size_t n = dump(fp);
+        fclose(fp);
+        printf("trace: %zu events written to %s\n", n, path);
+        return path;
+    }
+}
+}
+
+#endif
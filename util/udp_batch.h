@@ -0,0 +1,233 @@
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// 批量收发UDP数据报。数据报协议（QUIC之类）每个包都小于MTU，逐个sendto/recvfrom时系统调用和协议栈
+// 的开销按包计，远高于同样字节数的TCP。这里两头都做合并：
+//   接收：recvmmsg一次取多个报文；开了UDP_GRO后，内核把同一条流上连续到达的数据报合并成一个大报文，
+//         cmsg里给出分段大小，由这里再切回原来的数据报
+//   发送：发往同一地址的连续等长数据报拼进同一个缓冲，带UDP_SEGMENT交给内核分段（GSO），
+//         协议栈只走一遍；多个目的地址的报文再用一次sendmmsg发出
+namespace mirror {
+
+    struct udp_io_stats {
+        unsigned long long syscalls = 0;   // recvmmsg/sendmmsg的次数
+        unsigned long long messages = 0;   // 内核收发的报文数（GSO/GRO合并后的）
+        unsigned long long datagrams = 0;  // 切分前的数据报数
+        unsigned long long dropped = 0;    // 发送缓冲满或出错丢掉的数据报，由对端重传
+    };
+
+    class udp_rx_batch {
+    public:
+        static const int BATCH = 16;
+        static const size_t BUF_SIZE = 65536; // 合并后的报文最大接近64KB
+
+        // gro为false或内核不支持时，每个报文就是一个数据报
+        udp_rx_batch(int fd, bool gro) : m_fd(fd), m_bufs((char*)malloc(BATCH * BUF_SIZE)) {
+            int on = 1;
+            m_gro = gro && setsockopt(fd, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+            for(int i = 0; i < BATCH; ++i) {
+                m_iov[i].iov_base = m_bufs + i * BUF_SIZE;
+                m_iov[i].iov_len = BUF_SIZE;
+            }
+        }
+        ~udp_rx_batch() { free(m_bufs); }
+        udp_rx_batch(const udp_rx_batch&) = delete;
+        udp_rx_batch& operator=(const udp_rx_batch&) = delete;
+
+        // 收一批报文，对其中的每个数据报调用f(peer, peer_len, data, len)；返回收到的报文数，没有数据时返回0
+        template<typename F>
+        int recv(F&& f) {
+            for(int i = 0; i < BATCH; ++i) {
+                memset(&m_msgs[i].msg_hdr, 0, sizeof(m_msgs[i].msg_hdr));
+                m_msgs[i].msg_hdr.msg_name = &m_peers[i];
+                m_msgs[i].msg_hdr.msg_namelen = sizeof(m_peers[i]);
+                m_msgs[i].msg_hdr.msg_iov = &m_iov[i];
+                m_msgs[i].msg_hdr.msg_iovlen = 1;
+                m_msgs[i].msg_hdr.msg_control = m_control[i];
+                m_msgs[i].msg_hdr.msg_controllen = sizeof(m_control[i]);
+            }
+            int n = recvmmsg(m_fd, m_msgs, BATCH, MSG_DONTWAIT, NULL);
+            if(n <= 0) {
+                return 0;
+            }
+            ++m_stats.syscalls;
+            m_stats.messages += n;
+            for(int i = 0; i < n; ++i) {
+                const msghdr& h = m_msgs[i].msg_hdr;
+                size_t len = m_msgs[i].msg_len;
+                size_t seg = len;
+                for(cmsghdr* cm = CMSG_FIRSTHDR(&h); cm; cm = CMSG_NXTHDR((msghdr*)&h, cm)) {
+                    if(cm->cmsg_level == IPPROTO_UDP && cm->cmsg_type == UDP_GRO) {
+                        int gso_size;
+                        memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+                        seg = gso_size;
+                    }
+                }
+                const char* p = (const char*)m_iov[i].iov_base;
+                for(size_t off = 0; off < len; off += seg) {
+                    ++m_stats.datagrams;
+                    f(m_peers[i], h.msg_namelen, p + off, len - off < seg ? len - off : seg);
+                }
+            }
+            return n;
+        }
+
+        bool gro() const { return m_gro; }
+        const udp_io_stats& stats() const { return m_stats; }
+
+    private:
+        int m_fd;
+        bool m_gro;
+        char* m_bufs;
+        struct iovec m_iov[BATCH];
+        struct mmsghdr m_msgs[BATCH];
+        struct sockaddr_storage m_peers[BATCH];
+        char m_control[BATCH][CMSG_SPACE(sizeof(int))];
+        udp_io_stats m_stats;
+    };
+
+    class udp_tx_batch {
+    public:
+        static const int BATCH = 32;
+        static const size_t ARENA_SIZE = 512 * 1024;
+        static const size_t MAX_GSO_BYTES = 65000;  // 一个GSO报文的上限（UDP长度字段是16位）
+        static const int MAX_GSO_SEGMENTS = 64;     // 内核限制UDP_MAX_SEGMENTS
+
+        udp_tx_batch(int fd, bool gso) : m_fd(fd), m_arena((char*)malloc(ARENA_SIZE)) {
+            // 用setsockopt试一下内核是否认识UDP_SEGMENT；真正的分段大小随每次发送的cmsg给出
+            int seg = 0;
+            m_gso = gso && setsockopt(fd, IPPROTO_UDP, UDP_SEGMENT, &seg, sizeof(seg)) == 0;
+        }
+        ~udp_tx_batch() { free(m_arena); }
+        udp_tx_batch(const udp_tx_batch&) = delete;
+        udp_tx_batch& operator=(const udp_tx_batch&) = delete;
+
+        // 为一个len字节的数据报分配空间，调用者直接写进去，不再拷贝；放不下时先把攒着的发出去。
+        // 能接到上一个报文后面（同一地址、分段大小相同、还没有出现过短的尾段）时合进同一个GSO报文
+        char* alloc(const sockaddr_storage& peer, socklen_t peer_len, size_t len) {
+            if(m_used + len > ARENA_SIZE) {
+                flush();
+            }
+            message* last = m_count ? &m_queue[m_count - 1] : nullptr;
+            bool append = m_gso && last && !last->sealed && last->segments < MAX_GSO_SEGMENTS &&
+                          len <= last->seg && last->len + len <= MAX_GSO_BYTES &&
+                          peer_len == last->peer_len && memcmp(&peer, &last->peer, peer_len) == 0;
+            if(append) {
+                last->len += len;
+                ++last->segments;
+                last->sealed = len < last->seg; // 只有最后一段可以短
+            } else {
+                if(m_count == BATCH) {
+                    flush();
+                }
+                last = &m_queue[m_count++];
+                memcpy(&last->peer, &peer, peer_len);
+                last->peer_len = peer_len;
+                last->offset = m_used;
+                last->len = len;
+                last->seg = len;
+                last->segments = 1;
+                last->sealed = false;
+            }
+            char* p = m_arena + m_used;
+            m_used += len;
+            ++m_stats.datagrams;
+            return p;
+        }
+
+        // 把攒着的报文用sendmmsg发出去。发送缓冲满时剩下的直接丢掉，数据报协议本来就要处理丢包
+        void flush() {
+            struct mmsghdr msgs[BATCH];
+            struct iovec iov[BATCH];
+            char control[BATCH][CMSG_SPACE(sizeof(uint16_t))];
+            for(int i = 0; i < m_count; ++i) {
+                message& m = m_queue[i];
+                iov[i].iov_base = m_arena + m.offset;
+                iov[i].iov_len = m.len;
+                msghdr& h = msgs[i].msg_hdr;
+                memset(&h, 0, sizeof(h));
+                h.msg_name = &m.peer;
+                h.msg_namelen = m.peer_len;
+                h.msg_iov = &iov[i];
+                h.msg_iovlen = 1;
+                if(m.segments > 1) {
+                    h.msg_control = control[i];
+                    h.msg_controllen = sizeof(control[i]);
+                    cmsghdr* cm = CMSG_FIRSTHDR(&h);
+                    cm->cmsg_level = IPPROTO_UDP;
+                    cm->cmsg_type = UDP_SEGMENT;
+                    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                    uint16_t seg = m.seg;
+                    memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+                }
+            }
+            int sent = 0;
+            while(sent < m_count) {
+                int n = sendmmsg(m_fd, msgs + sent, m_count - sent, 0);
+                ++m_stats.syscalls;
+                if(n > 0) {
+                    m_stats.messages += n;
+                    sent += n;
+                    continue;
+                }
+                if(errno == EINTR) {
+                    continue;
+                }
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    for(; sent < m_count; ++sent) {
+                        m_stats.dropped += m_queue[sent].segments;
+                    }
+                    break;
+                }
+                if(errno == EIO && m_queue[sent].segments > 1) {
+                    // 出口网卡不支持校验和卸载时GSO会失败，之后不再合并
+                    m_gso = false;
+                }
+                m_stats.dropped += m_queue[sent].segments; // 跳过出错的报文，接着发后面的
+                ++sent;
+            }
+            m_count = 0;
+            m_used = 0;
+        }
+
+        bool gso() const { return m_gso; }
+        const udp_io_stats& stats() const { return m_stats; }
+
+    private:
+        struct message {
+            sockaddr_storage peer;
+            socklen_t peer_len;
+            size_t offset;    // 在m_arena中的起始位置
+            size_t len;
+            size_t seg;       // 分段大小，即第一个数据报的长度
+            int segments;
+            bool sealed;      // 已经有一个短的尾段，不能再接
+        };
+
+        int m_fd;
+        bool m_gso;
+        char* m_arena;        // 待发的数据报按顺序排在这里，同一个GSO报文的各段连续存放
+        size_t m_used = 0;
+        message m_queue[BATCH];
+        int m_count = 0;
+        udp_io_stats m_stats;
+    };
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <cstdio>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <vector>
+#include "fanout.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// WebSocket（RFC 6455）：升级握手、帧解析、负载去掩码和广播。
+// 会话只在reactor线程上访问（多线程版本里升级后的连接不再交给线程池），都不加锁。
+namespace mirror {
+
+    enum ws_opcode {WS_CONTINUATION = 0, WS_TEXT = 1, WS_BINARY = 2, WS_CLOSE = 8, WS_PING = 9, WS_PONG = 10};
+
+    // 握手只需要SHA-1算一次Sec-WebSocket-Accept，不值得为它依赖OpenSSL
+    inline void sha1(const void* data, size_t len, uint8_t out[20]) {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+        auto rol = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+        const uint8_t* p = (const uint8_t*)data;
+        uint64_t bits = (uint64_t)len * 8;
+        size_t total = (len + 9 + 63) / 64 * 64; // 补一个0x80和64位长度后按64字节分块
+        for(size_t off = 0; off < total; off += 64) {
+            uint8_t block[64];
+            for(size_t i = 0; i < 64; ++i) {
+                size_t k = off + i;
+                block[i] = k < len ? p[k] : k == len ? 0x80 : k >= total - 8 ? (uint8_t)(bits >> (8 * (total - 1 - k))) : 0;
+            }
+            uint32_t w[80];
+            for(int i = 0; i < 16; ++i) {
+                w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+            }
+            for(int i = 16; i < 80; ++i) {
+                w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+            }
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for(int i = 0; i < 80; ++i) {
+                uint32_t f, k;
+                if(i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+                else if(i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+                else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+                else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+                uint32_t t = rol(a, 5) + f + e + k + w[i];
+                e = d; d = c; c = rol(b, 30); b = a; a = t;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+        }
+        for(int i = 0; i < 20; ++i) {
+            out[i] = h[i / 4] >> (24 - 8 * (i % 4));
+        }
+    }
+
+    // Sec-WebSocket-Accept = base64(SHA-1(key + 固定GUID))，out至少29字节
+    inline void ws_accept_key(const char* key, char* out) {
+        static const char* guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        static const char* b64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        char buf[128];
+        int n = snprintf(buf, sizeof(buf), "%.60s%s", key, guid);
+        uint8_t d[21] = {0};
+        sha1(buf, n, d);
+        for(int i = 0, o = 0; i < 20; i += 3) {
+            uint32_t v = d[i] << 16 | d[i + 1] << 8 | d[i + 2]; // 最后一组只有2字节，d[20]是补的0
+            out[o++] = b64[v >> 18];
+            out[o++] = b64[(v >> 12) & 63];
+            out[o++] = b64[(v >> 6) & 63];
+            out[o++] = i + 2 < 20 ? b64[v & 63] : '=';
+        }
+        out[28] = '\0';
+    }
+
+    // 客户端发来的负载每个字节都和4字节掩码循环异或，消息大时这是解析里最耗时的一步。
+    // 把掩码铺满一个向量寄存器，每条指令处理16/32字节；向量处理的长度是4的倍数，剩下的部分接着按字节下标取掩码
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("avx2"))) inline size_t ws_unmask_avx2(uint8_t* p, size_t n, uint32_t mask) {
+        __m256i m = _mm256_set1_epi32(mask);
+        size_t i = 0;
+        for(; i + 32 <= n; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+            _mm256_storeu_si256((__m256i*)(p + i), _mm256_xor_si256(v, m));
+        }
+        return i;
+    }
+
+    __attribute__((target("sse2"))) inline size_t ws_unmask_sse2(uint8_t* p, size_t n, uint32_t mask) {
+        __m128i m = _mm_set1_epi32(mask);
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+            _mm_storeu_si128((__m128i*)(p + i), _mm_xor_si128(v, m));
+        }
+        return i;
+    }
+#endif
+
+    // 不用向量指令的版本，按8字节处理，也用于向量处理后剩下的尾部
+    inline void ws_unmask_scalar(uint8_t* p, size_t n, const uint8_t key[4], size_t i = 0) {
+        uint32_t m32;
+        memcpy(&m32, key, 4);
+        uint64_t m64 = (uint64_t)m32 << 32 | m32;
+        for(; i + 8 <= n; i += 8) {
+            uint64_t v;
+            memcpy(&v, p + i, 8);
+            v ^= m64;
+            memcpy(p + i, &v, 8);
+        }
+        for(; i < n; ++i) {
+            p[i] ^= key[i & 3];
+        }
+    }
+
+    inline void ws_unmask(uint8_t* p, size_t n, const uint8_t key[4]) {
+        size_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        uint32_t m32;
+        memcpy(&m32, key, 4);
+        i = avx2 ? ws_unmask_avx2(p, n, m32) : ws_unmask_sse2(p, n, m32);
+#endif
+        ws_unmask_scalar(p, n, key, i);
+    }
+
+    // 序列化好的服务端帧（服务端发的帧不加掩码）。广播时所有订阅者的发送队列引用同一份，
+    // 最后一个发完的释放；只在reactor线程上增减引用，不用原子量
+    class ws_frame : public shared_chunk {
+    public:
+        static ws_frame* make(int opcode, const void* payload, size_t len) {
+            size_t hdr = len < 126 ? 2 : len < 65536 ? 4 : 10;
+            ws_frame* f = alloc<ws_frame>(hdr + len);
+            uint8_t* p = (uint8_t*)f->data();
+            p[0] = 0x80 | opcode; // FIN，服务端的消息都不分片
+            if(hdr == 2) {
+                p[1] = len;
+            } else if(hdr == 4) {
+                p[1] = 126;
+                p[2] = len >> 8;
+                p[3] = len;
+            } else {
+                p[1] = 127;
+                for(int i = 0; i < 8; ++i) {
+                    p[2 + i] = (uint64_t)len >> (56 - 8 * i);
+                }
+            }
+            memcpy(p + hdr, payload, len);
+            return f;
+        }
+    };
+
+    // 一个WebSocket连接的状态：从读缓冲里解析客户端的帧，以及待发送帧的队列
+    class ws_session : public fanout_queue {
+    public:
+        static const size_t MAX_QUEUED = 1024; //发送队列上限，订阅者收得太慢时断开它，而不是无限攒内存
+
+        ws_session() : fanout_queue(MAX_QUEUED) {}
+
+        // 解析buf中[0, len)的数据：完整的数据消息交给on_message(opcode, payload, len)，
+        // ping自动回pong，close回close并进入closing。分片消息的各片在缓冲开头原地拼接，
+        // 所以一条消息（含最后一帧的帧头）最多cap字节，更大的消息回close 1009（Message Too Big）后断开。
+        // 返回剩余（不完整）数据的长度，已经挪到缓冲开头；协议错误返回-1。进入closing后收到的数据都丢掉
+        template<typename F>
+        int parse(char* buf, int len, int cap, F&& on_message) {
+            while(true) {
+                if(m_closing) {
+                    return 0;
+                }
+                int pos = m_msg_len; // [0, m_msg_len)是已拼好的分片消息
+                if(len - pos < 2) {
+                    break;
+                }
+                uint8_t b0 = buf[pos], b1 = buf[pos + 1];
+                int opcode = b0 & 0x0f;
+                bool fin = b0 & 0x80;
+                if(!(b1 & 0x80) || (b0 & 0x70)) {
+                    return -1; // 客户端的帧必须加掩码；没有协商扩展，RSV位必须为0
+                }
+                uint64_t plen = b1 & 0x7f;
+                int hdr = 2;
+                if(plen == 126) {
+                    if(len - pos < 4) {
+                        break;
+                    }
+                    plen = (uint8_t)buf[pos + 2] << 8 | (uint8_t)buf[pos + 3];
+                    hdr = 4;
+                } else if(plen == 127) {
+                    if(len - pos < 10) {
+                        break;
+                    }
+                    plen = 0;
+                    for(int i = 0; i < 8; ++i) {
+                        plen = plen << 8 | (uint8_t)buf[pos + 2 + i];
+                    }
+                    hdr = 10;
+                    if(plen >> 63) {
+                        return -1; // 64位长度的最高位必须为0（RFC 6455 5.2）
+                    }
+                }
+                // 不能在plen上做加法：接近2^64的长度会绕回来通过检查
+                if(hdr + 4 + pos > cap || plen > (uint64_t)(cap - hdr - 4 - pos)) {
+                    static const char too_big[2] = {0x03, (char)0xf1}; // 1009
+                    push_control(WS_CLOSE, too_big, 2);
+                    m_closing = true;
+                    m_msg_len = 0;
+                    m_msg_op = 0;
+                    return 0;
+                }
+                if((uint64_t)(len - pos) < hdr + 4 + plen) { // plen已经不超过cap，这里不会溢出
+                    break;
+                }
+                uint8_t key[4];
+                memcpy(key, buf + pos + hdr, 4);
+                char* payload = buf + pos + hdr + 4;
+                ws_unmask((uint8_t*)payload, plen, key);
+                int frame_len = hdr + 4 + plen;
+                m_ping_outstanding = false; // 收到任何帧都说明对端还活着
+
+                if(opcode >= WS_CLOSE) {
+                    if(!fin || plen > 125) {
+                        return -1;
+                    }
+                    if(opcode == WS_PING) {
+                        push_control(WS_PONG, payload, plen);
+                    } else if(opcode == WS_CLOSE) {
+                        push_control(WS_CLOSE, payload, plen >= 2 ? 2 : 0); // 回显状态码
+                        m_closing = true;
+                    } else if(opcode != WS_PONG) {
+                        return -1;
+                    }
+                    // 控制帧可以夹在分片之间，把它从缓冲里去掉
+                    memmove(buf + pos, buf + pos + frame_len, len - pos - frame_len);
+                    len -= frame_len;
+                    continue;
+                }
+                if((opcode == WS_CONTINUATION) != (m_msg_len > 0 || m_msg_op != 0)) {
+                    return -1; // 没有开头的后续分片，或者上一条消息还没结束又来了新消息
+                }
+                if(opcode != WS_CONTINUATION) {
+                    m_msg_op = opcode;
+                }
+                if(fin && m_msg_len == 0) {
+                    // 最常见的情况：不分片的消息，直接交出去
+                    on_message(m_msg_op, payload, (size_t)plen);
+                    m_msg_op = 0;
+                    memmove(buf, buf + frame_len, len - frame_len);
+                    len -= frame_len;
+                    continue;
+                }
+                // 把这一片的负载接到已拼好的部分后面
+                memmove(buf + m_msg_len, payload, plen);
+                memmove(buf + m_msg_len + plen, buf + pos + frame_len, len - pos - frame_len);
+                len -= hdr + 4;
+                m_msg_len += plen;
+                if(fin) {
+                    on_message(m_msg_op, buf, (size_t)m_msg_len);
+                    memmove(buf, buf + m_msg_len, len - m_msg_len);
+                    len -= m_msg_len;
+                    m_msg_len = 0;
+                    m_msg_op = 0;
+                }
+            }
+            return len;
+        }
+
+        void ping() {
+            push_control(WS_PING, nullptr, 0);
+            m_ping_outstanding = true;
+        }
+
+        bool closing() const { return m_closing; }
+        bool ping_outstanding() const { return m_ping_outstanding; }
+
+    private:
+        void push_control(int opcode, const char* payload, size_t len) {
+            ws_frame* f = ws_frame::make(opcode, payload, len);
+            if(!push(f)) {
+                f->unref();
+            }
+        }
+
+        int m_msg_len = 0;        // 正在拼接的分片消息已有的长度
+        int m_msg_op = 0;         // 正在拼接的消息的类型，0表示没有
+        bool m_closing = false;   // 收到了close，回完close就断开
+        bool m_ping_outstanding = false;
+    };
+
+    template<typename conn>
+    struct ws_access {
+        static ws_session* queue(conn* c) { return c->ws(); }
+        static int flush(conn* c) { return c->ws_flush(); }
+        static void abort(conn* c) { c->ws_abort(); }
+    };
+
+    // 一个广播频道：订阅者是升级到WebSocket的连接，广播只把同一个帧的引用挂到各订阅者的队列上。
+    // conn需要提供 ws_session* ws()、int ws_flush()（1发完，0发送缓冲满，-1出错）和 void ws_abort()
+    template<typename conn>
+    class ws_hub : public fanout_hub<conn, ws_access<conn>> {
+    public:
+        explicit ws_hub(const char* path) : m_path(path) {}
+
+        const char* path() const { return m_path; }
+
+        // 发给除except以外的所有订阅者，f的一个引用归hub
+        void broadcast(ws_frame* f, conn* except = nullptr) {
+            f->ref(this->m_subs.size());
+            for(conn* c : this->m_subs) {
+                ws_session* s = c->ws();
+                if(c == except || !s->push(f)) {
+                    f->unref();
+                    if(c != except) {
+                        c->ws_abort(); // 积压太多，断开这个订阅者，连接由事件循环关闭
+                    }
+                    continue;
+                }
+                this->mark(c);
+            }
+            f->unref();
+            ++m_broadcasts;
+        }
+
+        unsigned long long broadcasts() const { return m_broadcasts; }
+
+    private:
+        const char* m_path;
+        unsigned long long m_broadcasts = 0;
+    };
+}
+
+#endif
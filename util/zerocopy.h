@@ -0,0 +1,151 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <utility>
+
+// MSG_ZEROCOPY发送：内核直接引用用户内存里的页，不再拷进socket缓冲，
+// 代价是发送返回后这块内存还不能改也不能释放，要等socket错误队列里的完成通知。
+// 小块数据加锁页和收通知的开销比拷贝还大，只对足够大的响应体使用。
+namespace mirror {
+
+    // 被零拷贝发送引用的一段mmap内存，最后一个引用释放时才munmap
+    class zc_buffer {
+    public:
+        zc_buffer(void* addr, size_t len) : m_addr(addr), m_len(len), m_refs(1) {}
+        void ref() { ++m_refs; }
+        void unref() {
+            if(--m_refs == 0) {
+                munmap(m_addr, m_len);
+                delete this;
+            }
+        }
+    private:
+        ~zc_buffer() = default;
+        void* m_addr;
+        size_t m_len;
+        int m_refs; // 只有持有连接的线程访问，不需要原子量
+    };
+
+    // 一个连接上的零拷贝状态：每次成功的MSG_ZEROCOPY发送占用一个通知号，
+    // 按发送顺序记下它引用的缓冲，通知号完成后释放引用
+    class zc_sender {
+    public:
+        ~zc_sender() { reset(); }
+
+        // 第一次需要时打开SO_ZEROCOPY，内核不支持或之前发现总被拷贝时返回false
+        bool usable(int fd) {
+            if(m_state == UNTRIED) {
+                int one = 1;
+                m_state = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0 ? ON : OFF;
+            }
+            return m_state == ON;
+        }
+
+        // 发送一块内存，buf为空表示内存常驻（如资源包），不需要引用计数；返回值同send
+        ssize_t send(int fd, const void* data, size_t len, zc_buffer* buf) {
+            ssize_t ret = ::send(fd, data, len, MSG_ZEROCOPY | MSG_NOSIGNAL);
+            if(ret == -1 && errno == ENOBUFS) {
+                // 未完成的通知太多，超出了optmem限制，这次退回普通发送
+                return ::send(fd, data, len, MSG_NOSIGNAL);
+            }
+            if(ret > 0) {
+                if(buf) {
+                    buf->ref();
+                }
+                m_pending.push_back({buf, false});
+            }
+            return ret;
+        }
+
+        // 取出错误队列里的完成通知并释放对应的引用，返回处理的通知数，-1表示队列里有别的错误
+        int reap(int fd) {
+            int reaped = 0;
+            while(true) {
+                char control[CMSG_SPACE(sizeof(sock_extended_err)) + 64];
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+                if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+                    return reaped;
+                }
+                struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+                if(!cm || !((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                    return -1;
+                }
+                const sock_extended_err* serr = (const sock_extended_err*)CMSG_DATA(cm);
+                if(serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                    return -1;
+                }
+                // 通知号区间[ee_info, ee_data]，相邻的完成会被内核合并成一条
+                complete(serr->ee_info, serr->ee_data);
+                if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    // 内核最后还是拷贝了（如发往本机），零拷贝只剩额外开销，这个连接不再使用
+                    m_state = OFF;
+                }
+                ++reaped;
+            }
+        }
+
+        bool tried() const { return m_state != UNTRIED; }
+        bool outstanding() const { return m_head < m_pending.size(); }
+
+        // 连接关闭时调用：fd关掉后收不到通知了，但内核仍持有发送中的页的引用，
+        // 这里直接释放映射是安全的
+        void reset() {
+            for(size_t i = m_head; i < m_pending.size(); ++i) {
+                if(m_pending[i].first) {
+                    m_pending[i].first->unref();
+                }
+            }
+            m_pending.clear();
+            m_head = 0;
+            m_base = 0;
+            m_state = UNTRIED;
+        }
+
+    private:
+        enum state {UNTRIED, ON, OFF};
+
+        void complete(uint32_t lo, uint32_t hi) {
+            for(uint32_t id = lo; ; ++id) {
+                size_t idx = m_head + (uint32_t)(id - m_base);
+                if(idx < m_pending.size()) {
+                    m_pending[idx].second = true;
+                }
+                if(id == hi) {
+                    break;
+                }
+            }
+            // 通知可能乱序到达，只从队头按顺序释放
+            while(m_head < m_pending.size() && m_pending[m_head].second) {
+                if(m_pending[m_head].first) {
+                    m_pending[m_head].first->unref();
+                }
+                ++m_head;
+                ++m_base;
+            }
+            if(m_head == m_pending.size()) {
+                m_pending.clear(); // 全部完成，保留容量
+                m_head = 0;
+            }
+        }
+
+        state m_state = UNTRIED;
+        uint32_t m_base = 0;                                 // m_pending[m_head]的通知号
+        size_t m_head = 0;                                   // 第一个未完成的发送
+        std::vector<std::pair<zc_buffer*, bool>> m_pending;  // 引用的缓冲，是否已完成；默认构造不分配内存
+    };
+}
+
+#endif